@@ -0,0 +1,918 @@
+// Benchmarks radix_tree on synthetic autocomplete workloads against std::map
+// and sorted-vector prefix search. Every structure answers the same queries
+// and the answers are cross-checked; a mismatch fails the run.
+//
+//   radix_bench [--workload=NAME|all] [--patterns=N] [--queries=N]
+//               [--seed=S] [--k=K] [--stats=1]
+//
+// --stats=1 prints the tree's shape, and its query counters if the library
+// is built with RADIX_ENABLE_COUNTERS, to stderr.
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "radix.h"
+#include "radix_handle.h"
+#include "radix_sharded.h"
+#include "workloads.h"
+
+// Live heap bytes, for the memory footprint of each structure.
+static std::atomic<size_t> g_heap_bytes{0};
+
+void* operator new(size_t size) {
+  void* block = malloc(size == 0 ? 1 : size);
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  g_heap_bytes += malloc_usable_size(block);
+  return block;
+}
+
+void operator delete(void* block) noexcept {
+  if (block != nullptr) {
+    g_heap_bytes -= malloc_usable_size(block);
+    free(block);
+  }
+}
+
+void operator delete(void* block, size_t) noexcept {
+  operator delete(block);
+}
+
+namespace radix {
+namespace bench {
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+struct options {
+  std::string workload = "all";
+  size_t patterns = 100000;
+  size_t queries = 100000;
+  uint64_t seed = 1;
+  int k = 10;
+  bool stats = false;
+};
+
+struct compare_ids {
+  bool operator()(int a, int b) const { return a < b; }
+};
+
+// Score of a value for the scored benchmarks, in [0, 1).
+float score_of(int id) {
+  return (static_cast<uint32_t>(id) * 2654435761u >> 8) / 16777216.0f;
+}
+
+// The order of match_scored() for values scored by score_of().
+struct compare_scores {
+  bool operator()(int a, int b) const {
+    float sa = score_of(a);
+    float sb = score_of(b);
+    return sa > sb || (sa == sb && a < b);
+  }
+};
+
+// Per-operation latencies of one benchmark.
+class samples {
+ public:
+  void add(clock_type::time_point begin, clock_type::time_point end) {
+    m_ns.push_back(
+        std::chrono::duration<double, std::nano>(end - begin).count());
+  }
+
+  void report(const std::string& workload,
+              const char* structure,
+              const char* operation) {
+    std::sort(m_ns.begin(), m_ns.end());
+    double total = 0;
+    for (double ns : m_ns) {
+      total += ns;
+    }
+    double mean = m_ns.empty() ? 0 : total / m_ns.size();
+    printf("%-12s %-8s %-14s %10zu %12.0f %10.1f %10.1f %10.1f %10.1f\n",
+           workload.c_str(), structure, operation, m_ns.size(),
+           total > 0 ? m_ns.size() * 1e9 / total : 0, mean, percentile(0.50),
+           percentile(0.90), percentile(0.99));
+    m_ns.clear();
+  }
+
+ private:
+  double percentile(double p) const {
+    if (m_ns.empty()) {
+      return 0;
+    }
+    size_t rank = static_cast<size_t>(p * m_ns.size());
+    return m_ns[std::min(m_ns.size() - 1, rank)];
+  }
+
+  std::vector<double> m_ns;
+};
+
+// A single timed operation over "ops" items, reported as per-item averages.
+void report_total(const std::string& workload,
+                  const char* structure,
+                  const char* operation,
+                  size_t ops,
+                  clock_type::time_point begin,
+                  clock_type::time_point end) {
+  double ns = std::chrono::duration<double, std::nano>(end - begin).count();
+  double mean = ops > 0 ? ns / ops : 0;
+  printf("%-12s %-8s %-14s %10zu %12.0f %10.1f %10s %10s %10s\n",
+         workload.c_str(), structure, operation, ops,
+         ns > 0 ? ops * 1e9 / ns : 0, mean, "-", "-", "-");
+}
+
+void report_memory(const std::string& workload,
+                   const char* structure,
+                   size_t bytes,
+                   size_t patterns,
+                   const char* op = "memory") {
+  printf("%-12s %-8s %-14s %10zu %12s %10.1f bytes/key\n", workload.c_str(),
+         structure, op, bytes, "-",
+         patterns > 0 ? static_cast<double>(bytes) / patterns : 0);
+}
+
+// What every structure must return for each query: the number of values
+// under the prefix and a checksum of its top-k list.
+struct answers {
+  std::vector<size_t> counts;
+  std::vector<uint64_t> top;
+
+  explicit answers(size_t n) : counts(n), top(n) {}
+};
+
+uint64_t checksum(const std::vector<int>& values) {
+  uint64_t sum = values.size();
+  for (int value : values) {
+    sum = sum * 1000003 + static_cast<uint64_t>(value);
+  }
+  return sum;
+}
+
+// The code points of "s", each packed into an integer.
+std::vector<uint32_t> code_points(const std::string& s) {
+  std::vector<uint32_t> result;
+  for (size_t i = 0; i < s.size();) {
+    size_t len = std::max<size_t>(radix_utf8_length(s[i]), 1);
+    uint32_t packed = 0;
+    for (size_t j = 0; j < len && i + j < s.size(); ++j) {
+      packed = packed << 8 | static_cast<unsigned char>(s[i + j]);
+    }
+    result.push_back(packed);
+    i += len;
+  }
+  return result;
+}
+
+// Whether a prefix of "pattern" is within "max_edits" code point edits of
+// "key", by the Levenshtein matrix of the two, a row per pattern code point.
+bool fuzzy_prefix(const std::vector<uint32_t>& pattern,
+                  const std::vector<uint32_t>& key,
+                  int max_edits) {
+  size_t n = key.size();
+  std::vector<int> row(n + 1);
+  for (size_t j = 0; j <= n; ++j) {
+    row[j] = j;
+  }
+  if (row[n] <= max_edits) {
+    return true;
+  }
+  for (uint32_t uchar : pattern) {
+    int diagonal = row[0];
+    int best = ++row[0];
+    for (size_t j = 1; j <= n; ++j) {
+      int above = row[j];
+      row[j] = std::min(diagonal + (key[j - 1] == uchar ? 0 : 1),
+                        std::min(above, row[j - 1]) + 1);
+      diagonal = above;
+      best = std::min(best, row[j]);
+    }
+    if (row[n] <= max_edits) {
+      return true;
+    }
+    if (best > max_edits) {
+      return false;
+    }
+  }
+  return false;
+}
+
+// The top-k list of match(): the k smallest distinct values, ascending.
+void top_k(std::vector<int>* values, int k) {
+  std::sort(values->begin(), values->end());
+  values->erase(std::unique(values->begin(), values->end()), values->end());
+  if (values->size() > static_cast<size_t>(k)) {
+    values->resize(k);
+  }
+}
+
+bool check(const std::string& workload,
+           const char* structure,
+           const answers& expected,
+           const answers& got) {
+  for (size_t i = 0; i < expected.counts.size(); ++i) {
+    if (expected.counts[i] != got.counts[i] || expected.top[i] != got.top[i]) {
+      fprintf(stderr, "%s: %s disagrees with radix on query %zu\n",
+              workload.c_str(), structure, i);
+      return false;
+    }
+  }
+  return true;
+}
+
+void print_histogram(const char* name, const std::vector<size_t>& counts) {
+  fprintf(stderr, "  %-8s", name);
+  for (size_t count : counts) {
+    fprintf(stderr, " %zu", count);
+  }
+  fprintf(stderr, "\n");
+}
+
+void print_stats(const std::string& workload, const radix_tree<int>& tree) {
+  radix_tree_stats shape = tree.stats();
+  fprintf(stderr,
+          "%s: %zu inner nodes, %zu leaves, %zu values, max depth %zu, "
+          "%zu top-k lists holding %zu values\n",
+          workload.c_str(), shape.inner_nodes, shape.leaves, shape.values,
+          shape.max_depth, shape.heap_nodes, shape.heap_values);
+  fprintf(stderr, "  bytes    nodes %zu keys %zu values %zu heaps %zu "
+          "reserved %zu\n",
+          shape.memory.node_bytes, shape.memory.key_bytes,
+          shape.memory.value_bytes, shape.memory.heap_bytes,
+          shape.memory.reserved_bytes);
+  print_histogram("depth", shape.depth);
+  print_histogram("fanout", shape.fanout);
+
+  radix_query_stats queries = tree.query_stats();
+  if (queries.lookups == 0) {
+    return;
+  }
+  fprintf(stderr,
+          "  queries  %llu lookups, %llu misses, %llu heap hits, %llu scans "
+          "over %llu leaves, %llu deduplicated values (max %llu)\n",
+          static_cast<unsigned long long>(queries.lookups),
+          static_cast<unsigned long long>(queries.misses),
+          static_cast<unsigned long long>(queries.heap_hits),
+          static_cast<unsigned long long>(queries.scans),
+          static_cast<unsigned long long>(queries.leaves_scanned),
+          static_cast<unsigned long long>(queries.dedup_values),
+          static_cast<unsigned long long>(queries.max_dedup));
+  std::vector<size_t> latency(std::begin(queries.latency),
+                              std::end(queries.latency));
+  while (!latency.empty() && latency.back() == 0) {
+    latency.pop_back();
+  }
+  print_histogram("log2 ns", latency);
+}
+
+bool run_radix(const workload& w, const options& opt, answers* result) {
+  samples timing;
+  size_t heap_before = g_heap_bytes;
+  radix_tree<int> tree;
+  for (const auto& entry : w.patterns) {
+    clock_type::time_point begin = clock_type::now();
+    tree.insert(entry.first, entry.second);
+    timing.add(begin, clock_type::now());
+  }
+  timing.report(w.name, "radix", "insert");
+
+  clock_type::time_point begin = clock_type::now();
+  tree.finish(compare_ids(), opt.k);
+  report_total(w.name, "radix", "finish", 1, begin, clock_type::now());
+  report_memory(w.name, "radix", g_heap_bytes - heap_before,
+                w.patterns.size());
+
+  std::vector<int> values;
+  for (size_t i = 0; i < w.queries.size(); ++i) {
+    values.clear();
+    clock_type::time_point begin = clock_type::now();
+    tree.match(w.queries[i], values);
+    timing.add(begin, clock_type::now());
+    result->counts[i] = values.size();
+  }
+  timing.report(w.name, "radix", "match");
+
+  for (size_t i = 0; i < w.queries.size(); ++i) {
+    values.clear();
+    clock_type::time_point begin = clock_type::now();
+    tree.match(w.queries[i], values, compare_ids(), opt.k);
+    timing.add(begin, clock_type::now());
+    result->top[i] = checksum(values);
+  }
+  timing.report(w.name, "radix", "match_topk");
+
+  bool ok = true;
+  // The same through a std::function, which the comparisons cannot inline.
+  std::function<bool(int, int)> compfunc = compare_ids();
+  for (size_t i = 0; i < w.queries.size(); ++i) {
+    values.clear();
+    clock_type::time_point begin = clock_type::now();
+    tree.match(w.queries[i], values, compfunc, opt.k);
+    timing.add(begin, clock_type::now());
+    ok = ok && checksum(values) == result->top[i];
+  }
+  timing.report(w.name, "radix", "match_topk_fn");
+
+  // Again with duplicates skipped by the dense stamp array.
+  int max_id = 0;
+  for (const auto& entry : w.patterns) {
+    max_id = std::max(max_id, entry.second);
+  }
+  tree.set_value_domain(max_id + 1);
+  for (size_t i = 0; i < w.queries.size(); ++i) {
+    values.clear();
+    clock_type::time_point begin = clock_type::now();
+    tree.match(w.queries[i], values, compare_ids(), opt.k);
+    timing.add(begin, clock_type::now());
+    ok = ok && checksum(values) == result->top[i];
+  }
+  timing.report(w.name, "radix", "topk_dense");
+  tree.set_value_domain(0);
+
+  // Lists built by the queries themselves for the prefixes they hit, in
+  // 1 MB, timed after a pass that earns them.
+  tree.finish_adaptive(compare_ids(), opt.k, 1 << 20);
+  for (int pass = 0; pass < 2; ++pass) {
+    for (size_t i = 0; i < w.queries.size(); ++i) {
+      values.clear();
+      clock_type::time_point begin = clock_type::now();
+      tree.match(w.queries[i], values, compare_ids(), opt.k);
+      if (pass == 1) {
+        timing.add(begin, clock_type::now());
+      }
+      ok = ok && checksum(values) == result->top[i];
+    }
+  }
+  timing.report(w.name, "radix", "topk_adaptive");
+  if (opt.stats) {
+    radix_adaptive_stats adaptive = tree.adaptive_stats();
+    fprintf(stderr,
+            "%s: adaptive %llu lists built, %llu evicted, %zu of %zu held\n",
+            w.name.c_str(), static_cast<unsigned long long>(adaptive.builds),
+            static_cast<unsigned long long>(adaptive.evictions),
+            adaptive.lists, adaptive.max_lists);
+  }
+  tree.finish(compare_ids(), opt.k);
+
+  // Again with the result cache, after a pass that fills it.
+  tree.set_cache_capacity(64 << 20);
+  for (int pass = 0; pass < 2; ++pass) {
+    for (size_t i = 0; i < w.queries.size(); ++i) {
+      values.clear();
+      clock_type::time_point begin = clock_type::now();
+      tree.match(w.queries[i], values, compare_ids(), opt.k);
+      if (pass == 1) {
+        timing.add(begin, clock_type::now());
+      }
+      ok = ok && checksum(values) == result->top[i];
+    }
+  }
+  timing.report(w.name, "radix", "topk_cached");
+  if (opt.stats) {
+    radix_cache_stats cache = tree.cache_stats();
+    fprintf(stderr,
+            "%s: cache %llu hits, %llu misses, %zu lists in %zu bytes\n",
+            w.name.c_str(), static_cast<unsigned long long>(cache.hits),
+            static_cast<unsigned long long>(cache.misses), cache.entries,
+            cache.bytes);
+  }
+  tree.set_cache_capacity(0);
+
+  // The same patterns with scores, ranked by score with precomputed lists,
+  // checked against the values of the unscored tree ranked by score.
+  {
+    radix_tree<int> scored;
+    for (const auto& entry : w.patterns) {
+      scored.insert(entry.first, entry.second, score_of(entry.second));
+    }
+    scored.finish_scored(opt.k);
+    std::vector<int> expected;
+    for (size_t i = 0; i < w.queries.size(); ++i) {
+      values.clear();
+      clock_type::time_point begin = clock_type::now();
+      scored.match_scored(w.queries[i], values, opt.k);
+      timing.add(begin, clock_type::now());
+      // The lists of "tree" are by id, so rank all of its values here.
+      expected.clear();
+      tree.match(w.queries[i], expected);
+      std::sort(expected.begin(), expected.end(), compare_scores());
+      expected.erase(std::unique(expected.begin(), expected.end()),
+                     expected.end());
+      if (expected.size() > static_cast<size_t>(opt.k)) {
+        expected.resize(opt.k);
+      }
+      ok = ok && values == expected;
+    }
+    timing.report(w.name, "radix", "scored_topk");
+
+    // Only values scoring at least 0.9.
+    for (size_t i = 0; i < w.queries.size(); ++i) {
+      values.clear();
+      clock_type::time_point begin = clock_type::now();
+      scored.match_scored(w.queries[i], values, opt.k, 0.9f);
+      timing.add(begin, clock_type::now());
+      ok = ok && std::all_of(values.begin(), values.end(),
+                             [](int id) { return score_of(id) >= 0.9f; });
+    }
+    timing.report(w.name, "radix", "scored_min");
+  }
+
+  std::vector<uint64_t> fuzzy_top(w.queries.size());
+  for (size_t i = 0; i < w.queries.size(); ++i) {
+    values.clear();
+    clock_type::time_point begin = clock_type::now();
+    tree.fuzzy_match(w.queries[i], 1, values, compare_ids(), opt.k);
+    timing.add(begin, clock_type::now());
+    fuzzy_top[i] = checksum(values);
+  }
+  timing.report(w.name, "radix", "fuzzy1_topk");
+
+  // Check the first queries, both forms, against every pattern's prefixes.
+  bool fuzzy_ok = true;
+  {
+    static const size_t kFuzzyChecks = 100;
+    std::vector<std::pair<std::string, int>> sorted(w.patterns);
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const std::pair<std::string, int>& a,
+                        const std::pair<std::string, int>& b) {
+                       return a.first < b.first;
+                     });
+    std::vector<std::vector<uint32_t>> patterns;
+    for (const auto& entry : sorted) {
+      patterns.push_back(code_points(entry.first));
+    }
+    std::vector<int> expected;
+    for (size_t i = 0; i < w.queries.size() && i < kFuzzyChecks; ++i) {
+      std::vector<uint32_t> key = code_points(w.queries[i]);
+      expected.clear();
+      for (size_t j = 0; j < sorted.size(); ++j) {
+        if (fuzzy_prefix(patterns[j], key, 1)) {
+          expected.push_back(sorted[j].second);
+        }
+      }
+      values.clear();
+      tree.fuzzy_match(w.queries[i], 1, values);
+      fuzzy_ok = fuzzy_ok && values == expected;
+      top_k(&expected, opt.k);
+      fuzzy_ok = fuzzy_ok && checksum(expected) == fuzzy_top[i];
+    }
+    if (!fuzzy_ok) {
+      fprintf(stderr, "%s: fuzzy_match() disagrees with a brute force\n",
+              w.name.c_str());
+    }
+  }
+
+  for (size_t i = 0; i < w.queries.size(); ++i) {
+    size_t count = 0;
+    clock_type::time_point begin = clock_type::now();
+    for (radix_tree_iter<int> it = tree.match(w.queries[i]); it.valid();
+         it.next()) {
+      ++count;
+    }
+    timing.add(begin, clock_type::now());
+    ok = ok && count == result->counts[i];
+  }
+  timing.report(w.name, "radix", "match_iter");
+
+  // A page of 20 patterns 500 patterns into the query's, or its last one.
+  for (size_t i = 0; i < w.queries.size(); ++i) {
+    clock_type::time_point begin = clock_type::now();
+    radix_tree_iter<int> it = tree.match(w.queries[i]);
+    ok = ok && static_cast<size_t>(it.count()) == result->counts[i];
+    it.reset(500, 20);
+    for (int n = 0; n < 20 && it.valid(); ++n) {
+      it.next();
+    }
+    timing.add(begin, clock_type::now());
+  }
+  timing.report(w.name, "radix", "page_500");
+
+  // A page of 20 patterns from the query on, as in alphabetical listings.
+  for (const std::string& query : w.queries) {
+    clock_type::time_point begin = clock_type::now();
+    radix_tree_iter<int> it = tree.lower_bound(query);
+    for (int n = 0; n < 20 && it.valid(); ++n) {
+      it.next();
+    }
+    timing.add(begin, clock_type::now());
+  }
+  timing.report(w.name, "radix", "scan_20");
+
+  std::vector<std::vector<int>> batch;
+  begin = clock_type::now();
+  tree.match_batch(w.queries, batch, compare_ids(), opt.k);
+  report_total(w.name, "radix", "match_batch", w.queries.size(), begin,
+               clock_type::now());
+  for (size_t i = 0; i < w.queries.size(); ++i) {
+    ok = ok && checksum(batch[i]) == result->top[i];
+  }
+  if (!ok) {
+    fprintf(stderr, "%s: radix iterator or batch disagrees with match()\n",
+            w.name.c_str());
+  }
+  if (opt.stats) {
+    print_stats(w.name, tree);
+  }
+
+  std::vector<std::pair<std::string, int>> sorted(w.patterns);
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const std::pair<std::string, int>& a,
+                      const std::pair<std::string, int>& b) {
+                     return a.first < b.first;
+                   });
+  radix_tree<int> loaded;
+  begin = clock_type::now();
+  size_t rejected =
+      loaded.bulk_load(sorted.begin(), sorted.end(), compare_ids(), opt.k);
+  report_total(w.name, "radix", "bulk_load", sorted.size(), begin,
+               clock_type::now());
+  // The loaded tree, and the top-k lists the loader built, must answer as
+  // the inserted one does.
+  bool loaded_ok = rejected == 0;
+  for (size_t i = 0; i < w.queries.size() && loaded_ok; ++i) {
+    values.clear();
+    loaded.match(w.queries[i], values);
+    loaded_ok = values.size() == result->counts[i];
+    values.clear();
+    loaded.match(w.queries[i], values, compare_ids(), opt.k);
+    loaded_ok = loaded_ok && checksum(values) == result->top[i];
+  }
+  if (!loaded_ok) {
+    fprintf(stderr, "%s: bulk_load disagrees with insert()\n",
+            w.name.c_str());
+  }
+  return ok && fuzzy_ok && loaded_ok;
+}
+
+answers run_map(const workload& w, const options& opt) {
+  answers result(w.queries.size());
+  samples timing;
+  size_t heap_before = g_heap_bytes;
+  std::map<std::string, std::vector<int>> index;
+  for (const auto& entry : w.patterns) {
+    clock_type::time_point begin = clock_type::now();
+    index[entry.first].push_back(entry.second);
+    timing.add(begin, clock_type::now());
+  }
+  timing.report(w.name, "map", "insert");
+  report_memory(w.name, "map", g_heap_bytes - heap_before, w.patterns.size());
+
+  std::vector<int> values;
+  for (size_t i = 0; i < w.queries.size(); ++i) {
+    const std::string& query = w.queries[i];
+    values.clear();
+    clock_type::time_point begin = clock_type::now();
+    for (auto it = index.lower_bound(query);
+         it != index.end() && it->first.compare(0, query.size(), query) == 0;
+         ++it) {
+      values.insert(values.end(), it->second.begin(), it->second.end());
+    }
+    timing.add(begin, clock_type::now());
+    result.counts[i] = values.size();
+  }
+  timing.report(w.name, "map", "match");
+
+  for (size_t i = 0; i < w.queries.size(); ++i) {
+    const std::string& query = w.queries[i];
+    values.clear();
+    clock_type::time_point begin = clock_type::now();
+    for (auto it = index.lower_bound(query);
+         it != index.end() && it->first.compare(0, query.size(), query) == 0;
+         ++it) {
+      values.insert(values.end(), it->second.begin(), it->second.end());
+    }
+    top_k(&values, opt.k);
+    timing.add(begin, clock_type::now());
+    result.top[i] = checksum(values);
+  }
+  timing.report(w.name, "map", "match_topk");
+  return result;
+}
+
+answers run_sorted_vector(const workload& w, const options& opt) {
+  answers result(w.queries.size());
+  typedef std::pair<std::string, int> entry;
+  size_t heap_before = g_heap_bytes;
+  clock_type::time_point begin = clock_type::now();
+  std::vector<entry> index(w.patterns);
+  std::sort(index.begin(), index.end());
+  report_total(w.name, "vector", "build", index.size(), begin,
+               clock_type::now());
+  report_memory(w.name, "vector", g_heap_bytes - heap_before,
+                w.patterns.size());
+
+  samples timing;
+  std::vector<int> values;
+  for (int pass = 0; pass < 2; ++pass) {
+    for (size_t i = 0; i < w.queries.size(); ++i) {
+      const std::string& query = w.queries[i];
+      values.clear();
+      clock_type::time_point begin = clock_type::now();
+      auto it = std::lower_bound(
+          index.begin(), index.end(), query,
+          [](const entry& e, const std::string& key) { return e.first < key; });
+      for (; it != index.end() &&
+             it->first.compare(0, query.size(), query) == 0;
+           ++it) {
+        values.push_back(it->second);
+      }
+      if (pass == 1) {
+        top_k(&values, opt.k);
+      }
+      timing.add(begin, clock_type::now());
+      if (pass == 0) {
+        result.counts[i] = values.size();
+      } else {
+        result.top[i] = checksum(values);
+      }
+    }
+    timing.report(w.name, "vector", pass == 0 ? "match" : "match_topk");
+  }
+  return result;
+}
+
+// Batch insert and finish() run one thread per shard.
+answers run_sharded(const workload& w, const options& opt) {
+  answers result(w.queries.size());
+  samples timing;
+  radix_sharded_tree<int> tree(16);
+  clock_type::time_point begin = clock_type::now();
+  tree.insert(w.patterns.begin(), w.patterns.end());
+  report_total(w.name, "sharded", "insert_batch", w.patterns.size(), begin,
+               clock_type::now());
+  begin = clock_type::now();
+  tree.finish(compare_ids(), opt.k);
+  report_total(w.name, "sharded", "finish", 1, begin, clock_type::now());
+
+  std::vector<int> values;
+  for (size_t i = 0; i < w.queries.size(); ++i) {
+    values.clear();
+    tree.match(w.queries[i], values);
+    result.counts[i] = values.size();
+  }
+  for (size_t i = 0; i < w.queries.size(); ++i) {
+    values.clear();
+    clock_type::time_point begin = clock_type::now();
+    tree.match(w.queries[i], values, compare_ids(), opt.k);
+    timing.add(begin, clock_type::now());
+    result.top[i] = checksum(values);
+  }
+  timing.report(w.name, "sharded", "match_topk");
+  return result;
+}
+
+// Queries through a radix_tree_handle, the top-k ones while the next tree is
+// built on the background thread and swapped in under them.
+answers run_handle(const workload& w, const options& opt) {
+  answers result(w.queries.size());
+  samples timing;
+  radix_tree_handle<int> handle;
+  auto build = [&w, &opt](radix_tree<int>& tree) {
+    for (const auto& entry : w.patterns) {
+      tree.insert(entry.first, entry.second);
+    }
+    tree.finish(compare_ids(), opt.k);
+  };
+  clock_type::time_point begin = clock_type::now();
+  handle.rebuild(build);
+  handle.wait();
+  report_total(w.name, "handle", "rebuild", 1, begin, clock_type::now());
+
+  std::vector<int> values;
+  for (size_t i = 0; i < w.queries.size(); ++i) {
+    values.clear();
+    handle.match(w.queries[i], values);
+    result.counts[i] = values.size();
+  }
+  handle.rebuild(build);
+  for (size_t i = 0; i < w.queries.size(); ++i) {
+    values.clear();
+    clock_type::time_point begin = clock_type::now();
+    handle.match(w.queries[i], values, compare_ids(), opt.k);
+    timing.add(begin, clock_type::now());
+    result.top[i] = checksum(values);
+  }
+  timing.report(w.name, "handle", "topk_rebuild");
+  handle.wait();
+  return result;
+}
+
+// "Contains" top-k queries over a prefix of the patterns, against the
+// linear scan they replace. Every suffix is a leaf, so the index is kept
+// small.
+bool run_infix(const workload& w, const options& opt) {
+  static const size_t kInfixPatterns = 10000;
+  static const size_t kInfixQueries = 1000;
+  size_t patterns = std::min(w.patterns.size(), kInfixPatterns);
+  size_t queries = std::min(w.queries.size(), kInfixQueries);
+  samples timing;
+  size_t heap_before = g_heap_bytes;
+  radix_tree<int> tree;
+  tree.set_infix(true);
+  for (size_t i = 0; i < patterns; ++i) {
+    clock_type::time_point begin = clock_type::now();
+    tree.insert(w.patterns[i].first, w.patterns[i].second);
+    timing.add(begin, clock_type::now());
+  }
+  timing.report(w.name, "infix", "insert");
+  tree.finish(compare_ids(), opt.k);
+  report_memory(w.name, "infix", g_heap_bytes - heap_before, patterns);
+
+  std::vector<uint64_t> top(queries);
+  std::vector<int> values;
+  for (size_t i = 0; i < queries; ++i) {
+    values.clear();
+    clock_type::time_point begin = clock_type::now();
+    tree.match(w.queries[i], values, compare_ids(), opt.k);
+    timing.add(begin, clock_type::now());
+    top[i] = checksum(values);
+  }
+  timing.report(w.name, "infix", "contains_topk");
+
+  bool ok = true;
+  for (size_t i = 0; i < queries; ++i) {
+    const std::string& query = w.queries[i];
+    values.clear();
+    clock_type::time_point begin = clock_type::now();
+    for (size_t j = 0; j < patterns; ++j) {
+      if (w.patterns[j].first.find(query) != std::string::npos) {
+        values.push_back(w.patterns[j].second);
+      }
+    }
+    top_k(&values, opt.k);
+    timing.add(begin, clock_type::now());
+    if (checksum(values) != top[i]) {
+      fprintf(stderr, "%s: infix disagrees with a scan on query %zu\n",
+              w.name.c_str(), i);
+      ok = false;
+    }
+  }
+  timing.report(w.name, "scan", "contains_topk");
+  return ok;
+}
+
+// Posting lists: every value goes under the first two code points of its
+// pattern as well as under the pattern, so that popular prefixes hold long
+// lists with repeats. Stored as inserted and with kCompactValues, whose
+// sorted, distinct lists must give the same top-k answers and, once sorted
+// and deduplicated, the same values.
+bool run_postings(const workload& w, const options& opt) {
+  std::vector<std::pair<std::string, int>> postings;
+  postings.reserve(2 * w.patterns.size());
+  for (const auto& entry : w.patterns) {
+    postings.push_back(entry);
+    const std::string& pattern = entry.first;
+    size_t len = 0;
+    for (int i = 0; i < 2 && len < pattern.size(); ++i) {
+      len += radix_utf8_length(pattern[len]);
+    }
+    if (len < pattern.size()) {
+      postings.emplace_back(pattern.substr(0, len), entry.second);
+    }
+  }
+
+  bool ok = true;
+  std::vector<std::vector<int>> plain_values(w.queries.size());
+  std::vector<uint64_t> plain_top(w.queries.size());
+  for (int pass = 0; pass < 2; ++pass) {
+    const char* structure = pass == 0 ? "plain" : "compact";
+    samples timing;
+    size_t heap_before = g_heap_bytes;
+    radix_tree<int> tree;
+    if (pass == 1) {
+      tree.set_value_encoding(kCompactValues);
+    }
+    for (const auto& entry : postings) {
+      clock_type::time_point begin = clock_type::now();
+      tree.insert(entry.first, entry.second);
+      timing.add(begin, clock_type::now());
+    }
+    timing.report(w.name, structure, "post_insert");
+    tree.finish(compare_ids(), opt.k);
+    report_memory(w.name, structure, g_heap_bytes - heap_before,
+                  postings.size());
+    // The value arena keeps its high-water mark, so the heap row hides what
+    // the lists themselves take.
+    report_memory(w.name, structure, tree.memory_usage().value_bytes,
+                  postings.size(), "value_memory");
+
+    std::vector<int> values;
+    for (size_t i = 0; i < w.queries.size(); ++i) {
+      values.clear();
+      clock_type::time_point begin = clock_type::now();
+      tree.match(w.queries[i], values);
+      timing.add(begin, clock_type::now());
+      std::sort(values.begin(), values.end());
+      values.erase(std::unique(values.begin(), values.end()), values.end());
+      if (pass == 0) {
+        plain_values[i].swap(values);
+      } else {
+        ok = ok && values == plain_values[i];
+      }
+    }
+    timing.report(w.name, structure, "post_match");
+
+    for (size_t i = 0; i < w.queries.size(); ++i) {
+      values.clear();
+      clock_type::time_point begin = clock_type::now();
+      tree.match(w.queries[i], values, compare_ids(), opt.k);
+      timing.add(begin, clock_type::now());
+      if (pass == 0) {
+        plain_top[i] = checksum(values);
+      } else {
+        ok = ok && checksum(values) == plain_top[i];
+      }
+    }
+    timing.report(w.name, structure, "post_topk");
+  }
+  if (!ok) {
+    fprintf(stderr, "%s: compact posting lists disagree with plain ones\n",
+            w.name.c_str());
+  }
+  return ok;
+}
+
+bool run(const workload& w, const options& opt) {
+  answers radix_answers(w.queries.size());
+  bool ok = run_radix(w, opt, &radix_answers);
+  ok = check(w.name, "map", radix_answers, run_map(w, opt)) && ok;
+  ok = check(w.name, "vector", radix_answers, run_sorted_vector(w, opt)) && ok;
+  ok = check(w.name, "sharded", radix_answers, run_sharded(w, opt)) && ok;
+  ok = check(w.name, "handle", radix_answers, run_handle(w, opt)) && ok;
+  ok = run_infix(w, opt) && ok;
+  ok = run_postings(w, opt) && ok;
+  return ok;
+}
+
+bool parse(int argc, char** argv, options* opt) {
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* value = strchr(arg, '=');
+    if (value == nullptr) {
+      return false;
+    }
+    std::string name(arg, value - arg);
+    ++value;
+    if (name == "--workload") {
+      opt->workload = value;
+    } else if (name == "--patterns") {
+      opt->patterns = strtoull(value, nullptr, 10);
+    } else if (name == "--queries") {
+      opt->queries = strtoull(value, nullptr, 10);
+    } else if (name == "--seed") {
+      opt->seed = strtoull(value, nullptr, 10);
+    } else if (name == "--k") {
+      opt->k = atoi(value);
+    } else if (name == "--stats") {
+      opt->stats = atoi(value) != 0;
+    } else {
+      return false;
+    }
+  }
+  return opt->patterns > 0 && opt->k > 0;
+}
+
+}  // namespace
+}  // namespace bench
+}  // namespace radix
+
+int main(int argc, char** argv) {
+  using namespace radix::bench;
+  options opt;
+  if (!parse(argc, argv, &opt)) {
+    fprintf(stderr,
+            "usage: %s [--workload=NAME|all] [--patterns=N] [--queries=N] "
+            "[--seed=S] [--k=K] [--stats=1]\n",
+            argv[0]);
+    return 2;
+  }
+  std::vector<std::string> names = workload_names();
+  if (opt.workload != "all") {
+    names.assign(1, opt.workload);
+  }
+
+  printf("%-12s %-8s %-14s %10s %12s %10s %10s %10s %10s\n", "workload",
+         "struct", "operation", "ops", "ops/s", "mean_ns", "p50_ns", "p90_ns",
+         "p99_ns");
+  bool ok = true;
+  for (const std::string& name : names) {
+    workload w;
+    if (!make_workload(name, opt.patterns, opt.queries, opt.seed, &w)) {
+      fprintf(stderr, "unknown workload: %s\n", name.c_str());
+      return 2;
+    }
+    ok = run(w, opt) && ok;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,200 @@
+#include "workloads.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+namespace radix {
+namespace bench {
+
+namespace {
+
+void append_utf8(uint32_t cp, std::string* out) {
+  if (cp < 0x80) {
+    out->push_back(static_cast<char>(cp));
+  } else if (cp < 0x800) {
+    out->push_back(static_cast<char>(0xC0 | (cp >> 6)));
+    out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  } else {
+    out->push_back(static_cast<char>(0xE0 | (cp >> 12)));
+    out->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+  }
+}
+
+std::string ascii_word(std::mt19937_64& rng, int min_len, int max_len) {
+  int len = min_len + rng() % (max_len - min_len + 1);
+  std::string word;
+  for (int i = 0; i < len; ++i) {
+    word.push_back(static_cast<char>('a' + rng() % 26));
+  }
+  return word;
+}
+
+// Samples ranks 0..n-1 with probability proportional to 1 / (rank + 1)^s.
+class zipf_sampler {
+ public:
+  zipf_sampler(size_t n, double s) : m_cdf(n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+      sum += 1.0 / std::pow(static_cast<double>(i + 1), s);
+      m_cdf[i] = sum;
+    }
+    for (double& p : m_cdf) {
+      p /= sum;
+    }
+  }
+
+  size_t operator()(std::mt19937_64& rng) const {
+    double u = std::uniform_real_distribution<double>(0, 1)(rng);
+    return std::min<size_t>(
+        std::lower_bound(m_cdf.begin(), m_cdf.end(), u) - m_cdf.begin(),
+        m_cdf.size() - 1);
+  }
+
+ private:
+  std::vector<double> m_cdf;
+};
+
+// Code point boundaries of "key", excluding 0.
+std::vector<size_t> boundaries(const std::string& key) {
+  std::vector<size_t> result;
+  for (size_t i = 1; i <= key.size(); ++i) {
+    if (i == key.size() ||
+        (static_cast<unsigned char>(key[i]) & 0xC0) != 0x80) {
+      result.push_back(i);
+    }
+  }
+  return result;
+}
+
+// Keystroke prefixes of patterns picked with Zipfian popularity, in a fixed
+// random popularity order. Prefixes are cut at code point boundaries after
+// "typed" code points that every query has, with short ones more likely.
+void make_queries(size_t count,
+                  size_t typed_before,
+                  std::mt19937_64& rng,
+                  workload* out) {
+  std::vector<size_t> popularity(out->patterns.size());
+  for (size_t i = 0; i < popularity.size(); ++i) {
+    popularity[i] = i;
+  }
+  std::shuffle(popularity.begin(), popularity.end(), rng);
+  zipf_sampler zipf(popularity.size(), 0.99);
+  out->queries.reserve(count);
+  while (out->queries.size() < count) {
+    const std::string& key = out->patterns[popularity[zipf(rng)]].first;
+    std::vector<size_t> cuts = boundaries(key);
+    size_t typed =
+        std::min(cuts.size(), typed_before + 1 + rng() % 3 + rng() % 6);
+    out->queries.push_back(key.substr(0, cuts[typed - 1]));
+  }
+}
+
+std::string zipf_key(std::mt19937_64& rng) {
+  std::string key = ascii_word(rng, 3, 10);
+  if (rng() % 3 == 0) {
+    key += ' ' + ascii_word(rng, 2, 8);
+  }
+  return key;
+}
+
+std::string cjk_key(std::mt19937_64& rng) {
+  std::string key;
+  int parts = 1 + rng() % 3;
+  for (int p = 0; p < parts; ++p) {
+    switch (rng() % 3) {
+      case 0:
+        key += ascii_word(rng, 2, 6);
+        break;
+      case 1:
+        for (int i = 1 + rng() % 4; i > 0; --i) {
+          // Common CJK Unified Ideographs, skewed toward the start.
+          append_utf8(0x4E00 + (rng() % 512) * (rng() % 8 + 1), &key);
+        }
+        break;
+      default:
+        for (int i = 2 + rng() % 5; i > 0; --i) {
+          append_utf8(rng() % 2 ? 'a' + rng() % 26 : 0xC0 + rng() % 64, &key);
+        }
+        break;
+    }
+  }
+  return key;
+}
+
+std::string long_prefix_key(std::mt19937_64& rng) {
+  static const char* const kSites[] = {
+      "https://www.example.com/catalog/", "https://shop.example.org/products/",
+      "https://docs.example.net/reference/api/"};
+  std::string key = kSites[rng() % 3];
+  key += ascii_word(rng, 4, 4) + '/';
+  key += ascii_word(rng, 5, 12) + '/';
+  key += std::to_string(rng() % 100000);
+  return key;
+}
+
+std::string fanout_key(std::mt19937_64& rng) {
+  // 4096 leading code points over the 1-, 2- and 3-byte ranges.
+  static const uint32_t kRanges[][2] = {
+      {0x21, 0x7E}, {0xA1, 0x7FF}, {0x3041, 0x30FF}, {0x4E00, 0x5A00}};
+  std::string key;
+  uint32_t lead = rng() % 4096;
+  for (const auto& range : kRanges) {
+    uint32_t size = range[1] - range[0] + 1;
+    if (lead < size) {
+      append_utf8(range[0] + lead, &key);
+      break;
+    }
+    lead -= size;
+  }
+  key += ascii_word(rng, 1, 6);
+  return key;
+}
+
+}  // namespace
+
+const std::vector<std::string>& workload_names() {
+  static const std::vector<std::string> names = {"zipf", "cjk", "long_prefix",
+                                                 "fanout"};
+  return names;
+}
+
+bool make_workload(const std::string& name,
+                   size_t patterns,
+                   size_t queries,
+                   uint64_t seed,
+                   workload* out) {
+  std::string (*generate)(std::mt19937_64&) = nullptr;
+  size_t typed_before = 0;
+  if (name == "zipf") {
+    generate = zipf_key;
+  } else if (name == "cjk") {
+    generate = cjk_key;
+  } else if (name == "long_prefix") {
+    // Queries start past the site, where the keys branch out; a site alone
+    // would match a third of the data set.
+    generate = long_prefix_key;
+    typed_before = 36;
+  } else if (name == "fanout") {
+    generate = fanout_key;
+  } else {
+    return false;
+  }
+
+  std::mt19937_64 rng(seed);
+  out->name = name;
+  out->patterns.clear();
+  out->queries.clear();
+  out->patterns.reserve(patterns);
+  // Values are document ids; several patterns may point at one document.
+  int documents = std::max<size_t>(1, patterns / 2);
+  for (size_t i = 0; i < patterns; ++i) {
+    out->patterns.emplace_back(generate(rng), rng() % documents);
+  }
+  make_queries(queries, typed_before, rng, out);
+  return true;
+}
+
+}  // namespace bench
+}  // namespace radix
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace radix {
+namespace bench {
+
+// A synthetic autocomplete data set: (pattern, value) pairs to index and a
+// query log of keystroke prefixes. Everything is derived from the seed, so a
+// workload is identical across runs and machines.
+struct workload {
+  std::string name;
+  std::vector<std::pair<std::string, int>> patterns;
+  std::vector<std::string> queries;
+};
+
+// Names accepted by make_workload():
+//   zipf         ASCII words, queries skewed toward popular words
+//   cjk          mixed ASCII, Latin-1 and CJK UTF-8 phrases
+//   long_prefix  URL-like keys sharing long prefixes
+//   fanout       keys spread over thousands of leading code points
+const std::vector<std::string>& workload_names();
+
+// Returns false if "name" is unknown.
+bool make_workload(const std::string& name,
+                   size_t patterns,
+                   size_t queries,
+                   uint64_t seed,
+                   workload* out);
+
+}  // namespace bench
+}  // namespace radix
@@ -1,5 +1,10 @@
 #include "radix.h"
 
+#include <cstdio>
+#include <type_traits>
+
+#include "radix_view.h"
+
 namespace radix {
 
 inline const Slice radix_substr(const Slice& key, int begin, int num) {
@@ -108,10 +113,233 @@ bool radix_tree<V>::SliceDecode(const Slice& key, Slice* uchar) const {
   return false;
 }
 
-static const Slice CHILD = Slice("__CHILD");
+template <typename V>
+radix_tree_node<V>* radix_tree<V>::create_node() {
+  return new (m_nodes.allocate(sizeof(radix_tree_node<V>)))
+      radix_tree_node<V>();
+}
+
+template <typename V>
+radix_tree_node<V>* radix_tree<V>::create_leaf(const radix_key& key,
+                                               const V& value,
+                                               const float* score) {
+  radix_tree_node<V>* leaf = new (m_nodes.allocate(sizeof(radix_tree_node<V>)))
+      radix_tree_node<V>(key);
+  if (score != nullptr) {
+    leaf->m_value.push_back(value, *score, m_values);
+  } else {
+    leaf->m_value.push_back(value, m_values);
+  }
+  return leaf;
+}
+
+// Add "value" to the values of a leaf, sorted and only if it is not there
+// yet with kCompactValues. Returns whether it was added.
+template <typename V>
+bool radix_tree<V>::add_value(radix_values<V>* values,
+                              const V& value,
+                              const float* score) {
+  if constexpr (std::is_integral<V>::value) {
+    if (m_encoding == kCompactValues) {
+      return values->add_sorted(value, score, m_values);
+    }
+  }
+  if (score != nullptr) {
+    values->push_back(value, *score, m_values);
+  } else {
+    values->push_back(value, m_values);
+  }
+  return true;
+}
+
+// Remove "value" from the values of a leaf. Returns the number of copies
+// removed, at most one with kCompactValues.
+template <typename V>
+size_t radix_tree<V>::erase_value(radix_values<V>* values, const V& value) {
+  if constexpr (std::is_integral<V>::value) {
+    if (m_encoding == kCompactValues) {
+      return values->erase_sorted(value, m_values);
+    }
+  }
+  return values->erase(value);
+}
+
+// Give an inner node that is no longer linked into the tree back to the
+// arenas, along with its child table and top-k list. A cached list goes too,
+// before a new node can take its address.
+template <typename V>
+void radix_tree<V>::destroy_node(radix_tree_node<V>* node) {
+  m_cache.invalidate(node);
+  if (m_adaptive) {
+    std::lock_guard<std::mutex> lock(m_adapt_mutex);
+    m_adapt.forget(node);
+  }
+  node->m_children.clear(m_nodes);
+  release_heap(node);
+  m_nodes.deallocate(node, sizeof(radix_tree_node<V>));
+}
+
+// Drop the key bytes of erased patterns that no node refers to any more,
+// once there are enough of them or the tree is empty.
+template <typename V>
+void radix_tree<V>::reclaim_keys() {
+  if (m_root->m_count == 0) {
+    m_keys.reset();
+    return;
+  }
+  if (!m_keys.compactable()) {
+    return;
+  }
+  m_keys.compact([this](const auto& f) {
+    std::vector<radix_tree_node<V>*> stack(1, m_root);
+    while (!stack.empty()) {
+      radix_tree_node<V>* current = stack.back();
+      stack.pop_back();
+      f(current->m_key);
+      if (current->m_leaf != nullptr) {
+        f(current->m_leaf->m_key);
+      }
+      for (typename radix_tree_node<V>::it_child iter =
+               current->m_children.begin();
+           iter != current->m_children.end(); ++iter) {
+        stack.push_back(*iter);
+      }
+    }
+  });
+}
+
+template <typename V>
+void radix_tree<V>::release_heap(radix_tree_node<V>* node) const {
+  if (node->m_heap != nullptr) {
+    node->m_heap->release(m_heaps);
+    m_heaps.deallocate(node->m_heap, sizeof(radix_values<V>));
+    node->m_heap = nullptr;
+  }
+}
+
+template <typename V>
+radix_values<V>* radix_tree<V>::store_heap(const std::vector<V>& heap) const {
+  radix_values<V>* stored =
+      new (m_heaps.allocate(sizeof(radix_values<V>))) radix_values<V>();
+  stored->assign(heap.data(), heap.data() + heap.size(), m_heaps);
+  return stored;
+}
+
+// Values are the only part of the tree with destructors to run; everything
+// else goes away with the arenas.
+template <typename V>
+void radix_tree<V>::destroy_values() {
+  if (std::is_trivially_destructible<V>::value) {
+    return;
+  }
+  for (radix_tree_node<V>* leaf = m_root->m_first; leaf != nullptr;
+       leaf = leaf->m_last) {
+    leaf->m_value.destroy();
+  }
+  std::vector<radix_tree_node<V>*> stack(1, m_root);
+  while (!stack.empty()) {
+    radix_tree_node<V>* current = stack.back();
+    stack.pop_back();
+    if (current->m_heap != nullptr) {
+      current->m_heap->destroy();
+    }
+    for (typename radix_tree_node<V>::it_child iter =
+             current->m_children.begin();
+         iter != current->m_children.end(); ++iter) {
+      stack.push_back(*iter);
+    }
+  }
+  for (radix_values<V>* heap : m_retired) {
+    heap->destroy();
+  }
+}
+
+template <typename V>
+radix_memory_stats radix_tree<V>::memory_usage() const {
+  radix_memory_stats stats;
+  stats.node_bytes = m_nodes.bytes_used();
+  stats.key_bytes = m_keys.bytes_used();
+  stats.value_bytes = m_values.bytes_used();
+  stats.heap_bytes = m_heaps.bytes_used();
+  stats.reserved_bytes = m_nodes.bytes_reserved() + m_keys.bytes_reserved() +
+                         m_values.bytes_reserved() + m_heaps.bytes_reserved();
+  return stats;
+}
+
+template <typename V>
+radix_tree_stats radix_tree<V>::stats() const {
+  radix_tree_stats stats;
+  std::vector<std::pair<const radix_tree_node<V>*, size_t>> stack;
+  stack.emplace_back(m_root, 0);
+  while (!stack.empty()) {
+    const radix_tree_node<V>* current = stack.back().first;
+    size_t depth = stack.back().second;
+    stack.pop_back();
+
+    ++stats.inner_nodes;
+    size_t bucket = 0;
+    for (size_t n = current->m_children.size(); n != 0; n >>= 1) {
+      ++bucket;
+    }
+    if (stats.fanout.size() <= bucket) {
+      stats.fanout.resize(bucket + 1);
+    }
+    ++stats.fanout[bucket];
+    if (current->m_heap != nullptr) {
+      ++stats.heap_nodes;
+      stats.heap_values += current->m_heap->size();
+    }
+    if (current->m_leaf != nullptr) {
+      ++stats.leaves;
+      stats.values += current->m_leaf->m_value.size();
+      if (stats.depth.size() <= depth) {
+        stats.depth.resize(depth + 1);
+      }
+      ++stats.depth[depth];
+      stats.max_depth = std::max(stats.max_depth, depth);
+    }
+    for (typename radix_tree_node<V>::it_child iter =
+             current->m_children.begin();
+         iter != current->m_children.end(); ++iter) {
+      stack.emplace_back(*iter, depth + 1);
+    }
+  }
+  stats.memory = memory_usage();
+  return stats;
+}
+
+template <typename V>
+radix_query_stats radix_tree<V>::query_stats() const {
+#ifdef RADIX_ENABLE_COUNTERS
+  return m_counters.snapshot();
+#else
+  return radix_query_stats();
+#endif
+}
+
+template <typename V>
+void radix_tree<V>::reset_query_stats() {
+  RADIX_COUNT(m_counters.reset());
+}
 
 template <typename V>
 void radix_tree<V>::insert(const std::string& pattern, V value) {
+  insert_value(pattern, value, nullptr);
+}
+
+template <typename V>
+void radix_tree<V>::insert(const std::string& pattern, V value, float score) {
+  insert_value(pattern, value, &score);
+}
+
+// Add "value" under "pattern", with "*score" unless it is null, and in
+// infix mode under each of its suffixes, whose keys share the bytes of the
+// pattern's.
+template <typename V>
+void radix_tree<V>::insert_value(const std::string& pattern,
+                                 V value,
+                                 const float* score) {
+  reclaim_heaps();
   if (pattern.empty()) {
     return;
   }
@@ -121,135 +349,186 @@ void radix_tree<V>::insert(const std::string& pattern, V value) {
       uchars.empty()) {
     return;
   }
-  Slice insert_key(pattern);
+  size_t len = 0;
+  for (const Slice& uchar : uchars) {
+    len += uchar.size();
+  }
+  if (!m_keys.can_store(len)) {
+    return;
+  }
+
+  radix_tree_node<V>* leaf = insert_leaf(uchars, len, nullptr, value, score);
+  if (leaf == nullptr) {
+    return;
+  }
+  ++m_size;
+  if (!m_infix) {
+    return;
+  }
+  std::vector<Slice> suffix;
+  for (size_t i = 1; i < uchars.size(); ++i) {
+    size_t pos = uchars[i].data() - uchars[0].data();
+    radix_key bytes = m_keys.substr(leaf->m_key, pos, len - pos);
+    suffix.assign(uchars.begin() + i, uchars.end());
+    insert_leaf(suffix, len - pos, &bytes, value, score);
+  }
+}
 
-  std::tuple<radix_tree_node<V>*, int, int> node_depth = find_node(uchars);
+// Add "value" under the pattern of the code points "uchars", "len" bytes in
+// all, and return its leaf, or null if the pattern could not be added or,
+// with kCompactValues, already holds the value. A new
+// leaf takes its key from "*bytes", or stores the pattern if "bytes" is null.
+template <typename V>
+radix_tree_node<V>* radix_tree<V>::insert_leaf(
+    const std::vector<Slice>& uchars,
+    size_t len,
+    const radix_key* bytes,
+    V value,
+    const float* score) {
+  std::vector<radix_tree_node<V>*> path;
+  std::tuple<radix_tree_node<V>*, int, int> node_depth =
+      find_node(uchars, &path);
   radix_tree_node<V>* match_node = std::get<0>(node_depth);
   int match_count = std::get<1>(node_depth);
   int match_depth = std::get<2>(node_depth);
 
   if (match_depth == uchars.size() && match_count == match_node->m_key.size()) {
-    if (match_node->m_leaf != nullptr &&
-        match_node->m_leaf->m_value != nullptr) {
-      match_node->m_leaf->m_value->emplace_back(value);
-      // update_node(uchars, match_node->m_last, match_node->m_last);
-      return;
+    if (match_node->m_leaf != nullptr) {
+      if (!add_value(&match_node->m_leaf->m_value, value, score)) {
+        // Already there; the score it kept may have risen.
+        if (score != nullptr && m_score_lists) {
+          update_heaps(path, value, *score);
+        }
+        return nullptr;
+      }
+      for (radix_tree_node<V>* node : path) {
+        ++node->m_value_count;
+        m_cache.invalidate(node);
+      }
+      if (m_compfunc || m_score_lists) {
+        update_heaps(path, value, score != nullptr ? *score : 0);
+      }
+      return match_node->m_leaf;
     }
   }
 
+  // The new leaf goes into the chain right before "next" or, if that is
+  // null, right after "prev", keeping the chain in pattern order.
+  radix_tree_node<V>* next = nullptr;
+  radix_tree_node<V>* prev = nullptr;
+  uint64_t child_key = 0;
+  if (match_depth != uchars.size()) {
+    child_key = radix_child_key(uchars[match_depth]);
+  }
+
   if (match_count < match_node->m_key.size()) {
+    Slice label = m_keys.slice(match_node->m_key);
     Slice new_key;
-    if (SliceDecode(radix_substr(match_node->m_key, match_count,
-                                 match_node->m_key.size() - match_count),
-                    &new_key)) {
-      radix_tree_node<V>* new_leaf = new radix_tree_node<V>(CHILD, value);
-      radix_tree_node<V>* new_node = new radix_tree_node<V>();
-      new_node->swap(*match_node);
-      match_node->m_key = radix_substr(new_node->m_key, 0, match_count);
-      new_node->m_key.remove_prefix(match_count);
-      new_leaf->m_key = match_node->m_key;
-
-      radix_tree_node<V>* temp_last = new_node->m_last;
-      if (temp_last->m_last != nullptr) {
-        temp_last->m_last->m_first = new_leaf;
-        new_leaf->m_last = temp_last->m_last;
-      }
-      new_leaf->m_first = temp_last;
-      temp_last->m_last = new_leaf;
-
-      match_node->m_first = new_node->m_first;
-      match_node->m_last = new_leaf;
-      match_node->m_children[new_key] = new_node;
-
-      if (match_depth != uchars.size()) {
-        radix_tree_node<V>* new_node1 = new radix_tree_node<V>();
-        int total_count = 0;
-        for (int i = 0; i < match_depth; ++i) {
-          total_count += uchars[i].size();
-        }
-        m_patterns.push_back(radix_substr(insert_key, total_count,
-                                          insert_key.size() - total_count)
-                                 .ToString());
-        Slice leaf_key = Slice(m_patterns.back());
-        new_node1->m_key = leaf_key;
-        new_node1->m_first = new_leaf;
-        new_node1->m_last = new_leaf;
-        new_node1->m_leaf = new_leaf;
-        new_leaf->m_key = leaf_key;
-        match_node->m_children[radix_substr(
-            leaf_key, 0, uchars[match_depth].size())] = new_node1;
-      } else {
-        match_node->m_leaf = new_leaf;
-      }
-
-      update_node(uchars, temp_last, new_leaf);
+    if (!SliceDecode(
+            radix_substr(label, match_count, label.size() - match_count),
+            &new_key)) {
+      return nullptr;
+    }
+    uint64_t new_child_key = radix_child_key(new_key);
+    radix_tree_node<V>* new_node = create_node();
+    new_node->swap(*match_node);
+    if (m_adaptive && new_node->m_heap != nullptr) {
+      std::lock_guard<std::mutex> lock(m_adapt_mutex);
+      m_adapt.move(match_node, new_node);
     }
-  } else if (match_count == match_node->m_key.size()) {
-    radix_tree_node<V>* new_leaf = new radix_tree_node<V>(CHILD, value);
-    new_leaf->m_key = match_node->m_key;
+    match_node->m_key = m_keys.substr(new_node->m_key, 0, match_count);
+    new_node->m_key = m_keys.substr(new_node->m_key, match_count,
+                                    new_node->m_key.size() - match_count);
+    match_node->m_first = new_node->m_first;
+    match_node->m_last = new_node->m_last;
+    match_node->m_children.insert(new_child_key, new_node, m_nodes);
 
-    if (match_depth != uchars.size()) {
-      radix_tree_node<V>* new_node1 = new radix_tree_node<V>();
-      int total_count = 0;
-      for (int i = 0; i < match_depth; ++i) {
-        total_count += uchars[i].size();
-      }
-      m_patterns.push_back(
-          radix_substr(insert_key, total_count, insert_key.size() - total_count)
-              .ToString());
-      Slice leaf_key = Slice(m_patterns.back());
-      new_node1->m_key = leaf_key;
-      new_node1->m_first = new_leaf;
-      new_node1->m_last = new_leaf;
-      new_node1->m_leaf = new_leaf;
-      new_leaf->m_key = leaf_key;
-      match_node
-          ->m_children[radix_substr(leaf_key, 0, uchars[match_depth].size())] =
-          new_node1;
+    if (match_depth == uchars.size() || child_key < new_child_key) {
+      next = new_node->m_first;
     } else {
-      match_node->m_leaf = new_leaf;
+      prev = new_node->m_last;
     }
-
-    radix_tree_node<V>* temp_last = match_node->m_last;
-    if (temp_last == nullptr) {
-      match_node->m_first = new_leaf;
-      match_node->m_last = new_leaf;
+  } else if (match_depth == uchars.size()) {
+    next = match_node->m_first;
+  } else {
+    typename radix_tree_node<V>::it_child sibling =
+        match_node->m_children.upper_bound(child_key);
+    if (sibling != match_node->m_children.end()) {
+      next = (*sibling)->m_first;
     } else {
-      if (temp_last->m_last != nullptr) {
-        temp_last->m_last->m_first = new_leaf;
-        new_leaf->m_last = temp_last->m_last;
-      }
-      new_leaf->m_first = temp_last;
-      temp_last->m_last = new_leaf;
+      prev = match_node->m_last;
+    }
+  }
+
+  // A pattern that ends inside the tree is a prefix of the patterns below
+  // where it ends, and shares their bytes.
+  radix_key full_key =
+      match_depth == uchars.size()
+          ? m_keys.substr(match_node->m_first->m_key, 0, len)
+          : bytes != nullptr ? *bytes : m_keys.store(uchars[0].data(), len);
+  radix_tree_node<V>* new_leaf = create_leaf(full_key, value, score);
+  if (match_depth != uchars.size()) {
+    int total_count = 0;
+    for (int i = 0; i < match_depth; ++i) {
+      total_count += uchars[i].size();
     }
+    radix_tree_node<V>* new_node1 = create_node();
+    new_node1->m_key =
+        m_keys.substr(new_leaf->m_key, total_count, len - total_count);
+    new_node1->m_leaf = new_leaf;
+    match_node->m_children.insert(child_key, new_node1, m_nodes);
+    path.push_back(new_node1);
+  } else {
+    match_node->m_leaf = new_leaf;
+  }
 
-    update_node(uchars, temp_last, new_leaf);
+  if (next != nullptr) {
+    prev = next->m_first;
+  } else if (prev != nullptr) {
+    next = prev->m_last;
+  }
+  new_leaf->m_first = prev;
+  new_leaf->m_last = next;
+  if (prev != nullptr) {
+    prev->m_last = new_leaf;
   }
+  if (next != nullptr) {
+    next->m_first = new_leaf;
+  }
+  update_node(path, new_leaf, value, score != nullptr ? *score : 0);
+  return new_leaf;
 }
 
 template <typename V>
 std::tuple<radix_tree_node<V>*, int, int> radix_tree<V>::find_node(
-    const std::vector<Slice>& key) const {
+    const std::vector<Slice>& key,
+    std::vector<radix_tree_node<V>*>* path) const {
   int count = 0, depth = 0;
   radix_tree_node<V>* result = m_root;
+  if (path != nullptr) {
+    path->push_back(result);
+  }
   if (key.empty()) {
     return {result, count, depth};
   }
 
   int len_key = key.size() - depth;
   while (len_key > 0) {
-    typename radix_tree_node<V>::it_child it =
-        result->m_children.find(key[depth]);
-    if (it == result->m_children.end()) {
+    radix_tree_node<V>* child =
+        result->m_children.find(radix_child_key(key[depth]));
+    if (child == nullptr) {
       break;
     }
 
-    result = it->second;
-    for (count = 0; count < result->m_key.size() && depth < key.size();
-         ++depth) {
-      int m_key_len = result->m_key.size() - count;
+    result = child;
+    if (path != nullptr) {
+      path->push_back(result);
+    }
+    Slice label = m_keys.slice(result->m_key);
+    for (count = 0; count < label.size() && depth < key.size(); ++depth) {
+      int m_key_len = label.size() - count;
       if (m_key_len < key[depth].size() ||
-          key[depth] != radix_substr(result->m_key, count, key[depth].size())) {
+          key[depth] != radix_substr(label, count, key[depth].size())) {
         break;
       }
       count += key[depth].size();
@@ -263,72 +542,506 @@ std::tuple<radix_tree_node<V>*, int, int> radix_tree<V>::find_node(
   return {result, count, depth};
 }
 
+// Count "leaf", just linked into the chain, and its value in every node on
+// "path", the nodes from the root down to the leaf's own, and let it open or
+// close their leaf ranges as its position in the chain says.
 template <typename V>
-void radix_tree<V>::update_node(const std::vector<Slice>& key,
-                                radix_tree_node<V>* old_last,
-                                radix_tree_node<V>* new_last) {
-  int count = 0, depth = 0;
-  radix_tree_node<V>* result = m_root;
-  if (key.empty()) {
+void radix_tree<V>::update_node(const std::vector<radix_tree_node<V>*>& path,
+                                radix_tree_node<V>* leaf,
+                                const V& value,
+                                float score) {
+  for (radix_tree_node<V>* node : path) {
+    ++node->m_value_count;
+    m_cache.invalidate(node);
+    if (node->m_count++ == 0) {
+      node->m_first = leaf;
+      node->m_last = leaf;
+      continue;
+    }
+    if (node->m_first == leaf->m_last) {
+      node->m_first = leaf;
+    }
+    if (node->m_last == leaf->m_first) {
+      node->m_last = leaf;
+    }
+  }
+  if (m_compfunc || m_score_lists) {
+    update_heaps(path, value, score);
+  }
+}
+
+// Keep the top-k lists built by finish() or finish_scored() current after
+// "value" was added with "score" under every node of "path", root first: fold
+// it into the existing lists, then build the lists of nodes that have now
+// crossed NODES_THRESHOLD, children before parents.
+template <typename V>
+void radix_tree<V>::update_heaps(const std::vector<radix_tree_node<V>*>& path,
+                                 const V& value,
+                                 float score) {
+  for (radix_tree_node<V>* node : path) {
+    if (node->m_heap == nullptr) {
+      continue;
+    }
+    if (m_score_lists) {
+      score_update(node->m_heap, value, score);
+    } else {
+      heap_update(node->m_heap, value);
+    }
+  }
+  for (int index = path.size() - 1; index >= 0; --index) {
+    radix_tree_node<V>* node = path[index];
+    int threshold = node == m_root ? NODES_THRESHOLD : NODES_THRESHOLD + 1;
+    if (!m_adaptive && node->m_heap == nullptr && node->m_count >= threshold) {
+      rebuild_heap(node);
+    }
+  }
+}
+
+// Insert "value" into the sorted list "heap" unless it is already there or
+// ranks below a full list, in O(log k) comparisons.
+template <typename V>
+void radix_tree<V>::heap_update(radix_values<V>* heap, const V& value) {
+  if (heap->size() >= m_recall_limit &&
+      !m_compfunc(value, (*heap)[heap->size() - 1])) {
+    return;
+  }
+  std::pair<const V*, const V*> range =
+      std::equal_range(heap->begin(), heap->end(), value, m_compfunc);
+  if (std::find(range.first, range.second, value) != range.second) {
     return;
   }
+  heap->insert(range.second - heap->begin(), value, m_heaps);
+  if (heap->size() > m_recall_limit) {
+    heap->pop_back();
+  }
+}
 
-  int len_key = key.size() - depth;
-  while (len_key > 0) {
-    typename radix_tree_node<V>::it_child it =
-        result->m_children.find(key[depth]);
-    if (it == result->m_children.end()) {
-      break;
+// Raise the score of "value" in the scored list "heap" to "score", adding it
+// if it ranks within the list.
+template <typename V>
+void radix_tree<V>::score_update(radix_values<V>* heap,
+                                 const V& value,
+                                 float score) {
+  const V* values = heap->begin();
+  size_t pos = std::find(values, heap->end(), value) - values;
+  if (pos < heap->size()) {
+    if (heap->scores()[pos] >= score) {
+      return;
     }
+    heap->erase_at(pos);
+  }
+  // The first entry that "value" ranks before.
+  const float* scores = heap->scores();
+  size_t size = heap->size();
+  pos = 0;
+  while (pos < size && (scores[pos] > score ||
+                        (scores[pos] == score && (*heap)[pos] < value))) {
+    ++pos;
+  }
+  if (pos >= m_recall_limit) {
+    return;
+  }
+  heap->insert(pos, value, score, m_heaps);
+  if (heap->size() > m_recall_limit) {
+    heap->pop_back();
+  }
+}
+
+template <typename V>
+typename radix_tree<V>::size_type radix_tree<V>::erase(
+    const std::string& pattern) {
+  return erase_values(pattern, nullptr);
+}
+
+template <typename V>
+typename radix_tree<V>::size_type radix_tree<V>::erase(
+    const std::string& pattern,
+    V value) {
+  return erase_values(pattern, &value);
+}
+
+// Remove the copies of "*value" stored under "pattern", or all of its values
+// if "value" is null. A leaf left without values is unlinked.
+template <typename V>
+typename radix_tree<V>::size_type radix_tree<V>::erase_values(
+    const std::string& pattern,
+    const V* value) {
+  reclaim_heaps();
+  std::vector<Slice> uchars;
+  if (pattern.empty() ||
+      !UTF8Decode(pattern.c_str(), pattern.length(), uchars) ||
+      uchars.empty()) {
+    return 0;
+  }
+  if (m_infix) {
+    size_type count = erase_infix(uchars, value);
+    m_size -= count;
+    reclaim_keys();
+    return count;
+  }
 
-    ++result->m_count;
-    if (old_last == result->m_last) {
-      result->m_last = new_last;
+  std::vector<radix_tree_node<V>*> path;
+  radix_tree_node<V>* leaf = find_leaf(uchars, &path);
+  if (leaf == nullptr) {
+    return 0;
+  }
+  std::vector<V> removed;
+  size_type count;
+  if (value == nullptr) {
+    leaf->m_value.append_to(&removed);
+    count = removed.size();
+  } else {
+    count = erase_value(&leaf->m_value, *value);
+    if (count == 0) {
+      return 0;
     }
+    removed.push_back(*value);
+  }
+  remove_values(path, count, removed, value == nullptr);
+  m_size -= count;
+  reclaim_keys();
+  return count;
+}
 
-    result = it->second;
-    for (count = 0; count < result->m_key.size() && depth < key.size();
-         ++depth) {
-      int m_key_len = result->m_key.size() - count;
-      if (m_key_len < key[depth].size() ||
-          key[depth] != radix_substr(result->m_key, count, key[depth].size())) {
-        break;
+// In infix mode, the leaf of a pattern also holds a copy of every value
+// stored under a pattern one code point longer that ends with it, and only
+// the copies beyond those were inserted under the pattern itself. Remove
+// those, or the ones of "*value" if it is not null, from the leaves of the
+// pattern and of each of its suffixes.
+template <typename V>
+typename radix_tree<V>::size_type radix_tree<V>::erase_infix(
+    const std::vector<Slice>& uchars,
+    const V* value) {
+  radix_tree_node<V>* leaf = find_leaf(uchars, nullptr);
+  if (leaf == nullptr) {
+    return 0;
+  }
+  std::vector<V> own;
+  for (const V& item : leaf->m_value) {
+    if (value == nullptr || item == *value) {
+      own.push_back(item);
+    }
+  }
+  std::vector<Slice> longer(1);
+  longer.insert(longer.end(), uchars.begin(), uchars.end());
+  for (typename radix_tree_node<V>::it_child iter = m_root->m_children.begin();
+       iter != m_root->m_children.end() && !own.empty(); ++iter) {
+    const char* label = m_keys.data((*iter)->m_key);
+    longer[0] = Slice(label, radix_utf8_length(label[0]));
+    const radix_tree_node<V>* other = find_leaf(longer, nullptr);
+    if (other == nullptr) {
+      continue;
+    }
+    for (const V& item : other->m_value) {
+      typename std::vector<V>::iterator found =
+          std::find(own.begin(), own.end(), item);
+      if (found != own.end()) {
+        *found = own.back();
+        own.pop_back();
       }
-      count += key[depth].size();
     }
-    if (count < result->m_key.size()) {
-      break;
+  }
+  if (own.empty()) {
+    return 0;
+  }
+
+  std::vector<V> removed;
+  for (const V& item : own) {
+    if (std::find(removed.begin(), removed.end(), item) == removed.end()) {
+      removed.push_back(item);
     }
-    len_key = key.size() - depth;
   }
+  std::vector<Slice> suffix;
+  std::vector<radix_tree_node<V>*> path;
+  for (size_t i = 0; i < uchars.size(); ++i) {
+    suffix.assign(uchars.begin() + i, uchars.end());
+    path.clear();
+    leaf = find_leaf(suffix, &path);
+    if (leaf == nullptr) {
+      continue;
+    }
+    size_type count = 0;
+    for (const V& item : own) {
+      const V* values = leaf->m_value.begin();
+      size_t pos = std::find(values, leaf->m_value.end(), item) - values;
+      if (pos < leaf->m_value.size()) {
+        leaf->m_value.erase_at(pos);
+        ++count;
+      }
+    }
+    if (count > 0) {
+      remove_values(path, count, removed, false);
+    }
+  }
+  return own.size();
+}
+
+// The leaf of the pattern of the code points "uchars", or null if there is
+// none. "*path", unless null, receives the nodes from the root down to the
+// one the leaf hangs from.
+template <typename V>
+radix_tree_node<V>* radix_tree<V>::find_leaf(
+    const std::vector<Slice>& uchars,
+    std::vector<radix_tree_node<V>*>* path) const {
+  std::tuple<radix_tree_node<V>*, int, int> node_depth =
+      find_node(uchars, path);
+  radix_tree_node<V>* match_node = std::get<0>(node_depth);
+  if (std::get<2>(node_depth) != uchars.size() ||
+      std::get<1>(node_depth) != match_node->m_key.size()) {
+    return nullptr;
+  }
+  return match_node->m_leaf;
+}
+
+// Account for "count" values, copies of those in "removed", that left the
+// leaf of "path.back()", and unlink the leaf if it is left empty or "whole"
+// is set.
+template <typename V>
+void radix_tree<V>::remove_values(const std::vector<radix_tree_node<V>*>& path,
+                                  size_type count,
+                                  const std::vector<V>& removed,
+                                  bool whole) {
+  radix_tree_node<V>* match_node = path.back();
+  for (radix_tree_node<V>* node : path) {
+    node->m_value_count -= count;
+    m_cache.invalidate(node);
+  }
+  if (whole || match_node->m_leaf->m_value.empty()) {
+    remove_leaf(path);
+  }
+  repair_heaps(path, removed);
+
+  // Restore path compression: drop the node if nothing is left below it,
+  // then merge whichever of it and its parent is left with a single child
+  // and no pattern of its own.
+  if (path.size() > 1) {
+    radix_tree_node<V>* parent = path[path.size() - 2];
+    // Bytes of the pattern above the key of "match_node".
+    size_t depth = 0;
+    for (size_t i = 1; i + 1 < path.size(); ++i) {
+      depth += path[i]->m_key.size();
+    }
+    if (match_node->m_count == 0) {
+      Slice label = m_keys.slice(match_node->m_key);
+      parent->m_children.erase(
+          radix_child_key(label.data(), radix_utf8_length(label[0])), m_nodes);
+      destroy_node(match_node);
+      if (path.size() > 2 && parent->m_leaf == nullptr &&
+          parent->m_children.size() == 1) {
+        merge_node(path[path.size() - 3], parent,
+                   depth - parent->m_key.size());
+      }
+    } else if (match_node->m_leaf == nullptr &&
+               match_node->m_children.size() == 1) {
+      merge_node(parent, match_node, depth);
+    }
+  }
+}
+
+// Unlink the leaf of "path.back()" from the leaf chain and from the leaf
+// ranges and counts of every node on "path", and free it.
+template <typename V>
+void radix_tree<V>::remove_leaf(const std::vector<radix_tree_node<V>*>& path) {
+  radix_tree_node<V>* leaf = path.back()->m_leaf;
+  radix_tree_node<V>* prev = leaf->m_first;
+  radix_tree_node<V>* next = leaf->m_last;
+  for (radix_tree_node<V>* node : path) {
+    --node->m_count;
+    if (node->m_count == 0) {
+      node->m_first = nullptr;
+      node->m_last = nullptr;
+      continue;
+    }
+    if (node->m_first == leaf) {
+      node->m_first = next;
+    }
+    if (node->m_last == leaf) {
+      node->m_last = prev;
+    }
+  }
+  if (prev != nullptr) {
+    prev->m_last = next;
+  }
+  if (next != nullptr) {
+    next->m_first = prev;
+  }
+  path.back()->m_leaf = nullptr;
+  m_keys.release(leaf->m_key);
+  leaf->m_value.release(m_values);
+  m_nodes.deallocate(leaf, sizeof(radix_tree_node<V>));
+}
+
+// Replace "node", which has no pattern of its own, by its only child under
+// "parent", joining their keys. The key of "node" starts "depth" bytes into
+// the patterns below it, whose bytes the joined key shares.
+template <typename V>
+void radix_tree<V>::merge_node(radix_tree_node<V>* parent,
+                               radix_tree_node<V>* node,
+                               size_t depth) {
+  radix_tree_node<V>* child = *node->m_children.begin();
+  child->m_key = m_keys.substr(child->m_first->m_key, depth,
+                               node->m_key.size() + child->m_key.size());
+  Slice label = m_keys.slice(child->m_key);
+  parent->m_children.insert(
+      radix_child_key(label.data(), radix_utf8_length(label[0])), child,
+      m_nodes);
+  destroy_node(node);
+}
 
-  ++result->m_count;
-  if (old_last == result->m_last) {
-    result->m_last = new_last;
+// Bring the top-k lists on "path" up to date after the values in "removed"
+// lost an occurrence under every node of it: lists of nodes that fell under
+// NODES_THRESHOLD are dropped, and lists holding a removed value are rebuilt,
+// children before parents.
+template <typename V>
+void radix_tree<V>::repair_heaps(const std::vector<radix_tree_node<V>*>& path,
+                                 const std::vector<V>& removed) {
+  for (int index = path.size() - 1; index >= 0; --index) {
+    radix_tree_node<V>* node = path[index];
+    if (node->m_heap == nullptr) {
+      continue;
+    }
+    int threshold = node == m_root ? NODES_THRESHOLD : NODES_THRESHOLD + 1;
+    if (!m_adaptive && node->m_count < threshold) {
+      release_heap(node);
+      continue;
+    }
+    for (const V& value : removed) {
+      if (std::find(node->m_heap->begin(), node->m_heap->end(), value) !=
+          node->m_heap->end()) {
+        rebuild_heap(node);
+        break;
+      }
+    }
+  }
+}
+
+// Walk down to the node whose subtree holds every pattern starting with
+// key[0, len), comparing raw bytes instead of decoded code points, so a lookup
+// allocates nothing. Stored keys are valid UTF-8, so a query that matches
+// them byte for byte is valid as well, provided it does not stop in the
+// middle of a code point; a NUL ends the query as it does in UTF8Decode.
+template <typename V>
+const radix_tree_node<V>* radix_tree<V>::find_prefix(const char* key,
+                                                     size_t len) const {
+  const char* nul = static_cast<const char*>(memchr(key, 0, len));
+  if (nul != nullptr) {
+    len = nul - key;
+  }
+  if (len == 0) {
+    return nullptr;
+  }
+
+  const radix_tree_node<V>* result = m_root;
+  size_t pos = 0;
+  while (true) {
+    size_t uchar_len = radix_utf8_length(key[pos]);
+    if (uchar_len == 0 || uchar_len > len - pos) {
+      return nullptr;
+    }
+    const radix_tree_node<V>* child =
+        result->m_children.find(radix_child_key(key + pos, uchar_len));
+    if (child == nullptr) {
+      return nullptr;
+    }
+
+    // The first code point is known to be equal.
+    const char* child_key = m_keys.data(child->m_key);
+    size_t compare = std::min(len - pos, child->m_key.size());
+    if (radix_mismatch(key + pos + uchar_len, child_key + uchar_len,
+                       compare - uchar_len) != compare - uchar_len) {
+      return nullptr;
+    }
+    pos += compare;
+    if (pos == len) {
+      if (compare < child->m_key.size() &&
+          radix_utf8_continuation(child_key[compare])) {
+        return nullptr;
+      }
+      return child;
+    }
+    result = child;
   }
 }
 
 template <typename V>
 void radix_tree<V>::match(const std::string& key, std::vector<V>& vec) const {
-  std::vector<Slice> uchars;
-  if (!UTF8Decode(key.data(), key.size(), uchars) || uchars.empty()) {
+#ifdef RADIX_ENABLE_COUNTERS
+  radix_latency_timer timer(&m_counters);
+#endif
+  collect_values(find_prefix(key.data(), key.size()), &vec);
+}
+
+template <typename V>
+void radix_tree<V>::match_scored(const std::string& key,
+                                 std::vector<V>& vec,
+                                 int recall_limit,
+                                 float min_score,
+                                 std::vector<float>* scores) const {
+#ifdef RADIX_ENABLE_COUNTERS
+  radix_latency_timer timer(&m_counters);
+#endif
+  const radix_tree_node<V>* match_node = find_prefix(key.data(), key.size());
+  RADIX_COUNT(m_counters.lookup(match_node != nullptr));
+  if (match_node == nullptr || recall_limit <= 0) {
+    return;
+  }
+  radix_adapt_reader reader(adapt_readers());
+  const radix_values<V>* heap = match_node->heap();
+  if (heap != nullptr && heap->scores() != nullptr) {
+    // The list is best first, so the values of at least "min_score" lead it.
+    RADIX_COUNT(m_counters.heap_hit());
+    const float* heap_scores = heap->scores();
+    size_t size = std::min<size_t>(recall_limit, heap->size());
+    size_t count = 0;
+    while (count < size && heap_scores[count] >= min_score) {
+      ++count;
+    }
+    vec.insert(vec.end(), heap->begin(), heap->begin() + count);
+    if (scores != nullptr) {
+      scores->insert(scores->end(), heap_scores, heap_scores + count);
+    }
     return;
   }
 
-  std::tuple<radix_tree_node<V>*, int, int> node_depth = find_node(uchars);
-  radix_tree_node<V>* match_node = std::get<0>(node_depth);
-  int match_count = std::get<1>(node_depth);
-  int match_depth = std::get<2>(node_depth);
+  radix_top_scores<V> top(recall_limit, min_score);
+  std::vector<V> buffer;
+  const radix_tree_node<V>* temp = match_node->m_first;
+  while (temp != nullptr) {
+    top.add(temp->m_value.values(&buffer), temp->m_value.scores(),
+            temp->m_value.size());
+    if (temp == match_node->m_last) {
+      break;
+    }
+    temp = temp->m_last;
+  }
+  RADIX_COUNT(m_counters.scan(match_node->m_count));
+  top.finish(&vec, scores);
+}
 
-  if (match_depth == uchars.size()) {
-    radix_tree_node<V>* temp = match_node->m_first;
+template <typename V>
+void radix_tree<V>::fuzzy_match(const std::string& key,
+                                int max_edits,
+                                std::vector<V>& vec) const {
+  std::vector<const radix_tree_node<V>*> nodes;
+  fuzzy_nodes(key, max_edits, &nodes);
+  RADIX_COUNT(m_counters.lookup(!nodes.empty()));
+  std::unique_ptr<radix_seen<V>> item_set;
+  if (m_infix) {
+    item_set.reset(new radix_seen<V>(m_value_domain));
+  }
+  for (const radix_tree_node<V>* node : nodes) {
+    const radix_tree_node<V>* temp = node->m_first;
     while (temp != nullptr) {
-      if (temp->m_value != nullptr) {
-        for (V p : *temp->m_value) {
-          vec.push_back(p);
-        }
+      if (item_set == nullptr) {
+        temp->m_value.append_to(&vec);
+      } else {
+        temp->m_value.for_each([&](const V& item) {
+          if (item_set->insert(item)) {
+            vec.push_back(item);
+          }
+        });
       }
-      if (temp == match_node->m_last) {
+      if (temp == node->m_last) {
         break;
       }
       temp = temp->m_last;
@@ -336,167 +1049,858 @@ void radix_tree<V>::match(const std::string& key, std::vector<V>& vec) const {
   }
 }
 
+// Fill "row" with the row of the Levenshtein matrix between the n code points
+// of "target" and a path that "prev" is the row of, extended by "uchar".
+// Returns the smallest entry.
+static int radix_edit_row(const int* prev,
+                          const uint64_t* target,
+                          size_t n,
+                          uint64_t uchar,
+                          int* row) {
+  row[0] = prev[0] + 1;
+  int best = row[0];
+  for (size_t i = 1; i <= n; ++i) {
+    int cost = prev[i - 1] + (target[i - 1] == uchar ? 0 : 1);
+    row[i] = std::min(cost, std::min(prev[i], row[i - 1]) + 1);
+    best = std::min(best, row[i]);
+  }
+  return best;
+}
+
+// Collect, in pattern order, the highest nodes whose path is within
+// "max_edits" of "key". The walk keeps one row of the Levenshtein matrix per
+// code point of the path, and leaves a subtree as soon as a row has no entry
+// within the budget: extending the path cannot lower the distance again.
 template <typename V>
-void radix_tree<V>::match(const std::string& key,
-                          std::vector<V>& vec,
-                          std::function<bool(V, V)> compfunc,
-                          int recall_limit) const {
+void radix_tree<V>::fuzzy_nodes(
+    const std::string& key,
+    int max_edits,
+    std::vector<const radix_tree_node<V>*>* nodes) const {
   std::vector<Slice> uchars;
-  if (!UTF8Decode(key.data(), key.size(), uchars) || uchars.empty()) {
+  if (max_edits < 0 || !UTF8Decode(key.data(), key.size(), uchars) ||
+      uchars.empty()) {
     return;
   }
+  size_t n = uchars.size();
+  std::vector<uint64_t> target(n);
+  for (size_t i = 0; i < n; ++i) {
+    target[i] = radix_child_key(uchars[i]);
+  }
 
-  std::tuple<radix_tree_node<V>*, int, int> node_depth = find_node(uchars);
-  radix_tree_node<V>* match_node = std::get<0>(node_depth);
-  int match_count = std::get<1>(node_depth);
-  int match_depth = std::get<2>(node_depth);
+  // rows[d * (n + 1) + i]: the distance between the first i code points of
+  // "key" and the first d of the path.
+  std::vector<int> rows(n + 1);
+  for (size_t i = 0; i <= n; ++i) {
+    rows[i] = i;
+  }
+  if (rows[n] <= max_edits) {
+    if (m_root->m_count > 0) {
+      nodes->push_back(m_root);
+    }
+    return;
+  }
+
+  // Children are screened by the first code point of their key, which the
+  // child table holds, so most pruned subtrees are never touched.
+  std::vector<int> scratch(n + 1);
+  std::vector<std::pair<const radix_tree_node<V>*, size_t>> stack(
+      1, std::make_pair(m_root, 0));
+  while (!stack.empty()) {
+    const radix_tree_node<V>* current = stack.back().first;
+    size_t depth = stack.back().second;
+    stack.pop_back();
 
-  if (match_depth == uchars.size()) {
-    if (match_node->m_heap != nullptr) {
-      int recall_num = recall_limit < match_node->m_heap->size()
-                           ? recall_limit
-                           : match_node->m_heap->size();
-      vec.reserve(recall_num);
-      for (int i = 0; i < recall_num; ++i) {
-        vec.push_back(match_node->m_heap->at(i));
+    const char* label = m_keys.data(current->m_key);
+    size_t size = current->m_key.size();
+    bool matched = false;
+    bool pruned = false;
+    for (size_t pos = 0; pos < size && !matched && !pruned; ++depth) {
+      size_t uchar_len = std::max<size_t>(1, radix_utf8_length(label[pos]));
+      uint64_t uchar = radix_child_key(label + pos, uchar_len);
+      pos += uchar_len;
+
+      if (rows.size() < (depth + 2) * (n + 1)) {
+        rows.resize((depth + 2) * (n + 1));
       }
-    } else {
-      std::unordered_set<V> item_set;
-      radix_tree_node<V>* temp = match_node->m_first;
-      while (temp != nullptr) {
-        if (temp->m_value != nullptr) {
-          for (V p : *temp->m_value) {
-            if (item_set.count(p) > 0) {
-              continue;
-            }
-            item_set.insert(p);
-            heap_insert(&vec, p, compfunc, recall_limit);
+      int* row = &rows[(depth + 1) * (n + 1)];
+      pruned = radix_edit_row(&rows[depth * (n + 1)], target.data(), n, uchar,
+                              row) > max_edits;
+      matched = row[n] <= max_edits;
+    }
+
+    if (matched) {
+      nodes->push_back(current);
+    } else if (!pruned) {
+      const int* prev = &rows[depth * (n + 1)];
+      if (*std::min_element(prev, prev + n + 1) < max_edits) {
+        for (typename radix_tree_node<V>::it_child iter =
+                 current->m_children.begin();
+             iter != current->m_children.end(); ++iter) {
+          if (radix_edit_row(prev, target.data(), n, iter.key(),
+                             scratch.data()) <= max_edits) {
+            __builtin_prefetch(*iter);
+            stack.emplace_back(*iter, depth);
           }
         }
-        if (temp == match_node->m_last) {
-          break;
+        continue;
+      }
+      // With the budget spent, a child survives only if its first code point
+      // continues a path that is still within it, so look those up instead.
+      for (size_t i = 0; i < n; ++i) {
+        if (prev[i] > max_edits) {
+          continue;
+        }
+        size_t same = 0;
+        while (same < i &&
+               (prev[same] > max_edits || target[same] != target[i])) {
+          ++same;
+        }
+        const radix_tree_node<V>* child =
+            same == i ? current->m_children.find(target[i]) : nullptr;
+        if (child != nullptr) {
+          stack.emplace_back(child, depth);
         }
-        temp = temp->m_last;
       }
-      std::sort_heap(vec.begin(), vec.end(), compfunc);
     }
   }
+
+  // The subtrees are disjoint, so their first patterns order them.
+  std::sort(nodes->begin(), nodes->end(),
+            [this](const radix_tree_node<V>* a, const radix_tree_node<V>* b) {
+              return m_keys.slice(a->m_first->m_key) <
+                     m_keys.slice(b->m_first->m_key);
+            });
 }
 
 template <typename V>
-radix_tree_iter<V> radix_tree<V>::match(const std::string& key) const {
-  std::vector<Slice> uchars;
-  if (!UTF8Decode(key.data(), key.size(), uchars) || uchars.empty()) {
-    return {nullptr, nullptr, 0};
+void radix_tree<V>::collect_values(const radix_tree_node<V>* match_node,
+                                   std::vector<V>* result) const {
+  std::vector<V>& vec = *result;
+  RADIX_COUNT(m_counters.lookup(match_node != nullptr));
+  if (match_node != nullptr) {
+    RADIX_COUNT(m_counters.scan(match_node->m_count));
+    // In infix mode, a value comes once for each suffix of its pattern that
+    // matches; only the first is kept.
+    std::unique_ptr<radix_seen<V>> item_set;
+    if (m_infix) {
+      item_set.reset(new radix_seen<V>(m_value_domain));
+    }
+    const radix_tree_node<V>* temp = match_node->m_first;
+    while (temp != nullptr) {
+      temp->m_value.for_each([&](const V& p) {
+        if (item_set == nullptr || item_set->insert(p)) {
+          vec.push_back(p);
+        }
+      });
+      if (temp == match_node->m_last) {
+        break;
+      }
+      temp = temp->m_last;
+    }
   }
+}
 
-  std::tuple<radix_tree_node<V>*, int, int> node_depth = find_node(uchars);
-  radix_tree_node<V>* match_node = std::get<0>(node_depth);
-  int match_count = std::get<1>(node_depth);
-  int match_depth = std::get<2>(node_depth);
+// Resolve the node find_prefix() would return for every key, walking the keys
+// in sorted order. "path" holds the nodes whose whole key the previous key
+// went through, with the number of key bytes consumed below each; the next key
+// resumes from the deepest of them that lies within the prefix both share.
+// "*order" receives the sorted key indexes, "*nodes" their matches.
+template <typename V>
+void radix_tree<V>::find_batch(
+    const std::vector<std::string>& keys,
+    std::vector<size_t>* order,
+    std::vector<const radix_tree_node<V>*>* nodes) const {
+  order->resize(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    (*order)[i] = i;
+  }
+  std::sort(order->begin(), order->end(), [&keys](size_t a, size_t b) {
+    return keys[a] < keys[b];
+  });
+  nodes->assign(keys.size(), nullptr);
 
-  if (match_depth == uchars.size()) {
-    return {match_node->m_first, match_node->m_last, match_node->m_count};
+  std::vector<std::pair<const radix_tree_node<V>*, size_t>> path(
+      1, std::make_pair(m_root, 0));
+  const char* prev = nullptr;
+  size_t prev_len = 0;
+  for (size_t i = 0; i < order->size(); ++i) {
+    const char* key = keys[(*order)[i]].data();
+    size_t len = keys[(*order)[i]].size();
+    const char* nul = static_cast<const char*>(memchr(key, 0, len));
+    if (nul != nullptr) {
+      len = nul - key;
+    }
+    size_t common = prev != nullptr
+                        ? radix_mismatch(key, prev, std::min(len, prev_len))
+                        : 0;
+    while (path.size() > 1 && path.back().second > common) {
+      path.pop_back();
+    }
+    prev = key;
+    prev_len = len;
+    if (len == 0) {
+      continue;
+    }
+
+    // The rest of find_prefix(), from the resume point.
+    const radix_tree_node<V>* result = path.back().first;
+    size_t pos = path.back().second;
+    if (pos == len) {
+      (*nodes)[i] = result;
+      continue;
+    }
+    while (true) {
+      size_t uchar_len = radix_utf8_length(key[pos]);
+      if (uchar_len == 0 || uchar_len > len - pos) {
+        break;
+      }
+      const radix_tree_node<V>* child =
+          result->m_children.find(radix_child_key(key + pos, uchar_len));
+      if (child == nullptr) {
+        break;
+      }
+      const char* child_key = m_keys.data(child->m_key);
+      __builtin_prefetch(child_key);
+      size_t compare = std::min(len - pos, child->m_key.size());
+      if (radix_mismatch(key + pos + uchar_len, child_key + uchar_len,
+                         compare - uchar_len) != compare - uchar_len) {
+        break;
+      }
+      pos += compare;
+      if (compare == child->m_key.size()) {
+        path.emplace_back(child, pos);
+      }
+      if (pos == len) {
+        if (compare == child->m_key.size() ||
+            !radix_utf8_continuation(child_key[compare])) {
+          (*nodes)[i] = child;
+        }
+        break;
+      }
+      result = child;
+    }
   }
+}
 
-  return {nullptr, nullptr, 0};
+template <typename V>
+void radix_tree<V>::match_batch(const std::vector<std::string>& keys,
+                                std::vector<std::vector<V>>& results) const {
+  std::vector<size_t> order;
+  std::vector<const radix_tree_node<V>*> nodes;
+  find_batch(keys, &order, &nodes);
+  results.resize(keys.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    if (i + BATCH_PREFETCH < nodes.size() &&
+        nodes[i + BATCH_PREFETCH] != nullptr) {
+      __builtin_prefetch(nodes[i + BATCH_PREFETCH]->m_first);
+    }
+    std::vector<V>& vec = results[order[i]];
+    vec.clear();
+    collect_values(nodes[i], &vec);
+  }
 }
 
-static const int nodes_threshold = 200;
+template <typename V>
+radix_tree_iter<V> radix_tree<V>::match(const std::string& key) const {
+  const radix_tree_node<V>* match_node = find_prefix(key.data(), key.size());
+  RADIX_COUNT(m_counters.lookup(match_node != nullptr));
+  if (match_node != nullptr) {
+    return {match_node->m_first, match_node->m_last, match_node->m_count,
+            match_node, 0, &m_keys};
+  }
+
+  return {nullptr, nullptr, 0, nullptr, 0, &m_keys};
+}
 
 template <typename V>
-void radix_tree<V>::heap_insert(std::vector<V>* result,
-                                V item,
-                                std::function<bool(V, V)> compfunc,
-                                int recall_limit) {
-  if (result == nullptr) {
-    return;
+radix_tree_iter<V> radix_tree<V>::lower_bound(const std::string& key) const {
+  int rank;
+  const radix_tree_node<V>* first = seek(key, false, &rank);
+  return {first, m_root->m_last, m_root->m_count - rank, m_root, rank,
+          &m_keys};
+}
+
+template <typename V>
+radix_tree_iter<V> radix_tree<V>::upper_bound(const std::string& key) const {
+  int rank;
+  const radix_tree_node<V>* first = seek(key, true, &rank);
+  return {first, m_root->m_last, m_root->m_count - rank, m_root, rank,
+          &m_keys};
+}
+
+template <typename V>
+radix_tree_iter<V> radix_tree<V>::range(const std::string& from,
+                                        const std::string& to,
+                                        bool order) const {
+  int from_rank, to_rank;
+  const radix_tree_node<V>* first = seek(from, false, &from_rank);
+  const radix_tree_node<V>* end = seek(to, false, &to_rank);
+  if (to_rank <= from_rank) {
+    return {nullptr, nullptr, 0, nullptr, 0, &m_keys};
   }
-  if (result->size() < recall_limit) {
-    result->push_back(item);
-    std::push_heap(result->begin(), result->end(), compfunc);
-  } else if (compfunc(item, result->at(0))) {
-    std::pop_heap(result->begin(), result->end(), compfunc);
-    result->pop_back();
-    result->push_back(item);
-    std::push_heap(result->begin(), result->end(), compfunc);
+  const radix_tree_node<V>* last =
+      end != nullptr ? end->m_first : m_root->m_last;
+  if (order) {
+    return {first, last, to_rank - from_rank, m_root, from_rank, &m_keys};
   }
+  return {last, first, to_rank - from_rank, m_root, to_rank - 1, &m_keys,
+          false};
 }
 
+// Return the first leaf whose pattern is not less than "key", or greater than
+// it if "upper" is set, and in "*rank" the number of patterns before it.
+// Returns null past the last pattern.
 template <typename V>
-void radix_tree<V>::finish(std::function<bool(V, V)> compfunc,
-                           int recall_limit) const {
-  if (m_root->m_count < nodes_threshold)
-    return;
+const radix_tree_node<V>* radix_tree<V>::seek(const std::string& key,
+                                              bool upper,
+                                              int* rank) const {
+  const radix_tree_node<V>* node = m_root;
+  size_t pos = 0;
+  *rank = 0;
+  while (true) {
+    // Every pattern below "node" starts with key[0, pos).
+    if (pos == key.size()) {
+      if (upper && node->m_leaf != nullptr) {
+        ++*rank;
+        return node->m_leaf->m_last;
+      }
+      return node->m_first;
+    }
+    if (node->m_leaf != nullptr) {
+      ++*rank;
+    }
+
+    // Children are keyed by their first code point, packed so that integer
+    // order is byte order; the ones before "iter" sort before "key".
+    size_t uchar_len = std::max<size_t>(radix_utf8_length(key[pos]), 1);
+    uint64_t uchar = radix_child_key(key.data() + pos,
+                                     std::min(uchar_len, key.size() - pos));
+    typename radix_tree_node<V>::it_child iter =
+        node->m_children.lower_bound(uchar);
+    for (typename radix_tree_node<V>::it_child before =
+             node->m_children.begin();
+         before != iter; ++before) {
+      *rank += (*before)->m_count;
+    }
+
+    if (iter != node->m_children.end() && iter.key() == uchar) {
+      const radix_tree_node<V>* child = *iter;
+      const char* child_key = m_keys.data(child->m_key);
+      size_t compare = std::min(key.size() - pos, child->m_key.size());
+      size_t common = radix_mismatch(child_key, key.data() + pos, compare);
+      if (common == compare) {
+        if (compare == child->m_key.size()) {
+          node = child;
+          pos += compare;
+          continue;
+        }
+        return child->m_first;
+      }
+      if (static_cast<unsigned char>(child_key[common]) >
+          static_cast<unsigned char>(key[pos + common])) {
+        return child->m_first;
+      }
+      *rank += child->m_count;
+      ++iter;
+    }
+    if (iter != node->m_children.end()) {
+      return (*iter)->m_first;
+    }
+    return node->m_last != nullptr ? node->m_last->m_last : nullptr;
+  }
+}
+
+template <typename V>
+void radix_tree<V>::set_heap(radix_tree_node<V>* current,
+                             const std::vector<V>& heap) const {
+  release_heap(current);
+  current->m_heap = store_heap(heap);
+}
 
-  std::vector<radix_tree_node<V>*> process_nodes;
-  process_nodes.push_back(m_root);
-  int index = 0;
+template <typename V>
+void radix_tree<V>::finish_scored(int recall_limit) const {
+  if (m_adaptive) {
+    release_heaps();
+  }
+  m_compfunc = nullptr;
+  m_recall_limit = recall_limit;
+  m_score_lists = true;
+  m_cache.clear();
+  if (m_root->m_count < NODES_THRESHOLD) {
+    return;
+  }
 
-  while (index < process_nodes.size()) {
+  std::vector<radix_tree_node<V>*> process_nodes(1, m_root);
+  for (size_t index = 0; index < process_nodes.size(); ++index) {
     radix_tree_node<V>* current = process_nodes[index];
     for (typename radix_tree_node<V>::it_child iter =
              current->m_children.begin();
          iter != current->m_children.end(); ++iter) {
-      if (iter->second->m_count > nodes_threshold) {
-        process_nodes.push_back(iter->second);
+      if ((*iter)->m_count > NODES_THRESHOLD) {
+        process_nodes.push_back(*iter);
       }
     }
-    ++index;
   }
+  for (size_t index = process_nodes.size(); index-- > 0;) {
+    build_scored_heap(process_nodes[index], recall_limit);
+  }
+}
 
-  for (int index = process_nodes.size() - 1; index >= 0; --index) {
-    radix_tree_node<V>* current = process_nodes[index];
-    current->m_heap = new std::vector<V>();
-    std::unordered_set<V> item_set;
-    std::vector<std::pair<radix_tree_node<V>*, radix_tree_node<V>*>> heap_range;
-    if (!current->m_children.empty()) {
-      heap_range.reserve(current->m_children.size());
+// Drop every top-k list and leave adaptive mode.
+template <typename V>
+void radix_tree<V>::release_heaps() const {
+  std::vector<radix_tree_node<V>*> stack(1, m_root);
+  while (!stack.empty()) {
+    radix_tree_node<V>* current = stack.back();
+    stack.pop_back();
+    release_heap(current);
+    for (typename radix_tree_node<V>::it_child iter =
+             current->m_children.begin();
+         iter != current->m_children.end(); ++iter) {
+      stack.push_back(*iter);
+    }
+  }
+  reclaim_heaps();
+  m_adapt.reset(0);
+  m_adaptive = false;
+}
+
+// Free the lists that queries withdrew in adaptive mode. Called by writes,
+// which no query runs alongside, and by free_retired().
+template <typename V>
+void radix_tree<V>::reclaim_heaps() const {
+  for (radix_values<V>* heap : m_retired) {
+    heap->release(m_heaps);
+    m_heaps.deallocate(heap, sizeof(radix_values<V>));
+  }
+  m_retired.clear();
+}
+
+// Whether a top-k query that just scanned the leaves below "node" for lack
+// of a list has made the node earn one.
+template <typename V>
+bool radix_tree<V>::wants_heap(const radix_tree_node<V>* node) const {
+  if (node->m_count < ADAPT_MIN_LEAVES) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(m_adapt_mutex);
+  return m_adapt.scanned(node, node->m_count, ADAPT_HEAT);
+}
+
+// Give "node" the list "heap", built by a query, unless another query got
+// there first, and withdraw the lists the budget has no room left for.
+// Other queries may still be reading those, so they are retired, and freed
+// once the query adopting a list is the only one counted in m_readers.
+// Retired lists count against the budget until then, and a list that would
+// take the lists over it waits for a query that can free them.
+// REQUIRES: the calling query is counted in m_readers once.
+template <typename V>
+void radix_tree<V>::adopt_heap(const radix_tree_node<V>* node,
+                               const std::vector<V>& heap) const {
+  std::lock_guard<std::mutex> lock(m_adapt_mutex);
+  if (node->heap() != nullptr) {
+    return;
+  }
+  free_retired();
+  if (m_adapt.lists() + m_retired.size() >= m_adapt.max_lists() &&
+      !sole_reader()) {
+    return;
+  }
+  std::vector<const void*> evicted;
+  m_adapt.admit(node, &evicted);
+  for (const void* victim : evicted) {
+    radix_tree_node<V>* evicted_node = static_cast<radix_tree_node<V>*>(
+        const_cast<void*>(victim));
+    m_retired.push_back(evicted_node->m_heap);
+    evicted_node->publish_heap(nullptr);
+  }
+  const_cast<radix_tree_node<V>*>(node)->publish_heap(store_heap(heap));
+  free_retired();
+}
+
+// Whether no query but the calling one may be reading lists. A query that
+// loads a list after it was withdrawn finds null, and one that loaded it
+// before is still counted.
+// REQUIRES: the calling query is counted in m_readers once.
+template <typename V>
+bool radix_tree<V>::sole_reader() const {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return m_readers.load() == 1;
+}
+
+// Free the retired lists if no other query may be reading them.
+// REQUIRES: m_adapt_mutex is held, and the calling query is counted once.
+template <typename V>
+void radix_tree<V>::free_retired() const {
+  if (!m_retired.empty() && sole_reader()) {
+    reclaim_heaps();
+  }
+}
+
+// Mark the list of "node" as used, for one hit in ADAPT_HIT_SAMPLE, and
+// never waiting for the lock.
+template <typename V>
+void radix_tree<V>::note_hit(const radix_tree_node<V>* node) const {
+  static thread_local unsigned hits = 0;
+  if (++hits % ADAPT_HIT_SAMPLE != 0) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(m_adapt_mutex, std::try_to_lock);
+  if (lock.owns_lock()) {
+    m_adapt.hit(node);
+  }
+}
+
+template <typename V>
+radix_adaptive_stats radix_tree<V>::adaptive_stats() const {
+  std::lock_guard<std::mutex> lock(m_adapt_mutex);
+  return m_adapt.stats();
+}
+
+template <typename V>
+void radix_tree<V>::rebuild_heap(radix_tree_node<V>* current) const {
+  if (m_score_lists) {
+    build_scored_heap(current, m_recall_limit);
+  } else {
+    build_heap(current, m_compfunc, m_recall_limit);
+  }
+}
+
+// Compute the scored list of "current" from the lists of its children and
+// the leaves not covered by them, as collect_heap() does.
+// REQUIRES: every child with more than NODES_THRESHOLD leaves has its list.
+template <typename V>
+void radix_tree<V>::build_scored_heap(radix_tree_node<V>* current,
+                                      int recall_limit) const {
+  radix_top_scores<V> top(recall_limit,
+                          -std::numeric_limits<float>::infinity());
+  std::vector<V> buffer;
+  std::vector<std::pair<radix_tree_node<V>*, radix_tree_node<V>*>> heap_range;
+  for (typename radix_tree_node<V>::it_child iter =
+           current->m_children.begin();
+       iter != current->m_children.end(); ++iter) {
+    const radix_values<V>* heap = (*iter)->m_heap;
+    if (heap != nullptr) {
+      top.add(heap->begin(), heap->scores(), heap->size());
+      heap_range.emplace_back((*iter)->m_first, (*iter)->m_last);
+    }
+  }
+
+  int range_index = 0;
+  const radix_tree_node<V>* temp = current->m_first;
+  while (temp != nullptr) {
+    if (range_index < heap_range.size() &&
+        temp == heap_range[range_index].first) {
+      temp = heap_range[range_index].second;
+      ++range_index;
+    } else {
+      top.add(temp->m_value.values(&buffer), temp->m_value.scores(),
+              temp->m_value.size());
+    }
+    if (temp == current->m_last) {
+      break;
     }
+    temp = temp->m_last;
+  }
+
+  std::vector<V> values;
+  std::vector<float> scores;
+  top.finish(&values, &scores);
+  release_heap(current);
+  radix_values<V>* stored =
+      new (m_heaps.allocate(sizeof(radix_values<V>))) radix_values<V>();
+  stored->assign(values.data(), scores.data(), values.size(), m_heaps);
+  current->m_heap = stored;
+}
 
+template <typename V>
+std::string radix_tree<V>::freeze() const {
+  if (!std::is_trivially_copyable<V>::value) {
+    return std::string();
+  }
+  std::vector<radix_image_node> nodes(1);
+  std::vector<uint64_t> child_keys;
+  std::vector<uint32_t> child_nodes;
+  std::vector<radix_image_leaf> leaves;
+  std::vector<V> values;
+  std::vector<V> heap_values;
+  std::string keys;
+
+  // Depth-first, children in key order. An entry with a null node closes the
+  // run of leaves of the node it names, after its subtree.
+  std::vector<std::pair<const radix_tree_node<V>*, uint32_t>> stack;
+  std::vector<const radix_tree_node<V>*> children;
+  stack.emplace_back(m_root, 0);
+  while (!stack.empty()) {
+    const radix_tree_node<V>* current = stack.back().first;
+    uint32_t index = stack.back().second;
+    stack.pop_back();
+    if (current == nullptr) {
+      nodes[index].leaf_end = leaves.size();
+      continue;
+    }
+
+    radix_image_node node = radix_image_node();
+    node.key = keys.size();
+    node.key_size = current->m_key.size();
+    keys.append(m_keys.data(current->m_key), current->m_key.size());
+    // Scored lists have no place in the image, which is served by
+    // comparator.
+    if (current->m_heap != nullptr && current->m_heap->scores() == nullptr) {
+      node.heap = heap_values.size();
+      node.heap_size = current->m_heap->size();
+      heap_values.insert(heap_values.end(), current->m_heap->begin(),
+                         current->m_heap->end());
+    }
+    node.leaf_begin = leaves.size();
+    if (current->m_leaf != nullptr) {
+      const radix_values<V>& leaf_values = current->m_leaf->m_value;
+      node.has_leaf = 1;
+      leaves.push_back({values.size(), leaf_values.size()});
+      leaf_values.append_to(&values);
+    }
+    node.child_begin = child_keys.size();
+    node.child_count = current->m_children.size();
+
+    children.clear();
     for (typename radix_tree_node<V>::it_child iter =
              current->m_children.begin();
          iter != current->m_children.end(); ++iter) {
-      if (iter->second->m_heap != nullptr) {
-        for (V item : *iter->second->m_heap) {
-          if (item_set.count(item) > 0) {
-            continue;
-          }
-          item_set.insert(item);
-          heap_insert(current->m_heap, item, compfunc, recall_limit);
-        }
-        heap_range.emplace_back(iter->second->m_first, iter->second->m_last);
-      }
+      child_keys.push_back(iter.key());
+      child_nodes.push_back(nodes.size() + children.size());
+      children.push_back(*iter);
     }
+    uint32_t first_child = nodes.size();
+    nodes[index] = node;
+    nodes.resize(nodes.size() + children.size());
+    stack.emplace_back(nullptr, index);
+    for (size_t i = children.size(); i > 0; --i) {
+      stack.emplace_back(children[i - 1], first_child + i - 1);
+    }
+  }
 
-    int range_index = 0;
-    radix_tree_node<V>* temp = current->m_first;
-    while (temp != nullptr) {
-      if (range_index < heap_range.size() &&
-          temp == heap_range[range_index].first) {
-        temp = heap_range[range_index].second;
-        ++range_index;
-      } else {
-        if (temp->m_value != nullptr) {
-          for (V p : *temp->m_value) {
-            if (item_set.count(p) > 0) {
-              continue;
-            }
-            item_set.insert(p);
-            heap_insert(current->m_heap, p, compfunc, recall_limit);
-          }
-        }
-      }
-      if (temp == current->m_last) {
-        break;
+  radix_image_header header = radix_image_header();
+  memcpy(header.magic, "RADIXIMG", sizeof(header.magic));
+  header.version = kImageVersion;
+  header.value_size = sizeof(V);
+  header.flags = m_infix ? kImageInfix : 0;
+  header.node_count = nodes.size();
+  header.child_count = child_keys.size();
+  header.leaf_count = leaves.size();
+  header.value_count = values.size();
+  header.heap_value_count = heap_values.size();
+  header.key_bytes = keys.size();
+
+  std::string image(sizeof(header), '\0');
+  auto append = [&image](const void* data, size_t size) {
+    image.resize((image.size() + kImageAlignment - 1) / kImageAlignment *
+                 kImageAlignment);
+    uint64_t offset = image.size();
+    if (size > 0) {
+      image.append(static_cast<const char*>(data), size);
+    }
+    return offset;
+  };
+  header.nodes = append(nodes.data(), nodes.size() * sizeof(nodes[0]));
+  header.child_keys =
+      append(child_keys.data(), child_keys.size() * sizeof(uint64_t));
+  header.child_nodes =
+      append(child_nodes.data(), child_nodes.size() * sizeof(uint32_t));
+  header.leaves = append(leaves.data(), leaves.size() * sizeof(leaves[0]));
+  header.values = append(values.data(), values.size() * sizeof(V));
+  header.heap_values =
+      append(heap_values.data(), heap_values.size() * sizeof(V));
+  header.keys = append(keys.data(), keys.size());
+  header.size = image.size();
+  memcpy(&image[0], &header, sizeof(header));
+  return image;
+}
+
+template <typename V>
+bool radix_tree<V>::save(const std::string& path) const {
+  std::string image = freeze();
+  if (image.empty()) {
+    return false;
+  }
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    return false;
+  }
+  bool written = fwrite(image.data(), 1, image.size(), file) == image.size();
+  return fclose(file) == 0 && written;
+}
+
+template <typename V>
+radix_tree_loader<V>::radix_tree_loader(radix_tree<V>* tree)
+    : radix_tree_loader(tree, nullptr, 0) {}
+
+template <typename V>
+radix_tree_loader<V>::radix_tree_loader(radix_tree<V>* tree,
+                                        std::function<bool(V, V)> compfunc,
+                                        int recall_limit)
+    : m_tree(tree),
+      m_compfunc(compfunc),
+      m_recall_limit(recall_limit),
+      m_fallback(tree->m_root->m_count != 0 || tree->m_infix) {
+  if (m_compfunc && !m_fallback && tree->m_adaptive) {
+    tree->release_heaps();
+  }
+  m_path.push_back({tree->m_root, 0, 0});
+}
+
+template <typename V>
+bool radix_tree_loader<V>::add(const std::string& pattern, V value) {
+  if (m_done) {
+    return false;
+  }
+  if (m_fallback) {
+    typename radix_tree<V>::size_type size = m_tree->size();
+    m_tree->insert(pattern, value);
+    return m_tree->size() != size;
+  }
+  if (!m_tree->UTF8Decode(pattern.data(), pattern.size(), m_uchars) ||
+      m_uchars.empty()) {
+    return false;
+  }
+  size_t len = 0;
+  for (const Slice& uchar : m_uchars) {
+    len += uchar.size();
+  }
+  if (!m_tree->m_keys.can_store(len)) {
+    return false;
+  }
+  Slice key(pattern.data(), len);
+
+  size_t common = 0;
+  if (m_leaf != nullptr) {
+    int order = key.compare(Slice(m_prev));
+    if (order < 0) {
+      return false;
+    }
+    if (order == 0) {
+      if (!m_tree->add_value(&m_leaf->m_value, value, nullptr)) {
+        return false;
       }
-      temp = temp->m_last;
+      ++m_path.back().node->m_value_count;
+      ++m_tree->m_size;
+      return true;
+    }
+    common = radix_mismatch(key.data(), m_prev.data(),
+                            std::min(key.size(), m_prev.size()));
+  }
+  // Both patterns are valid UTF-8 and agree up to "common", so they have the
+  // same code point boundaries there.
+  size_t lcp = 0;
+  for (const Slice& uchar : m_uchars) {
+    if (lcp + uchar.size() > common) {
+      break;
     }
+    lcp += uchar.size();
+  }
+
+  // Nothing sorting after this pattern can enter a subtree that starts at or
+  // below the point where it leaves the previous one.
+  while (m_path.size() > 1 && m_path.back().begin >= lcp) {
+    pop();
+  }
+
+  if (m_path.back().end > lcp) {
+    // The pattern leaves the previous one inside a node key: split the node.
+    radix_tree_node<V>* lower = m_path.back().node;
+    size_t begin = m_path.back().begin;
+    seal(lower);
+    m_path.pop_back();
+
+    radix_key_store& keys = m_tree->m_keys;
+    radix_tree_node<V>* upper = m_tree->create_node();
+    upper->m_key = keys.substr(lower->m_key, 0, lcp - begin);
+    lower->m_key = keys.substr(lower->m_key, lcp - begin,
+                               lower->m_key.size() - (lcp - begin));
+    upper->m_first = lower->m_first;
+    upper->m_count = lower->m_count;
+    upper->m_value_count = lower->m_value_count;
+    Slice lower_key = keys.slice(lower->m_key);
+    upper->m_children.insert(
+        radix_child_key(lower_key.data(), radix_utf8_length(lower_key[0])),
+        lower, m_tree->m_nodes);
+    Slice upper_key = keys.slice(upper->m_key);
+    m_path.back().node->m_children.insert(
+        radix_child_key(upper_key.data(), radix_utf8_length(upper_key[0])),
+        upper, m_tree->m_nodes);
+    m_path.push_back({upper, begin, lcp});
+  }
+
+  radix_tree_node<V>* node = m_tree->create_node();
+  radix_tree_node<V>* leaf = m_tree->create_leaf(
+      m_tree->m_keys.store(key.data(), len), value, nullptr);
+  node->m_key = m_tree->m_keys.substr(leaf->m_key, lcp, len - lcp);
+  node->m_leaf = leaf;
+  node->m_first = leaf;
+  node->m_count = 1;
+  node->m_value_count = 1;
+  if (m_leaf != nullptr) {
+    m_leaf->m_last = leaf;
+    leaf->m_first = m_leaf;
+  } else {
+    m_tree->m_root->m_first = leaf;
+  }
+  Slice node_key = m_tree->m_keys.slice(node->m_key);
+  m_path.back().node->m_children.insert(
+      radix_child_key(node_key.data(), radix_utf8_length(node_key[0])), node,
+      m_tree->m_nodes);
+  m_path.push_back({node, lcp, len});
+
+  m_leaf = leaf;
+  m_prev.assign(key.data(), key.size());
+  ++m_tree->m_size;
+  return true;
+}
 
-    std::sort_heap(current->m_heap->begin(), current->m_heap->end(), compfunc);
+template <typename V>
+void radix_tree_loader<V>::seal(radix_tree_node<V>* node) {
+  node->m_last = m_leaf;
+  if (m_compfunc && node->m_count > radix_tree<V>::NODES_THRESHOLD) {
+    m_tree->build_heap(node, m_compfunc, m_recall_limit);
+  }
+}
+
+template <typename V>
+void radix_tree_loader<V>::pop() {
+  radix_tree_node<V>* node = m_path.back().node;
+  seal(node);
+  m_path.pop_back();
+  m_path.back().node->m_count += node->m_count;
+  m_path.back().node->m_value_count += node->m_value_count;
+}
+
+template <typename V>
+void radix_tree_loader<V>::done() {
+  if (m_done) {
+    return;
+  }
+  m_done = true;
+  if (m_compfunc) {
+    m_tree->m_compfunc = m_compfunc;
+    m_tree->m_recall_limit = m_recall_limit;
+    m_tree->m_score_lists = false;
+  }
+  if (m_fallback) {
+    if (m_compfunc) {
+      m_tree->finish(m_compfunc, m_recall_limit);
+    }
+    return;
+  }
+  while (m_path.size() > 1) {
+    pop();
+  }
+  radix_tree_node<V>* root = m_tree->m_root;
+  root->m_last = m_leaf;
+  if (m_compfunc && root->m_count >= radix_tree<V>::NODES_THRESHOLD) {
+    m_tree->build_heap(root, m_compfunc, m_recall_limit);
   }
 }
 
 template class radix_tree<int>;
+template class radix_tree_loader<int>;
 
 }  // namespace radix
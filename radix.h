@@ -1,77 +1,305 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstring>
 #include <functional>
 #include <iterator>
-#include <list>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <tuple>
-#include <unordered_set>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+#include "radix_adaptive.h"
+#include "radix_cache.h"
+#include "radix_dedup.h"
 #include "radix_node.h"
+#include "radix_pool.h"
+#include "radix_score.h"
+#include "radix_stats.h"
+#include "radix_utf8.h"
 
 namespace radix {
 
+template <typename V>
+class radix_tree_loader;
+
+// How the leaves of a radix_tree store their values; see
+// radix_tree::set_value_encoding().
+enum radix_value_encoding { kPlainValues, kCompactValues };
+
 template <typename V>
 class radix_tree {
+  friend class radix_tree_loader<V>;
+
  public:
   typedef std::size_t size_type;
 
-  radix_tree()
-      : m_size(0),
+  explicit radix_tree(radix_chunk_allocator* chunks = nullptr)
+      : m_nodes(chunks),
+        m_keys(chunks),
+        m_values(chunks),
+        m_heaps(chunks),
+        m_size(0),
+        m_root(create_node()),
         m_first(nullptr),
-        m_last(nullptr),
-        m_root(new radix_tree_node<V>()) {}
-  ~radix_tree() {
-    radix_tree_node<V>* curr = m_root->m_first;
-    while (curr != nullptr) {
-      radix_tree_node<V>* temp = curr->m_last;
-      delete curr;
-      curr = temp;
-    }
-    delete m_root;
-  }
+        m_last(nullptr) {}
+  ~radix_tree() { destroy_values(); }
 
+  // The number of values stored, each counted once per insert() that added
+  // it and not erased since.
   size_type size() const { return m_size; }
   bool empty() const { return m_size == 0; }
   void clear() {
-    radix_tree_node<V>* curr = m_root->m_first;
-    while (curr != nullptr) {
-      radix_tree_node<V>* temp = curr->m_last;
-      delete curr;
-      curr = temp;
-    }
-    delete m_root;
-    m_root = new radix_tree_node<V>();
+    destroy_values();
+    m_nodes.reset();
+    m_keys.reset();
+    m_values.reset();
+    m_heaps.reset();
+    m_cache.clear();
+    m_retired.clear();
+    m_adapt.clear();
+    m_root = create_node();
     m_size = 0;
   }
 
+  radix_memory_stats memory_usage() const;
+  // Walks the whole tree.
+  radix_tree_stats stats() const;
+  radix_query_stats query_stats() const;
+  void reset_query_stats();
+
+  // Cache, in up to "bytes" bytes, the lists that top-k match() and
+  // match_batch() compute for prefixes with at least CACHE_MIN_LEAVES (32)
+  // patterns and no list from finish(). insert() and erase() drop the lists
+  // of the prefixes of their pattern. A cached list only answers queries with
+  // the same ordering, as radix_order_of() identifies it; queries whose
+  // comparator it cannot identify, such as a functor with state, bypass the
+  // cache. 0, the default, turns the cache off.
+  void set_cache_capacity(size_t bytes) { m_cache.set_capacity(bytes); }
+  radix_cache_stats cache_stats() const { return m_cache.stats(); }
+
+  // Tell top-k queries and finish() that values are mostly integers in
+  // [0, domain), such as dense ids, so that they skip duplicates by marking
+  // them in an array of "domain" entries per thread rather than by hashing.
+  // Values outside the domain are still handled. 0, the default, hashes all
+  // values.
+  void set_value_domain(size_t domain) { m_value_domain = domain; }
+  size_t value_domain() const { return m_value_domain; }
+
+  // Index every code point suffix of each pattern as well, so that match()
+  // and the other prefix queries find the patterns that contain the key
+  // anywhere. A suffix is stored like a pattern, under the values of its
+  // pattern, with a key that shares the bytes of the pattern's; the top-k
+  // lists cover the suffixes like any pattern. Queries other than iterators
+  // return a value once however many suffixes of its pattern match, and
+  // iterators, stats() and freeze() see the suffixes as patterns. erase()
+  // takes back what insert() added, looking up the pattern behind each first
+  // code point to tell the values of the pattern from those of the patterns
+  // that end with it. Set on an empty tree.
+  void set_infix(bool infix) {
+    assert(m_root->m_count == 0 && m_encoding == kPlainValues);
+    m_infix = infix;
+  }
+  bool infix() const { return m_infix; }
+
+  // Keep the values of each pattern sorted and distinct instead of in the
+  // order they were inserted, so that lists of radix_values<V>::kPackSize
+  // (32) or more values without scores are stored packed: in frames of gaps
+  // between ascending values, bit-packed at the width of the widest (see
+  // radix_packed.h). With kCompactValues, insert() of a value that is
+  // already under its pattern adds nothing, though it raises its score;
+  // match(), iterators and freeze() give the values of a pattern in
+  // ascending order; and erase(pattern, value) removes at most one value.
+  // An insert or erase that changes a packed list encodes the one frame of
+  // its value anew and copies the others; an insert with a score unpacks the
+  // list for good. For integer V only. Set on an empty tree, and not in
+  // infix mode.
+  void set_value_encoding(radix_value_encoding encoding) {
+    assert(m_root->m_count == 0 && !m_infix);
+    assert(encoding == kPlainValues || std::is_integral<V>::value);
+    m_encoding = encoding;
+  }
+  radix_value_encoding value_encoding() const { return m_encoding; }
+
   bool UTF8Decode(const char* str,
                   size_t len,
                   std::vector<Slice>& uchars) const;
 
   void insert(const std::string& pattern, V value);
+  // Insert "value" with a score for match_scored(). Values inserted without
+  // one score 0.
+  void insert(const std::string& pattern, V value, float score);
+  // Remove "pattern" with all of its values, or only the copies of "value"
+  // stored under it. Returns the number of values removed. Once the patterns
+  // erased hold half of the stored key bytes, the key store is compacted;
+  // once none are left, it is freed.
+  size_type erase(const std::string& pattern);
+  size_type erase(const std::string& pattern, V value);
   void match(const std::string& key, std::vector<V>& vec) const;
+  // The "recall_limit" smallest distinct values under "key", in ascending
+  // order under "compfunc(V, V)". "compfunc" is a template parameter so that
+  // the comparisons inline; a std::function works as well.
+  template <typename Compare>
   void match(const std::string& key,
              std::vector<V>& vec,
-             std::function<bool(V, V)> compfunc,
+             Compare compfunc,
              int recall_limit) const;
   radix_tree_iter<V> match(const std::string& key) const;
+  // The "recall_limit" distinct values under "key" with the highest scores
+  // of at least "min_score", best first, ties going to the smaller value. A
+  // value stored more than once ranks by its best score. The values are
+  // appended to "vec", and their scores to "*scores" unless it is null.
+  void match_scored(const std::string& key,
+                    std::vector<V>& vec,
+                    int recall_limit,
+                    float min_score = -std::numeric_limits<float>::infinity(),
+                    std::vector<float>* scores = nullptr) const;
+  // Like match(), for the patterns that start with a string within
+  // "max_edits" code point insertions, deletions and substitutions of "key".
+  // The values come in pattern order; the top-k form ranks them by
+  // "compfunc" alone, whatever the number of edits.
+  void fuzzy_match(const std::string& key,
+                   int max_edits,
+                   std::vector<V>& vec) const;
+  template <typename Compare>
+  void fuzzy_match(const std::string& key,
+                   int max_edits,
+                   std::vector<V>& vec,
+                   Compare compfunc,
+                   int recall_limit) const;
+  // Iterate over the patterns from the first one not less than "key"
+  // (lower_bound) or greater than it (upper_bound) to the last one, in
+  // pattern order. Patterns compare the way std::string does.
+  radix_tree_iter<V> lower_bound(const std::string& key) const;
+  radix_tree_iter<V> upper_bound(const std::string& key) const;
+  // Iterate over the patterns in [from, to), in pattern order, or in reverse
+  // if "order" is false.
+  radix_tree_iter<V> range(const std::string& from,
+                           const std::string& to,
+                           bool order = true) const;
+  // Give results[i] what match(keys[i], results[i]) gives an empty vector,
+  // for every i. Keys are walked in sorted order, resuming from the part of
+  // the previous walk they share, and the leaves of the next matches are
+  // prefetched while the values of the current one are copied.
+  void match_batch(const std::vector<std::string>& keys,
+                   std::vector<std::vector<V>>& results) const;
+  template <typename Compare>
+  void match_batch(const std::vector<std::string>& keys,
+                   std::vector<std::vector<V>>& results,
+                   Compare compfunc,
+                   int recall_limit) const;
+  template <typename Compare>
   static void heap_insert(std::vector<V>* result,
-                          V item,
-                          std::function<bool(V, V)> compfunc,
+                          const V& item,
+                          const Compare& compfunc,
                           int recall_limit);
-  void finish(std::function<bool(V, V)> compfunc, int recall_limit) const;
+  // Precompute the top-k lists of match(key, vec, compfunc, recall_limit)
+  // for the prefixes with many patterns. "compfunc" is kept, as a
+  // std::function, to maintain the lists on later inserts and erases.
+  template <typename Compare>
+  void finish(Compare compfunc, int recall_limit) const;
+  // Same result as above, computed by "threads" threads: independent
+  // subtrees are processed in parallel, each node after its children.
+  // "compfunc" is called concurrently.
+  template <typename Compare>
+  void finish(Compare compfunc, int recall_limit, int threads) const;
+  // Precompute the lists of match_scored(key, vec, recall_limit) instead,
+  // with scores, for the same prefixes. Like those of finish(), the lists
+  // are kept current on later inserts and erases, and replace any lists of
+  // an earlier finish().
+  void finish_scored(int recall_limit) const;
+  // Build the lists of finish() lazily instead, for the prefixes that top-k
+  // queries make worth it, in up to "heap_bytes" bytes. A prefix with at
+  // least ADAPT_MIN_LEAVES (32) patterns gets its list once its top-k
+  // queries have scanned ADAPT_HEAT (800) leaves without one; when the
+  // budget is full, the list of a prefix that has not been hit for the
+  // longest goes. Existing lists are dropped. Lists are always built in the
+  // ordering of "compfunc", whatever that of the query that earns them, and
+  // answer only top-k queries in that ordering for up to "recall_limit"
+  // values, as radix_order_of() tells orderings apart; other queries scan.
+  // Queries build and drop lists without disturbing concurrent queries. A
+  // dropped list is freed by the query that drops it unless other queries
+  // may still be reading it; until a later query or write frees it, it
+  // counts against the budget, and no list is added while such lists fill
+  // it.
+  template <typename Compare>
+  void finish_adaptive(Compare compfunc,
+                       int recall_limit,
+                       size_t heap_bytes) const;
+  radix_adaptive_stats adaptive_stats() const;
+
+  // Serialize the tree, with the top-k lists of the last finish(), into an
+  // image that radix_tree_view serves without loading it; see radix_view.h.
+  // Returns an empty string unless V is trivially copyable. save() returns
+  // false if there is no image or "path" cannot be written.
+  std::string freeze() const;
+  bool save(const std::string& path) const;
+
+  // Build the tree from a range of (pattern, value) pairs sorted by pattern,
+  // optionally precomputing the top-k lists on the way; see
+  // radix_tree_loader. Returns the number of pairs left out because their
+  // pattern is not valid UTF-8 or sorts before the previous one, or, with
+  // kCompactValues, because the value is already under the pattern.
+  template <typename Iterator>
+  size_type bulk_load(Iterator first, Iterator last);
+  template <typename Iterator>
+  size_type bulk_load(Iterator first,
+                      Iterator last,
+                      std::function<bool(V, V)> compfunc,
+                      int recall_limit);
 
  private:
   static const int MAX_NODES = 2000000;
   static const int SPLIT_NUMS = 3;
+  // Nodes with more leaves than this get a top-k list from finish(); the
+  // root already at this many.
+  static const int NODES_THRESHOLD = 200;
+  // Number of matches ahead of the one being copied whose first leaf is
+  // prefetched by match_batch().
+  static const size_t BATCH_PREFETCH = 4;
+  // Prefixes with fewer patterns are scanned faster than looked up in the
+  // result cache.
+  static const int CACHE_MIN_LEAVES = 32;
+  // See finish_adaptive(). One in ADAPT_HIT_SAMPLE hits on a list marks it
+  // as used.
+  static const int ADAPT_MIN_LEAVES = 32;
+  static const int ADAPT_HEAT = 4 * NODES_THRESHOLD;
+  static const unsigned ADAPT_HIT_SAMPLE = 8;
 
-  std::list<std::string> m_patterns;
+  radix_arena m_nodes;
+  radix_key_store m_keys;
+  radix_arena m_values;
+  mutable radix_arena m_heaps;
+  // The ordering and list length of the last finish(), which insert() keeps
+  // the precomputed top-k lists current with.
+  mutable std::function<bool(V, V)> m_compfunc;
+  mutable int m_recall_limit = 0;
+  // Whether the lists are those of finish_scored().
+  mutable bool m_score_lists = false;
+  // Whether the lists are built by queries, as finish_adaptive() set up, and
+  // the identity of its ordering. The policy, the lists withdrawn from nodes
+  // but maybe still being read, and list allocation by queries are guarded
+  // by m_adapt_mutex. m_readers counts the queries that may be reading lists.
+  mutable bool m_adaptive = false;
+  mutable radix_order_id m_adapt_order;
+  mutable std::mutex m_adapt_mutex;
+  mutable radix_heap_policy m_adapt;
+  mutable std::vector<radix_values<V>*> m_retired;
+  mutable std::atomic<int> m_readers{0};
+#ifdef RADIX_ENABLE_COUNTERS
+  mutable radix_query_counters m_counters;
+#endif
+  mutable radix_result_cache<V> m_cache;
+  size_t m_value_domain = 0;
+  bool m_infix = false;
+  radix_value_encoding m_encoding = kPlainValues;
   size_type m_size;
   radix_tree_node<V>* m_root;
   radix_tree_node<V>* m_first;
@@ -82,13 +310,551 @@ class radix_tree {
 
   bool SliceDecode(const Slice& str, Slice* uchar) const;
 
+  radix_tree_node<V>* create_node();
+  radix_tree_node<V>* create_leaf(const radix_key& key,
+                                  const V& value,
+                                  const float* score);
+  bool add_value(radix_values<V>* values, const V& value, const float* score);
+  size_t erase_value(radix_values<V>* values, const V& value);
+  void destroy_node(radix_tree_node<V>* node);
+  void reclaim_keys();
+  void release_heap(radix_tree_node<V>* node) const;
+  radix_values<V>* store_heap(const std::vector<V>& heap) const;
+  void destroy_values();
+  template <typename Compare>
+  void build_heap(radix_tree_node<V>* current,
+                  const Compare& compfunc,
+                  int recall_limit) const;
+  template <typename Compare>
+  void collect_heap(const radix_tree_node<V>* current,
+                    const Compare& compfunc,
+                    int recall_limit,
+                    std::vector<V>* heap) const;
+  void set_heap(radix_tree_node<V>* current, const std::vector<V>& heap) const;
+  void build_scored_heap(radix_tree_node<V>* current, int recall_limit) const;
+  void release_heaps() const;
+  void reclaim_heaps() const;
+  void adopt_heap(const radix_tree_node<V>* node,
+                  const std::vector<V>& heap) const;
+  template <typename Compare>
+  bool list_serves(const radix_values<V>* heap,
+                   const Compare& compfunc,
+                   int recall_limit) const;
+  bool sole_reader() const;
+  void free_retired() const;
+  void note_hit(const radix_tree_node<V>* node) const;
+  // What a query that may read lists counts itself in, if anything.
+  std::atomic<int>* adapt_readers() const {
+    return m_adaptive ? &m_readers : nullptr;
+  }
+  bool wants_heap(const radix_tree_node<V>* node) const;
+  void rebuild_heap(radix_tree_node<V>* current) const;
+
   std::tuple<radix_tree_node<V>*, int, int> find_node(
-      const std::vector<Slice>& key) const;
-  void update_node(const std::vector<Slice>& key,
-                   radix_tree_node<V>* old_last,
-                   radix_tree_node<V>* new_last);
+      const std::vector<Slice>& key,
+      std::vector<radix_tree_node<V>*>* path = nullptr) const;
+  const radix_tree_node<V>* find_prefix(const char* key, size_t len) const;
+  void find_batch(const std::vector<std::string>& keys,
+                  std::vector<size_t>* order,
+                  std::vector<const radix_tree_node<V>*>* nodes) const;
+  void fuzzy_nodes(const std::string& key,
+                   int max_edits,
+                   std::vector<const radix_tree_node<V>*>* nodes) const;
+  void collect_values(const radix_tree_node<V>* match_node,
+                      std::vector<V>* result) const;
+  template <typename Compare>
+  void collect_top(const radix_tree_node<V>* match_node,
+                   const Compare& compfunc,
+                   int recall_limit,
+                   std::vector<V>* result) const;
+  const radix_tree_node<V>* seek(const std::string& key,
+                                 bool upper,
+                                 int* rank) const;
+  void insert_value(const std::string& pattern, V value, const float* score);
+  radix_tree_node<V>* insert_leaf(const std::vector<Slice>& uchars,
+                                  size_t len,
+                                  const radix_key* bytes,
+                                  V value,
+                                  const float* score);
+  void update_node(const std::vector<radix_tree_node<V>*>& path,
+                   radix_tree_node<V>* leaf,
+                   const V& value,
+                   float score);
+  void update_heaps(const std::vector<radix_tree_node<V>*>& path,
+                    const V& value,
+                    float score);
+  void heap_update(radix_values<V>* heap, const V& value);
+  void score_update(radix_values<V>* heap, const V& value, float score);
+  size_type erase_values(const std::string& pattern, const V* value);
+  size_type erase_infix(const std::vector<Slice>& uchars, const V* value);
+  radix_tree_node<V>* find_leaf(
+      const std::vector<Slice>& uchars,
+      std::vector<radix_tree_node<V>*>* path) const;
+  void remove_values(const std::vector<radix_tree_node<V>*>& path,
+                     size_type count,
+                     const std::vector<V>& removed,
+                     bool whole);
+  void remove_leaf(const std::vector<radix_tree_node<V>*>& path);
+  void merge_node(radix_tree_node<V>* parent,
+                  radix_tree_node<V>* node,
+                  size_t depth);
+  void repair_heaps(const std::vector<radix_tree_node<V>*>& path,
+                    const std::vector<V>& removed);
+};
+
+// Builds a radix_tree in a single pass from patterns that arrive sorted the
+// way std::string compares them. Nodes are only ever added along the path of
+// the previous pattern, so no pattern is looked up from the root, and each
+// node gets its leaf range and count once, when its subtree is complete. With
+// a comparator, the top-k lists that finish() would build are computed at that
+// point as well.
+//
+// If the tree is not empty to begin with, or in infix mode, add() falls back
+// to insert() and done() to finish().
+template <typename V>
+class radix_tree_loader {
+ public:
+  explicit radix_tree_loader(radix_tree<V>* tree);
+  radix_tree_loader(radix_tree<V>* tree,
+                    std::function<bool(V, V)> compfunc,
+                    int recall_limit);
+  ~radix_tree_loader() { done(); }
+
+  // Add one pattern. Returns false, leaving the tree as it was, if the
+  // pattern is not valid UTF-8 or sorts before the previous one, or, with
+  // kCompactValues, is already there with "value".
+  bool add(const std::string& pattern, V value);
+
+  // Complete the tree. Called by the destructor if need be.
+  void done();
+
+ private:
+  struct path_entry {
+    radix_tree_node<V>* node;
+    size_t begin;  // pattern bytes above the node's key
+    size_t end;    // pattern bytes up to the end of the node's key
+  };
+
+  radix_tree_loader(const radix_tree_loader&);             // delete
+  radix_tree_loader& operator=(const radix_tree_loader&);  // delete
+
+  void seal(radix_tree_node<V>* node);
+  void pop();
+
+  radix_tree<V>* m_tree;
+  std::function<bool(V, V)> m_compfunc;
+  int m_recall_limit;
+  bool m_fallback;
+  bool m_done = false;
+  std::vector<path_entry> m_path;
+  std::vector<Slice> m_uchars;
+  std::string m_prev;
+  radix_tree_node<V>* m_leaf = nullptr;
 };
 
+template <typename V>
+template <typename Iterator>
+typename radix_tree<V>::size_type radix_tree<V>::bulk_load(Iterator first,
+                                                           Iterator last) {
+  radix_tree_loader<V> loader(this);
+  size_type rejected = 0;
+  for (; first != last; ++first) {
+    if (!loader.add(first->first, first->second)) {
+      ++rejected;
+    }
+  }
+  return rejected;
+}
+
+template <typename V>
+template <typename Iterator>
+typename radix_tree<V>::size_type radix_tree<V>::bulk_load(
+    Iterator first,
+    Iterator last,
+    std::function<bool(V, V)> compfunc,
+    int recall_limit) {
+  radix_tree_loader<V> loader(this, compfunc, recall_limit);
+  size_type rejected = 0;
+  for (; first != last; ++first) {
+    if (!loader.add(first->first, first->second)) {
+      ++rejected;
+    }
+  }
+  return rejected;
+}
+
+template <typename V>
+template <typename Compare>
+void radix_tree<V>::match(const std::string& key,
+                          std::vector<V>& vec,
+                          Compare compfunc,
+                          int recall_limit) const {
+#ifdef RADIX_ENABLE_COUNTERS
+  radix_latency_timer timer(&m_counters);
+#endif
+  collect_top(find_prefix(key.data(), key.size()), compfunc, recall_limit,
+              &vec);
+}
+
+template <typename V>
+template <typename Compare>
+void radix_tree<V>::collect_top(const radix_tree_node<V>* match_node,
+                                const Compare& compfunc,
+                                int recall_limit,
+                                std::vector<V>* result) const {
+  std::vector<V>& vec = *result;
+  RADIX_COUNT(m_counters.lookup(match_node != nullptr));
+  if (match_node != nullptr) {
+    radix_adapt_reader reader(adapt_readers());
+    bool empty = vec.empty();
+    radix_order_id order;
+    bool cached = m_cache.enabled() && empty &&
+                  match_node->m_count >= CACHE_MIN_LEAVES;
+    if (cached) {
+      order = radix_order_of(compfunc);
+      cached = order.known();
+    }
+    const radix_values<V>* heap = match_node->heap();
+    if (list_serves(heap, compfunc, recall_limit)) {
+      RADIX_COUNT(m_counters.heap_hit());
+      if (m_adaptive) {
+        note_hit(match_node);
+      }
+      int recall_num =
+          recall_limit < heap->size() ? recall_limit : heap->size();
+      vec.reserve(recall_num);
+      for (int i = 0; i < recall_num; ++i) {
+        vec.push_back(heap->at(i));
+      }
+    } else if (cached &&
+               m_cache.lookup(match_node, order, recall_limit, &vec)) {
+      return;
+    } else {
+      radix_seen<V> item_set(m_value_domain);
+      const radix_tree_node<V>* temp = match_node->m_first;
+      while (temp != nullptr) {
+        temp->m_value.for_each([&](const V& p) {
+          if (item_set.insert(p)) {
+            heap_insert(&vec, p, compfunc, recall_limit);
+          }
+        });
+        if (temp == match_node->m_last) {
+          break;
+        }
+        temp = temp->m_last;
+      }
+      RADIX_COUNT(m_counters.scan(match_node->m_count));
+      RADIX_COUNT(m_counters.dedup(item_set.size()));
+      std::sort_heap(vec.begin(), vec.end(), compfunc);
+      if (cached) {
+        m_cache.store(match_node, order, recall_limit, vec);
+      }
+      // Lists are kept in the ordering of finish_adaptive(), which later
+      // queries and inserts assume, so the result only serves as one if it
+      // was computed in that ordering.
+      if (m_adaptive && heap == nullptr && wants_heap(match_node)) {
+        if (empty && recall_limit == m_recall_limit &&
+            radix_order_of(compfunc) == m_adapt_order) {
+          adopt_heap(match_node, vec);
+        } else {
+          std::vector<V> list;
+          collect_heap(match_node, m_compfunc, m_recall_limit, &list);
+          adopt_heap(match_node, list);
+        }
+      }
+    }
+  }
+}
+
+template <typename V>
+template <typename Compare>
+void radix_tree<V>::fuzzy_match(const std::string& key,
+                                int max_edits,
+                                std::vector<V>& vec,
+                                Compare compfunc,
+                                int recall_limit) const {
+  std::vector<const radix_tree_node<V>*> nodes;
+  fuzzy_nodes(key, max_edits, &nodes);
+  RADIX_COUNT(m_counters.lookup(!nodes.empty()));
+  // The top-k list of a union of subtrees is that of the union of their
+  // lists, so subtrees with a list are not walked.
+  radix_adapt_reader reader(adapt_readers());
+  radix_seen<V> item_set(m_value_domain);
+  for (const radix_tree_node<V>* node : nodes) {
+    const radix_values<V>* heap = node->heap();
+    if (list_serves(heap, compfunc, recall_limit)) {
+      RADIX_COUNT(m_counters.heap_hit());
+      for (const V& item : *heap) {
+        if (item_set.insert(item)) {
+          heap_insert(&vec, item, compfunc, recall_limit);
+        }
+      }
+      continue;
+    }
+    RADIX_COUNT(m_counters.scan(node->m_count));
+    const radix_tree_node<V>* temp = node->m_first;
+    while (temp != nullptr) {
+      temp->m_value.for_each([&](const V& item) {
+        if (item_set.insert(item)) {
+          heap_insert(&vec, item, compfunc, recall_limit);
+        }
+      });
+      if (temp == node->m_last) {
+        break;
+      }
+      temp = temp->m_last;
+    }
+  }
+  std::sort_heap(vec.begin(), vec.end(), compfunc);
+}
+
+// Whether "heap", the list of a node, answers a top-k query in the ordering
+// of "compfunc". The lists of finish() answer every query. Those of
+// finish_adaptive() appear as traffic makes them worth it, so they only
+// answer queries they answer rightly, lest a query's answer change with
+// traffic: those in its ordering, for no more values than it holds.
+template <typename V>
+template <typename Compare>
+bool radix_tree<V>::list_serves(const radix_values<V>* heap,
+                                const Compare& compfunc,
+                                int recall_limit) const {
+  if (heap == nullptr || heap->scores() != nullptr) {
+    return false;
+  }
+  return !m_adaptive || (recall_limit <= m_recall_limit &&
+                         radix_order_of(compfunc) == m_adapt_order);
+}
+
+template <typename V>
+template <typename Compare>
+void radix_tree<V>::match_batch(const std::vector<std::string>& keys,
+                                std::vector<std::vector<V>>& results,
+                                Compare compfunc,
+                                int recall_limit) const {
+  std::vector<size_t> order;
+  std::vector<const radix_tree_node<V>*> nodes;
+  find_batch(keys, &order, &nodes);
+  results.resize(keys.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    if (i + BATCH_PREFETCH < nodes.size() &&
+        nodes[i + BATCH_PREFETCH] != nullptr) {
+      const radix_tree_node<V>* next = nodes[i + BATCH_PREFETCH];
+      const radix_values<V>* heap = next->heap();
+      if (heap != nullptr) {
+        __builtin_prefetch(heap);
+      } else {
+        __builtin_prefetch(next->m_first);
+      }
+    }
+    std::vector<V>& vec = results[order[i]];
+    vec.clear();
+    collect_top(nodes[i], compfunc, recall_limit, &vec);
+  }
+}
+
+template <typename V>
+template <typename Compare>
+void radix_tree<V>::heap_insert(std::vector<V>* result,
+                                const V& item,
+                                const Compare& compfunc,
+                                int recall_limit) {
+  if (result == nullptr) {
+    return;
+  }
+  if (result->size() < recall_limit) {
+    result->push_back(item);
+    std::push_heap(result->begin(), result->end(), compfunc);
+  } else if (compfunc(item, result->at(0))) {
+    std::pop_heap(result->begin(), result->end(), compfunc);
+    result->pop_back();
+    result->push_back(item);
+    std::push_heap(result->begin(), result->end(), compfunc);
+  }
+}
+
+template <typename V>
+template <typename Compare>
+void radix_tree<V>::finish(Compare compfunc, int recall_limit) const {
+  if (m_adaptive) {
+    release_heaps();
+  }
+  m_compfunc = compfunc;
+  m_recall_limit = recall_limit;
+  m_score_lists = false;
+  m_cache.clear();
+  if (m_root->m_count < NODES_THRESHOLD)
+    return;
+
+  std::vector<radix_tree_node<V>*> process_nodes;
+  process_nodes.push_back(m_root);
+  int index = 0;
+
+  while (index < process_nodes.size()) {
+    radix_tree_node<V>* current = process_nodes[index];
+    for (typename radix_tree_node<V>::it_child iter =
+             current->m_children.begin();
+         iter != current->m_children.end(); ++iter) {
+      if ((*iter)->m_count > NODES_THRESHOLD) {
+        process_nodes.push_back(*iter);
+      }
+    }
+    ++index;
+  }
+
+  for (int index = process_nodes.size() - 1; index >= 0; --index) {
+    build_heap(process_nodes[index], compfunc, recall_limit);
+  }
+}
+
+template <typename V>
+template <typename Compare>
+void radix_tree<V>::finish(Compare compfunc,
+                           int recall_limit,
+                           int threads) const {
+  if (threads <= 1) {
+    finish(compfunc, recall_limit);
+    return;
+  }
+  if (m_adaptive) {
+    release_heaps();
+  }
+  m_compfunc = compfunc;
+  m_recall_limit = recall_limit;
+  m_score_lists = false;
+  m_cache.clear();
+  if (m_root->m_count < NODES_THRESHOLD)
+    return;
+
+  std::vector<radix_tree_node<V>*> process_nodes(1, m_root);
+  std::vector<int> parents(1, -1);
+  for (int index = 0; index < process_nodes.size(); ++index) {
+    radix_tree_node<V>* current = process_nodes[index];
+    for (typename radix_tree_node<V>::it_child iter =
+             current->m_children.begin();
+         iter != current->m_children.end(); ++iter) {
+      if ((*iter)->m_count > NODES_THRESHOLD) {
+        process_nodes.push_back(*iter);
+        parents.push_back(index);
+      }
+    }
+  }
+
+  // A node is ready once the lists of all its selected children are built;
+  // the last child to finish hands its parent to the pool.
+  std::unique_ptr<std::atomic<int>[]> pending(
+      new std::atomic<int>[process_nodes.size()]);
+  for (int index = 0; index < process_nodes.size(); ++index) {
+    pending[index].store(0, std::memory_order_relaxed);
+  }
+  for (int index = 1; index < process_nodes.size(); ++index) {
+    pending[parents[index]].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  radix_thread_pool pool(threads);
+  std::mutex heaps_mutex;
+  std::function<void(int)> process = [&](int index) {
+    std::vector<V> heap;
+    collect_heap(process_nodes[index], compfunc, recall_limit, &heap);
+    {
+      std::lock_guard<std::mutex> lock(heaps_mutex);
+      set_heap(process_nodes[index], heap);
+    }
+    int parent = parents[index];
+    if (parent >= 0 &&
+        pending[parent].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      pool.submit([&process, parent] { process(parent); });
+    }
+  };
+  for (int index = 0; index < process_nodes.size(); ++index) {
+    if (pending[index].load(std::memory_order_relaxed) == 0) {
+      pool.submit([&process, index] { process(index); });
+    }
+  }
+  pool.wait();
+}
+
+template <typename V>
+template <typename Compare>
+void radix_tree<V>::finish_adaptive(Compare compfunc,
+                                    int recall_limit,
+                                    size_t heap_bytes) const {
+  release_heaps();
+  m_compfunc = compfunc;
+  m_adapt_order = radix_order_of(compfunc);
+  m_recall_limit = recall_limit;
+  m_score_lists = false;
+  m_cache.clear();
+  size_t list_bytes =
+      sizeof(radix_values<V>) + std::max(recall_limit, 0) * sizeof(V);
+  m_adapt.reset(heap_bytes / list_bytes);
+  m_adaptive = true;
+}
+
+template <typename V>
+template <typename Compare>
+void radix_tree<V>::build_heap(radix_tree_node<V>* current,
+                               const Compare& compfunc,
+                               int recall_limit) const {
+  std::vector<V> heap;
+  collect_heap(current, compfunc, recall_limit, &heap);
+  set_heap(current, heap);
+}
+
+// Compute the top-k list of "current" from the lists of its children and the
+// leaves not covered by them.
+// REQUIRES: every child with more than NODES_THRESHOLD leaves has its list.
+template <typename V>
+template <typename Compare>
+void radix_tree<V>::collect_heap(const radix_tree_node<V>* current,
+                                 const Compare& compfunc,
+                                 int recall_limit,
+                                 std::vector<V>* result) const {
+  std::vector<V>& heap = *result;
+  radix_adapt_reader reader(adapt_readers());
+  radix_seen<V> item_set(m_value_domain);
+  std::vector<std::pair<radix_tree_node<V>*, radix_tree_node<V>*>> heap_range;
+  if (!current->m_children.empty()) {
+    heap_range.reserve(current->m_children.size());
+  }
+
+  for (typename radix_tree_node<V>::it_child iter =
+           current->m_children.begin();
+       iter != current->m_children.end(); ++iter) {
+    const radix_values<V>* child_heap = (*iter)->heap();
+    if (child_heap != nullptr) {
+      for (const V& item : *child_heap) {
+        if (item_set.insert(item)) {
+          heap_insert(&heap, item, compfunc, recall_limit);
+        }
+      }
+      heap_range.emplace_back((*iter)->m_first, (*iter)->m_last);
+    }
+  }
+
+  int range_index = 0;
+  const radix_tree_node<V>* temp = current->m_first;
+  while (temp != nullptr) {
+    if (range_index < heap_range.size() &&
+        temp == heap_range[range_index].first) {
+      temp = heap_range[range_index].second;
+      ++range_index;
+    } else {
+      temp->m_value.for_each([&](const V& p) {
+        if (item_set.insert(p)) {
+          heap_insert(&heap, p, compfunc, recall_limit);
+        }
+      });
+    }
+    if (temp == current->m_last) {
+      break;
+    }
+    temp = temp->m_last;
+  }
+
+  std::sort_heap(heap.begin(), heap.end(), compfunc);
+}
+
 extern template class radix_tree<int>;
+extern template class radix_tree_loader<int>;
 
 }  // namespace radix
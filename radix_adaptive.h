@@ -0,0 +1,202 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "radix_stats.h"
+
+namespace radix {
+
+// Decides which nodes of a radix_tree in adaptive mode have a top-k list, up
+// to a number of lists. A node earns a list by the leaves its top-k queries
+// scan for lack of one, so a wide prefix earns it on its first query and a
+// narrow one after many. Counts are halved once too many nodes are tracked,
+// and dropped if that is not enough, so old traffic fades.
+//
+// Lists are evicted by CLOCK, as in radix_result_cache: a hit marks a list,
+// and the hand spares a marked list once, clearing the mark.
+//
+// Not safe for concurrent use; the tree serializes the calls.
+class radix_heap_policy {
+ public:
+  radix_heap_policy() = default;
+
+  // Forget every node and allow up to "max_lists" lists.
+  void reset(size_t max_lists) {
+    clear();
+    m_max_lists = max_lists;
+    m_builds = 0;
+    m_evictions = 0;
+  }
+
+  // Forget every node, keeping the budget.
+  void clear() {
+    m_heat.clear();
+    m_slots.clear();
+    m_ring.clear();
+    m_free.clear();
+    m_hand = 0;
+  }
+
+  size_t lists() const { return m_slots.size(); }
+  size_t max_lists() const { return m_max_lists; }
+
+  // Count a top-k query that scanned "leaves" leaves below "node" without a
+  // list. Returns true once those add up to "heat".
+  bool scanned(const void* node, size_t leaves, size_t heat) {
+    if (m_max_lists == 0) {
+      return false;
+    }
+    if (m_heat.size() >= kMaxTracked) {
+      age();
+    }
+    size_t& count = m_heat[node];
+    count += leaves;
+    return count >= heat;
+  }
+
+  // Give "node" a list, adding to "*evicted" the nodes whose lists must go to
+  // make room for it.
+  void admit(const void* node, std::vector<const void*>* evicted) {
+    m_heat.erase(node);
+    while (m_slots.size() >= m_max_lists) {
+      if (m_hand >= m_ring.size()) {
+        m_hand = 0;
+      }
+      entry& e = m_ring[m_hand];
+      if (e.node != nullptr) {
+        if (e.referenced) {
+          e.referenced = false;
+        } else {
+          evicted->push_back(e.node);
+          drop(m_hand);
+          ++m_evictions;
+        }
+      }
+      ++m_hand;
+    }
+    size_t slot;
+    if (!m_free.empty()) {
+      slot = m_free.back();
+      m_free.pop_back();
+    } else {
+      slot = m_ring.size();
+      m_ring.emplace_back();
+    }
+    m_ring[slot].node = node;
+    m_ring[slot].referenced = false;
+    m_slots[node] = slot;
+    ++m_builds;
+  }
+
+  void hit(const void* node) {
+    std::unordered_map<const void*, size_t>::const_iterator found =
+        m_slots.find(node);
+    if (found != m_slots.end()) {
+      m_ring[found->second].referenced = true;
+    }
+  }
+
+  // "node" is gone, with its list if it had one.
+  void forget(const void* node) {
+    m_heat.erase(node);
+    std::unordered_map<const void*, size_t>::const_iterator found =
+        m_slots.find(node);
+    if (found != m_slots.end()) {
+      drop(found->second);
+    }
+  }
+
+  // The list of "from" now belongs to "to".
+  void move(const void* from, const void* to) {
+    std::unordered_map<const void*, size_t>::iterator found =
+        m_slots.find(from);
+    if (found == m_slots.end()) {
+      return;
+    }
+    size_t slot = found->second;
+    m_slots.erase(found);
+    m_ring[slot].node = to;
+    m_slots[to] = slot;
+  }
+
+  radix_adaptive_stats stats() const {
+    radix_adaptive_stats stats;
+    stats.builds = m_builds;
+    stats.evictions = m_evictions;
+    stats.lists = m_slots.size();
+    stats.max_lists = m_max_lists;
+    stats.tracked = m_heat.size();
+    return stats;
+  }
+
+ private:
+  static const size_t kMaxTracked = 1 << 16;
+
+  struct entry {
+    const void* node = nullptr;  // null for a free slot
+    bool referenced = false;
+  };
+
+  void drop(size_t slot) {
+    m_slots.erase(m_ring[slot].node);
+    m_ring[slot].node = nullptr;
+    m_free.push_back(slot);
+  }
+
+  void age() {
+    for (std::unordered_map<const void*, size_t>::iterator it =
+             m_heat.begin();
+         it != m_heat.end();) {
+      it->second /= 2;
+      if (it->second == 0) {
+        it = m_heat.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    if (m_heat.size() >= kMaxTracked / 2) {
+      m_heat.clear();
+    }
+  }
+
+  radix_heap_policy(const radix_heap_policy&);             // delete
+  radix_heap_policy& operator=(const radix_heap_policy&);  // delete
+
+  std::unordered_map<const void*, size_t> m_heat;
+  std::unordered_map<const void*, size_t> m_slots;
+  std::vector<entry> m_ring;
+  std::vector<size_t> m_free;
+  size_t m_hand = 0;
+  size_t m_max_lists = 0;
+  uint64_t m_builds = 0;
+  uint64_t m_evictions = 0;
+};
+
+// Counts a query in "*readers" while it may read the lists of a tree in
+// adaptive mode, so that lists withdrawn from nodes are freed only once no
+// query can still be reading them. Counts nothing if "readers" is null.
+class radix_adapt_reader {
+ public:
+  explicit radix_adapt_reader(std::atomic<int>* readers) : m_readers(readers) {
+    if (m_readers != nullptr) {
+      m_readers->fetch_add(1);
+    }
+  }
+  ~radix_adapt_reader() {
+    if (m_readers != nullptr) {
+      m_readers->fetch_sub(1);
+    }
+  }
+
+ private:
+  radix_adapt_reader(const radix_adapt_reader&);             // delete
+  radix_adapt_reader& operator=(const radix_adapt_reader&);  // delete
+
+  std::atomic<int>* m_readers;
+};
+
+}  // namespace radix
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+
+namespace radix {
+
+// Source of the chunks a radix_arena carves its allocations from. Plug in a
+// custom implementation to place a tree in huge pages, shared memory, etc.
+class radix_chunk_allocator {
+ public:
+  virtual ~radix_chunk_allocator() {}
+
+  virtual void* allocate(size_t size) = 0;
+  virtual void deallocate(void* chunk, size_t size) = 0;
+
+  // The process-wide allocator backed by operator new.
+  static radix_chunk_allocator* default_allocator();
+};
+
+class radix_new_allocator : public radix_chunk_allocator {
+ public:
+  void* allocate(size_t size) override { return ::operator new(size); }
+  void deallocate(void* chunk, size_t) override { ::operator delete(chunk); }
+};
+
+inline radix_chunk_allocator* radix_chunk_allocator::default_allocator() {
+  static radix_new_allocator allocator;
+  return &allocator;
+}
+
+// Bump allocator over a list of chunks. Blocks handed back with deallocate()
+// go to per-size free lists and are reused by later allocations of the same
+// size class; everything else is only returned by reset() or the destructor,
+// which cost O(chunks). Not thread-safe.
+class radix_arena {
+ public:
+  static const size_t kAlignment = 16;
+
+  explicit radix_arena(radix_chunk_allocator* chunks = nullptr)
+      : m_allocator(chunks != nullptr
+                        ? chunks
+                        : radix_chunk_allocator::default_allocator()) {
+    memset(m_free, 0, sizeof(m_free));
+  }
+  ~radix_arena() { reset(); }
+
+  // Return a block of at least "size" bytes aligned to kAlignment.
+  void* allocate(size_t size) {
+    int index = class_index(size);
+    if (index < 0) {
+      return allocate_large(size);
+    }
+    size_t rounded = class_size(index);
+    m_used += rounded;
+    if (m_free[index] != nullptr) {
+      void* block = m_free[index];
+      m_free[index] = *static_cast<void**>(block);
+      return block;
+    }
+    return bump(rounded, kAlignment);
+  }
+
+  // Give back a block obtained from allocate() with the same "size".
+  void deallocate(void* block, size_t size) {
+    if (block == nullptr) {
+      return;
+    }
+    int index = class_index(size);
+    if (index < 0) {
+      deallocate_large(block);
+      return;
+    }
+    m_used -= class_size(index);
+    *static_cast<void**>(block) = m_free[index];
+    m_free[index] = block;
+  }
+
+  // Copy "size" bytes into the arena. The copy lives until reset().
+  char* copy(const char* data, size_t size) {
+    m_used += size;
+    char* dest = static_cast<char*>(bump(size, 1));
+    if (size > 0) {
+      memcpy(dest, data, size);
+    }
+    return dest;
+  }
+
+  // Release every chunk at once.
+  void reset() {
+    while (m_chunks != nullptr) {
+      chunk* next = m_chunks->next;
+      m_allocator->deallocate(m_chunks, m_chunks->size);
+      m_chunks = next;
+    }
+    while (m_large != nullptr) {
+      chunk* next = m_large->next;
+      m_allocator->deallocate(m_large, m_large->size);
+      m_large = next;
+    }
+    memset(m_free, 0, sizeof(m_free));
+    m_ptr = nullptr;
+    m_end = nullptr;
+    m_next_chunk = kMinChunk;
+    m_used = 0;
+    m_reserved = 0;
+  }
+
+  // Bytes handed out and not given back.
+  size_t bytes_used() const { return m_used; }
+  // Bytes obtained from the chunk allocator.
+  size_t bytes_reserved() const { return m_reserved; }
+
+  void swap(radix_arena& other) {
+    std::swap(m_allocator, other.m_allocator);
+    std::swap(m_chunks, other.m_chunks);
+    std::swap(m_large, other.m_large);
+    std::swap(m_ptr, other.m_ptr);
+    std::swap(m_end, other.m_end);
+    std::swap(m_next_chunk, other.m_next_chunk);
+    std::swap(m_used, other.m_used);
+    std::swap(m_reserved, other.m_reserved);
+    for (int i = 0; i < kClasses; ++i) {
+      std::swap(m_free[i], other.m_free[i]);
+    }
+  }
+
+ private:
+  struct chunk {
+    chunk* next;
+    chunk* prev;
+    size_t size;
+    size_t pad;
+  };
+
+  // Sizes up to kSmallLimit are rounded to kAlignment, larger ones up to
+  // kLargeLimit to a power of two; beyond that a block gets its own chunk.
+  static const size_t kSmallLimit = 1024;
+  static const size_t kLargeLimit = 64 * 1024;
+  static const int kSmallClasses = kSmallLimit / kAlignment;
+  static const int kClasses = kSmallClasses + 6;
+  static const size_t kMinChunk = 4 * 1024;
+  static const size_t kMaxChunk = 1024 * 1024;
+
+  static int class_index(size_t size) {
+    if (size <= kSmallLimit) {
+      return size == 0 ? 0 : static_cast<int>((size - 1) / kAlignment);
+    }
+    if (size > kLargeLimit) {
+      return -1;
+    }
+    int index = kSmallClasses;
+    for (size_t limit = kSmallLimit * 2; limit < size; limit *= 2) {
+      ++index;
+    }
+    return index;
+  }
+
+  static size_t class_size(int index) {
+    if (index < kSmallClasses) {
+      return (index + 1) * kAlignment;
+    }
+    return kSmallLimit << (index - kSmallClasses + 1);
+  }
+
+  void* bump(size_t size, size_t align) {
+    uintptr_t p =
+        (reinterpret_cast<uintptr_t>(m_ptr) + align - 1) & ~(align - 1);
+    if (m_ptr == nullptr || p + size > reinterpret_cast<uintptr_t>(m_end)) {
+      size_t need = sizeof(chunk) + size + kAlignment;
+      size_t chunk_size = m_next_chunk;
+      while (chunk_size < need) {
+        chunk_size *= 2;
+      }
+      if (m_next_chunk < kMaxChunk) {
+        m_next_chunk *= 2;
+      }
+      chunk* c = static_cast<chunk*>(m_allocator->allocate(chunk_size));
+      c->next = m_chunks;
+      c->prev = nullptr;
+      c->size = chunk_size;
+      m_chunks = c;
+      m_reserved += chunk_size;
+      m_ptr = reinterpret_cast<char*>(c + 1);
+      m_end = reinterpret_cast<char*>(c) + chunk_size;
+      p = (reinterpret_cast<uintptr_t>(m_ptr) + align - 1) & ~(align - 1);
+    }
+    m_ptr = reinterpret_cast<char*>(p + size);
+    return reinterpret_cast<void*>(p);
+  }
+
+  void* allocate_large(size_t size) {
+    size_t chunk_size = sizeof(chunk) + size;
+    chunk* c = static_cast<chunk*>(m_allocator->allocate(chunk_size));
+    c->next = m_large;
+    c->prev = nullptr;
+    c->size = chunk_size;
+    if (m_large != nullptr) {
+      m_large->prev = c;
+    }
+    m_large = c;
+    m_used += size;
+    m_reserved += chunk_size;
+    return c + 1;
+  }
+
+  void deallocate_large(void* block) {
+    chunk* c = static_cast<chunk*>(block) - 1;
+    if (c->prev != nullptr) {
+      c->prev->next = c->next;
+    } else {
+      m_large = c->next;
+    }
+    if (c->next != nullptr) {
+      c->next->prev = c->prev;
+    }
+    m_used -= c->size - sizeof(chunk);
+    m_reserved -= c->size;
+    m_allocator->deallocate(c, c->size);
+  }
+
+  radix_arena(const radix_arena&);             // delete
+  radix_arena& operator=(const radix_arena&);  // delete
+
+  radix_chunk_allocator* m_allocator;
+  chunk* m_chunks = nullptr;
+  chunk* m_large = nullptr;
+  char* m_ptr = nullptr;
+  char* m_end = nullptr;
+  size_t m_next_chunk = kMinChunk;
+  size_t m_used = 0;
+  size_t m_reserved = 0;
+  void* m_free[kClasses];
+};
+
+}  // namespace radix
@@ -0,0 +1,307 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#include "radix_stats.h"
+
+namespace radix {
+
+// The identity of an ordering, which tells top-k lists of different
+// orderings apart: the type of a stateless comparator, the type and address
+// of a function, or a number the caller gives with radix_order_named().
+// Comparators with the same identity must order alike. Others, such as
+// functors with state and lambdas with captures, have no identity, and their
+// lists are not kept across queries.
+struct radix_order_id {
+  const std::type_info* type = nullptr;
+  uintptr_t value = 0;
+
+  bool known() const { return type != nullptr; }
+  bool operator==(const radix_order_id& other) const {
+    return known() && other.known() && *type == *other.type &&
+           value == other.value;
+  }
+  bool operator!=(const radix_order_id& other) const {
+    return !(*this == other);
+  }
+};
+
+// A comparator with an ordering the caller names by "id". Every comparator
+// named with one id must order alike.
+template <typename Compare>
+struct radix_named_order {
+  Compare compfunc;
+  uint64_t id;
+
+  template <typename T>
+  bool operator()(const T& a, const T& b) const {
+    return compfunc(a, b);
+  }
+};
+
+template <typename Compare>
+radix_named_order<Compare> radix_order_named(Compare compfunc, uint64_t id) {
+  return radix_named_order<Compare>{compfunc, id};
+}
+
+template <typename Compare>
+radix_order_id radix_order_of(const Compare& compfunc) {
+  radix_order_id order;
+  if constexpr (std::is_pointer<Compare>::value &&
+                std::is_function<
+                    typename std::remove_pointer<Compare>::type>::value) {
+    order.type = &typeid(Compare);
+    order.value = reinterpret_cast<uintptr_t>(compfunc);
+  } else if constexpr (std::is_empty<Compare>::value) {
+    order.type = &typeid(Compare);
+  }
+  return order;
+}
+
+template <typename Compare>
+radix_order_id radix_order_of(const radix_named_order<Compare>& compfunc) {
+  // Named orders share a type of their own.
+  radix_order_id order;
+  order.type = &typeid(radix_order_id);
+  order.value = compfunc.id;
+  return order;
+}
+
+// A std::function is known by the function it holds, if any.
+template <typename V>
+radix_order_id radix_order_of(const std::function<bool(V, V)>& compfunc) {
+  typedef bool (*by_value)(V, V);
+  typedef bool (*by_reference)(const V&, const V&);
+  if (const by_value* target = compfunc.template target<by_value>()) {
+    return radix_order_of(*target);
+  }
+  if (const by_reference* target = compfunc.template target<by_reference>()) {
+    return radix_order_of(*target);
+  }
+  return radix_order_id();
+}
+
+// Bounded cache of top-k lists by the node they were computed for, safe to
+// use from concurrent readers. A list built with a recall limit answers every
+// smaller limit by its prefix, so a node has at most one list, the one with
+// the largest limit seen. Lists are kept with the identity of their ordering,
+// and only answer queries with the same one.
+//
+// The cache is split into shards by node, each with its own lock and byte
+// budget. Within a shard, lists are evicted by CLOCK: a hit marks a list, and
+// the hand spares a marked list once, clearing the mark, so lists that are
+// never hit again go first.
+template <typename V>
+class radix_result_cache {
+ public:
+  radix_result_cache() = default;
+
+  // Drop every list and keep up to "bytes" bytes of lists from now on; 0
+  // turns the cache off.
+  void set_capacity(size_t bytes) {
+    for (shard& s : m_shards) {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      drop_all(&s);
+      s.capacity = bytes / kShards;
+    }
+    m_capacity.store(bytes, std::memory_order_relaxed);
+  }
+
+  bool enabled() const {
+    return m_capacity.load(std::memory_order_relaxed) != 0;
+  }
+
+  // Append the first "recall_limit" values of the list of "node" for the
+  // ordering "order" to "*result". Returns false if there is no list that
+  // long.
+  bool lookup(const void* node,
+              const radix_order_id& order,
+              int recall_limit,
+              std::vector<V>* result) {
+    shard& s = shard_of(node);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    typename std::unordered_map<const void*, size_t>::const_iterator found =
+        s.index.find(node);
+    if (found == s.index.end() ||
+        !covers(s.entries[found->second], order, recall_limit)) {
+      ++s.misses;
+      return false;
+    }
+    entry& e = s.entries[found->second];
+    e.referenced = true;
+    ++s.hits;
+    size_t size = std::min<size_t>(recall_limit, e.list.size());
+    result->insert(result->end(), e.list.begin(), e.list.begin() + size);
+    return true;
+  }
+
+  // Keep "list", the top-k list of "node" for the ordering "order" and
+  // "recall_limit", in place of a list for another ordering.
+  void store(const void* node,
+             const radix_order_id& order,
+             int recall_limit,
+             const std::vector<V>& list) {
+    shard& s = shard_of(node);
+    size_t bytes = entry_bytes(list.size());
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (bytes > s.capacity) {
+      return;
+    }
+    typename std::unordered_map<const void*, size_t>::iterator found =
+        s.index.find(node);
+    if (found != s.index.end()) {
+      if (covers(s.entries[found->second], order, recall_limit)) {
+        return;
+      }
+      drop(&s, found->second);
+    }
+    while (s.bytes + bytes > s.capacity) {
+      if (s.hand >= s.entries.size()) {
+        s.hand = 0;
+      }
+      entry& e = s.entries[s.hand];
+      if (e.node != nullptr) {
+        if (e.referenced) {
+          e.referenced = false;
+        } else {
+          drop(&s, s.hand);
+          ++s.evictions;
+        }
+      }
+      ++s.hand;
+    }
+
+    size_t slot;
+    if (!s.free.empty()) {
+      slot = s.free.back();
+      s.free.pop_back();
+    } else {
+      slot = s.entries.size();
+      s.entries.emplace_back();
+    }
+    entry& e = s.entries[slot];
+    e.node = node;
+    e.order = order;
+    e.recall_limit = recall_limit;
+    e.referenced = false;
+    e.list = list;
+    s.index[node] = slot;
+    s.bytes += bytes;
+  }
+
+  // Drop the list of "node", whose leaves changed.
+  void invalidate(const void* node) {
+    if (!enabled()) {
+      return;
+    }
+    shard& s = shard_of(node);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    typename std::unordered_map<const void*, size_t>::iterator found =
+        s.index.find(node);
+    if (found != s.index.end()) {
+      drop(&s, found->second);
+      ++s.invalidations;
+    }
+  }
+
+  void clear() {
+    for (shard& s : m_shards) {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      drop_all(&s);
+    }
+  }
+
+  radix_cache_stats stats() const {
+    radix_cache_stats stats;
+    for (const shard& s : m_shards) {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      stats.hits += s.hits;
+      stats.misses += s.misses;
+      stats.evictions += s.evictions;
+      stats.invalidations += s.invalidations;
+      stats.entries += s.index.size();
+      stats.bytes += s.bytes;
+    }
+    stats.capacity = m_capacity.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+ private:
+  static const int kShards = 16;
+
+  struct entry {
+    const void* node = nullptr;  // null for a free slot
+    radix_order_id order;
+    int recall_limit = 0;
+    bool referenced = false;
+    std::vector<V> list;
+  };
+
+  struct alignas(64) shard {
+    mutable std::mutex mutex;
+    std::unordered_map<const void*, size_t> index;
+    // The clock. Slots of dropped lists are reused in place.
+    std::vector<entry> entries;
+    std::vector<size_t> free;
+    size_t hand = 0;
+    size_t bytes = 0;
+    size_t capacity = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t invalidations = 0;
+  };
+
+  // A list shorter than its recall limit holds every distinct value, so it
+  // answers any limit.
+  static bool covers(const entry& e,
+                     const radix_order_id& order,
+                     int recall_limit) {
+    return e.order == order &&
+           (e.recall_limit >= recall_limit ||
+            e.list.size() < static_cast<size_t>(e.recall_limit));
+  }
+
+  static size_t entry_bytes(size_t values) {
+    return sizeof(entry) + values * sizeof(V);
+  }
+
+  shard& shard_of(const void* node) {
+    // Nodes are 64 bytes apart within an arena chunk.
+    return m_shards[(reinterpret_cast<uintptr_t>(node) >> 6) % kShards];
+  }
+
+  static void drop(shard* s, size_t slot) {
+    entry& e = s->entries[slot];
+    s->bytes -= entry_bytes(e.list.size());
+    s->index.erase(e.node);
+    e.node = nullptr;
+    std::vector<V>().swap(e.list);
+    s->free.push_back(slot);
+  }
+
+  static void drop_all(shard* s) {
+    s->index.clear();
+    s->entries.clear();
+    s->free.clear();
+    s->hand = 0;
+    s->bytes = 0;
+  }
+
+  radix_result_cache(const radix_result_cache&);             // delete
+  radix_result_cache& operator=(const radix_result_cache&);  // delete
+
+  std::atomic<size_t> m_capacity{0};
+  shard m_shards[kShards];
+};
+
+}  // namespace radix
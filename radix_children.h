@@ -0,0 +1,506 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "radix_arena.h"
+#include "slice.h"
+
+namespace radix {
+
+// Pack the bytes of one UTF-8 code point big-endian into an integer, so that
+// integer order matches Slice order. UTF8Decode never yields more than seven
+// bytes per code point and never a leading zero byte, so 0 is free to mark
+// unused slots.
+inline uint64_t radix_child_key(const char* data, size_t size) {
+  uint64_t key = 0;
+  for (size_t i = 0; i < size && i < 8; ++i) {
+    key |= static_cast<uint64_t>(static_cast<unsigned char>(data[i]))
+           << (56 - 8 * i);
+  }
+  return key;
+}
+
+inline uint64_t radix_child_key(const Slice& uchar) {
+  return radix_child_key(uchar.data(), uchar.size());
+}
+
+// Return the index of "key" in keys[0, n), or -1 if absent.
+// REQUIRES: keys has room for n rounded up to 4 entries, and the slots past n
+// hold 0.
+inline int radix_find_key(const uint64_t* keys, int n, uint64_t key) {
+#if defined(__AVX2__)
+  const __m256i needle = _mm256_set1_epi64x(static_cast<long long>(key));
+  for (int i = 0; i < n; i += 4) {
+    __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + i));
+    int mask = _mm256_movemask_pd(
+        _mm256_castsi256_pd(_mm256_cmpeq_epi64(block, needle)));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return -1;
+#elif defined(__SSE2__)
+  const __m128i needle = _mm_set1_epi64x(static_cast<long long>(key));
+  for (int i = 0; i < n; i += 2) {
+    __m128i eq = _mm_cmpeq_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + i)), needle);
+    // Both 32-bit halves must match for a 64-bit lane to match.
+    eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+    int mask = _mm_movemask_pd(_mm_castsi128_pd(eq));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return -1;
+#else
+  for (int i = 0; i < n; ++i) {
+    if (keys[i] == key) {
+      return i;
+    }
+  }
+  return -1;
+#endif
+}
+
+// Child table of an inner radix_tree_node, keyed by the first code point of
+// each child's key. It adapts its layout to the fan-out:
+//   - up to 4 children:  sorted arrays searched with SIMD,
+//   - up to 16 children: the same, in a larger block,
+//   - wide:              a direct-indexed table for ASCII code points plus
+//                        sorted arrays for multi-byte code points.
+// Iteration is always in key order. The table does not own the children, and
+// its blocks come from the arena passed to the mutating calls.
+template <typename N>
+class radix_children {
+  enum Kind : uint8_t { kEmpty, kSmall4, kSmall16, kWide };
+
+  template <int Capacity>
+  struct small_block {
+    uint64_t keys[Capacity];
+    N* children[Capacity];
+  };
+  typedef small_block<4> block4;
+  typedef small_block<16> block16;
+
+  struct wide_block {
+    N* ascii[128];
+    uint32_t size;
+    uint32_t capacity;
+    uint64_t* keys;
+    N** children;
+  };
+
+  static const uint32_t kShrinkWide = 12;
+  static const uint32_t kShrinkSmall16 = 3;
+  static const uint64_t kAsciiLimit = static_cast<uint64_t>(0x80) << 56;
+
+ public:
+  class iterator {
+   public:
+    iterator() = default;
+
+    uint64_t key() const { return m_owner->key_at(m_pos); }
+    N* operator*() const { return m_owner->child_at(m_pos); }
+
+    iterator& operator++() {
+      m_pos = m_owner->next_pos(m_pos + 1);
+      return *this;
+    }
+    bool operator==(const iterator& other) const {
+      return m_pos == other.m_pos;
+    }
+    bool operator!=(const iterator& other) const {
+      return m_pos != other.m_pos;
+    }
+
+   private:
+    friend class radix_children;
+    iterator(const radix_children* owner, uint32_t pos)
+        : m_owner(owner), m_pos(pos) {}
+
+    const radix_children* m_owner = nullptr;
+    uint32_t m_pos = 0;
+  };
+
+  radix_children() = default;
+
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+
+  iterator begin() const { return iterator(this, next_pos(0)); }
+  iterator end() const { return iterator(this, end_pos()); }
+
+  N* find(uint64_t key) const {
+    switch (m_kind) {
+      case kSmall4: {
+        const block4* b = static_cast<const block4*>(m_block);
+        int i = radix_find_key(b->keys, m_size, key);
+        return i < 0 ? nullptr : b->children[i];
+      }
+      case kSmall16: {
+        const block16* b = static_cast<const block16*>(m_block);
+        int i = radix_find_key(b->keys, m_size, key);
+        return i < 0 ? nullptr : b->children[i];
+      }
+      case kWide: {
+        const wide_block* b = static_cast<const wide_block*>(m_block);
+        if (key < kAsciiLimit) {
+          return b->ascii[key >> 56];
+        }
+        const uint64_t* keys = b->keys;
+        const uint64_t* end = keys + b->size;
+        const uint64_t* it = std::lower_bound(keys, end, key);
+        return (it != end && *it == key) ? b->children[it - keys] : nullptr;
+      }
+      default:
+        return nullptr;
+    }
+  }
+
+  // First entry whose key is not less than "key", or greater than it.
+  iterator lower_bound(uint64_t key) const {
+    return iterator(this, bound_pos(key, false));
+  }
+  iterator upper_bound(uint64_t key) const {
+    return iterator(this, bound_pos(key, true));
+  }
+
+  // Map "key" to "child", replacing any existing mapping.
+  void insert(uint64_t key, N* child, radix_arena& arena) {
+    switch (m_kind) {
+      case kEmpty:
+        m_block = create<block4>(arena);
+        m_kind = kSmall4;
+        small_insert(static_cast<block4*>(m_block), key, child);
+        return;
+      case kSmall4: {
+        block4* b = static_cast<block4*>(m_block);
+        if (m_size < 4 || radix_find_key(b->keys, m_size, key) >= 0) {
+          small_insert(b, key, child);
+          return;
+        }
+        block16* grown = create<block16>(arena);
+        memcpy(grown->keys, b->keys, sizeof(b->keys));
+        memcpy(grown->children, b->children, sizeof(b->children));
+        destroy(arena, b);
+        m_block = grown;
+        m_kind = kSmall16;
+        small_insert(grown, key, child);
+        return;
+      }
+      case kSmall16: {
+        block16* b = static_cast<block16*>(m_block);
+        if (m_size < 16 || radix_find_key(b->keys, m_size, key) >= 0) {
+          small_insert(b, key, child);
+          return;
+        }
+        wide_block* grown = create<wide_block>(arena);
+        m_block = grown;
+        m_kind = kWide;
+        uint32_t count = m_size;
+        m_size = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+          wide_insert(grown, b->keys[i], b->children[i], arena);
+        }
+        destroy(arena, b);
+        wide_insert(grown, key, child, arena);
+        return;
+      }
+      case kWide:
+        wide_insert(static_cast<wide_block*>(m_block), key, child, arena);
+        return;
+    }
+  }
+
+  // Remove the mapping for "key". Returns false if there was none.
+  bool erase(uint64_t key, radix_arena& arena) {
+    switch (m_kind) {
+      case kSmall4:
+        if (!small_erase(static_cast<block4*>(m_block), key)) {
+          return false;
+        }
+        if (m_size == 0) {
+          clear(arena);
+        }
+        return true;
+      case kSmall16: {
+        block16* b = static_cast<block16*>(m_block);
+        if (!small_erase(b, key)) {
+          return false;
+        }
+        if (m_size <= kShrinkSmall16) {
+          block4* shrunk = create<block4>(arena);
+          memcpy(shrunk->keys, b->keys, m_size * sizeof(uint64_t));
+          memcpy(shrunk->children, b->children, m_size * sizeof(N*));
+          destroy(arena, b);
+          m_block = shrunk;
+          m_kind = kSmall4;
+        }
+        return true;
+      }
+      case kWide: {
+        wide_block* b = static_cast<wide_block*>(m_block);
+        if (!wide_erase(b, key)) {
+          return false;
+        }
+        if (m_size <= kShrinkWide) {
+          block16* shrunk = create<block16>(arena);
+          uint32_t count = 0;
+          for (iterator it = begin(); it != end(); ++it, ++count) {
+            shrunk->keys[count] = it.key();
+            shrunk->children[count] = *it;
+          }
+          destroy_wide(arena, b);
+          m_block = shrunk;
+          m_kind = kSmall16;
+        }
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+  // Drop every mapping. The children themselves are left alone.
+  void clear(radix_arena& arena) {
+    switch (m_kind) {
+      case kSmall4:
+        destroy(arena, static_cast<block4*>(m_block));
+        break;
+      case kSmall16:
+        destroy(arena, static_cast<block16*>(m_block));
+        break;
+      case kWide:
+        destroy_wide(arena, static_cast<wide_block*>(m_block));
+        break;
+      default:
+        break;
+    }
+    m_block = nullptr;
+    m_size = 0;
+    m_kind = kEmpty;
+  }
+
+  void swap(radix_children& other) {
+    std::swap(m_block, other.m_block);
+    std::swap(m_size, other.m_size);
+    std::swap(m_kind, other.m_kind);
+  }
+
+ private:
+  radix_children(const radix_children&);             // delete
+  radix_children& operator=(const radix_children&);  // delete
+
+  template <typename T>
+  static T* create(radix_arena& arena) {
+    return new (arena.allocate(sizeof(T))) T();
+  }
+
+  template <typename T>
+  static void destroy(radix_arena& arena, T* block) {
+    arena.deallocate(block, sizeof(T));
+  }
+
+  static void destroy_wide(radix_arena& arena, wide_block* b) {
+    arena.deallocate(b->keys, b->capacity * sizeof(uint64_t));
+    arena.deallocate(b->children, b->capacity * sizeof(N*));
+    destroy(arena, b);
+  }
+
+  template <typename Block>
+  void small_insert(Block* b, uint64_t key, N* child) {
+    uint32_t pos = 0;
+    while (pos < m_size && b->keys[pos] < key) {
+      ++pos;
+    }
+    if (pos < m_size && b->keys[pos] == key) {
+      b->children[pos] = child;
+      return;
+    }
+    memmove(b->keys + pos + 1, b->keys + pos,
+            (m_size - pos) * sizeof(uint64_t));
+    memmove(b->children + pos + 1, b->children + pos,
+            (m_size - pos) * sizeof(N*));
+    b->keys[pos] = key;
+    b->children[pos] = child;
+    ++m_size;
+  }
+
+  template <typename Block>
+  bool small_erase(Block* b, uint64_t key) {
+    int pos = radix_find_key(b->keys, m_size, key);
+    if (pos < 0) {
+      return false;
+    }
+    --m_size;
+    memmove(b->keys + pos, b->keys + pos + 1,
+            (m_size - pos) * sizeof(uint64_t));
+    memmove(b->children + pos, b->children + pos + 1,
+            (m_size - pos) * sizeof(N*));
+    b->keys[m_size] = 0;
+    b->children[m_size] = nullptr;
+    return true;
+  }
+
+  void wide_insert(wide_block* b, uint64_t key, N* child, radix_arena& arena) {
+    if (key < kAsciiLimit) {
+      if (b->ascii[key >> 56] == nullptr) {
+        ++m_size;
+      }
+      b->ascii[key >> 56] = child;
+      return;
+    }
+    uint64_t* end = b->keys + b->size;
+    uint64_t* it = std::lower_bound(b->keys, end, key);
+    uint32_t pos = it - b->keys;
+    if (it != end && *it == key) {
+      b->children[pos] = child;
+      return;
+    }
+    if (b->size == b->capacity) {
+      uint32_t capacity = b->capacity == 0 ? 16 : b->capacity * 2;
+      uint64_t* keys =
+          static_cast<uint64_t*>(arena.allocate(capacity * sizeof(uint64_t)));
+      N** children = static_cast<N**>(arena.allocate(capacity * sizeof(N*)));
+      if (b->size > 0) {
+        memcpy(keys, b->keys, b->size * sizeof(uint64_t));
+        memcpy(children, b->children, b->size * sizeof(N*));
+      }
+      arena.deallocate(b->keys, b->capacity * sizeof(uint64_t));
+      arena.deallocate(b->children, b->capacity * sizeof(N*));
+      b->keys = keys;
+      b->children = children;
+      b->capacity = capacity;
+    }
+    memmove(b->keys + pos + 1, b->keys + pos,
+            (b->size - pos) * sizeof(uint64_t));
+    memmove(b->children + pos + 1, b->children + pos,
+            (b->size - pos) * sizeof(N*));
+    b->keys[pos] = key;
+    b->children[pos] = child;
+    ++b->size;
+    ++m_size;
+  }
+
+  bool wide_erase(wide_block* b, uint64_t key) {
+    if (key < kAsciiLimit) {
+      if (b->ascii[key >> 56] == nullptr) {
+        return false;
+      }
+      b->ascii[key >> 56] = nullptr;
+      --m_size;
+      return true;
+    }
+    uint64_t* end = b->keys + b->size;
+    uint64_t* it = std::lower_bound(b->keys, end, key);
+    if (it == end || *it != key) {
+      return false;
+    }
+    uint32_t pos = it - b->keys;
+    --b->size;
+    memmove(b->keys + pos, b->keys + pos + 1,
+            (b->size - pos) * sizeof(uint64_t));
+    memmove(b->children + pos, b->children + pos + 1,
+            (b->size - pos) * sizeof(N*));
+    --m_size;
+    return true;
+  }
+
+  uint32_t bound_pos(uint64_t key, bool upper) const {
+    switch (m_kind) {
+      case kSmall4:
+      case kSmall16: {
+        const uint64_t* keys = m_kind == kSmall4
+                                   ? static_cast<const block4*>(m_block)->keys
+                                   : static_cast<const block16*>(m_block)->keys;
+        uint32_t pos = 0;
+        while (pos < m_size &&
+               (keys[pos] < key || (upper && keys[pos] == key))) {
+          ++pos;
+        }
+        return pos;
+      }
+      case kWide: {
+        const wide_block* b = static_cast<const wide_block*>(m_block);
+        if (key < kAsciiLimit) {
+          return next_pos((key >> 56) + (upper ? 1 : 0));
+        }
+        const uint64_t* keys = b->keys;
+        const uint64_t* end = keys + b->size;
+        const uint64_t* it = upper ? std::upper_bound(keys, end, key)
+                                   : std::lower_bound(keys, end, key);
+        return 128 + (it - keys);
+      }
+      default:
+        return 0;
+    }
+  }
+
+  // Positions enumerate the slots of the current layout in key order: small
+  // blocks use [0, m_size); the wide layout uses [0, 128) for the ASCII table
+  // followed by 128 + i for the i-th multi-byte entry.
+  uint32_t end_pos() const {
+    if (m_kind == kWide) {
+      return 128 + static_cast<const wide_block*>(m_block)->size;
+    }
+    return m_size;
+  }
+
+  uint32_t next_pos(uint32_t pos) const {
+    if (m_kind == kWide) {
+      const wide_block* b = static_cast<const wide_block*>(m_block);
+      while (pos < 128 && b->ascii[pos] == nullptr) {
+        ++pos;
+      }
+    }
+    return pos;
+  }
+
+  uint64_t key_at(uint32_t pos) const {
+    switch (m_kind) {
+      case kSmall4:
+        return static_cast<const block4*>(m_block)->keys[pos];
+      case kSmall16:
+        return static_cast<const block16*>(m_block)->keys[pos];
+      case kWide:
+        if (pos < 128) {
+          return static_cast<uint64_t>(pos) << 56;
+        }
+        return static_cast<const wide_block*>(m_block)->keys[pos - 128];
+      default:
+        return 0;
+    }
+  }
+
+  N* child_at(uint32_t pos) const {
+    switch (m_kind) {
+      case kSmall4:
+        return static_cast<const block4*>(m_block)->children[pos];
+      case kSmall16:
+        return static_cast<const block16*>(m_block)->children[pos];
+      case kWide: {
+        const wide_block* b = static_cast<const wide_block*>(m_block);
+        return pos < 128 ? b->ascii[pos] : b->children[pos - 128];
+      }
+      default:
+        return nullptr;
+    }
+  }
+
+  void* m_block = nullptr;
+  uint32_t m_size = 0;
+  Kind m_kind = kEmpty;
+};
+
+}  // namespace radix
@@ -0,0 +1,105 @@
+#include "radix_concurrent.h"
+
+#include <functional>
+#include <thread>
+
+namespace radix {
+
+template <typename V>
+radix_concurrent_tree<V>::radix_concurrent_tree(radix_chunk_allocator* chunks)
+    : m_left(chunks), m_right(chunks), m_side(0), m_version(0) {}
+
+template <typename V>
+void radix_concurrent_tree<V>::insert(const std::string& pattern, V value) {
+  write([&](radix_tree<V>& tree) { tree.insert(pattern, value); });
+}
+
+template <typename V>
+typename radix_concurrent_tree<V>::size_type radix_concurrent_tree<V>::erase(
+    const std::string& pattern) {
+  size_type count = 0;
+  write([&](radix_tree<V>& tree) { count = tree.erase(pattern); });
+  return count;
+}
+
+template <typename V>
+typename radix_concurrent_tree<V>::size_type radix_concurrent_tree<V>::erase(
+    const std::string& pattern,
+    V value) {
+  size_type count = 0;
+  write([&](radix_tree<V>& tree) { count = tree.erase(pattern, value); });
+  return count;
+}
+
+template <typename V>
+void radix_concurrent_tree<V>::finish(std::function<bool(V, V)> compfunc,
+                                      int recall_limit) {
+  write([&](radix_tree<V>& tree) { tree.finish(compfunc, recall_limit); });
+}
+
+template <typename V>
+void radix_concurrent_tree<V>::clear() {
+  write([](radix_tree<V>& tree) { tree.clear(); });
+}
+
+template <typename V>
+void radix_concurrent_tree<V>::match(const std::string& key,
+                                     std::vector<V>& vec) const {
+  reader_guard guard(this);
+  guard.tree().match(key, vec);
+}
+
+template <typename V>
+void radix_concurrent_tree<V>::match(const std::string& key,
+                                     std::vector<V>& vec,
+                                     std::function<bool(V, V)> compfunc,
+                                     int recall_limit) const {
+  reader_guard guard(this);
+  guard.tree().match(key, vec, compfunc, recall_limit);
+}
+
+// Point readers at the copy just written, then wait until no reader can be
+// left in the other one. Readers that arrived before the switch may hold
+// either count, so both are drained; new readers are steered to the count
+// not being drained first.
+template <typename V>
+void radix_concurrent_tree<V>::publish() {
+  m_side.store(1 - m_side.load());
+  int version = m_version.load();
+  drain(1 - version);
+  m_version.store(1 - version);
+  drain(version);
+}
+
+template <typename V>
+void radix_concurrent_tree<V>::drain(int version) const {
+  for (int i = 0; i < kStripes; ++i) {
+    while (m_readers[version][i].readers.load() != 0) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+template <typename V>
+int radix_concurrent_tree<V>::stripe() {
+  static thread_local int index =
+      std::hash<std::thread::id>()(std::this_thread::get_id()) % kStripes;
+  return index;
+}
+
+template <typename V>
+radix_concurrent_tree<V>::reader_guard::reader_guard(
+    const radix_concurrent_tree* owner)
+    : m_count(&owner->m_readers[owner->m_version.load()][stripe()]) {
+  m_count->readers.fetch_add(1);
+  m_tree = &owner->tree(owner->m_side.load());
+}
+
+template <typename V>
+radix_concurrent_tree<V>::reader_guard::~reader_guard() {
+  m_count->readers.fetch_sub(1);
+}
+
+template class radix_concurrent_tree<int>;
+
+}  // namespace radix
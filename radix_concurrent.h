@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "radix.h"
+
+namespace radix {
+
+// A radix_tree that readers can search while writers modify it, without ever
+// blocking or retrying.
+//
+// Two copies of the tree are kept. Readers always see a complete copy:
+// nodes, leaf chain, counts and top-k lists are consistent with one point in
+// the sequence of writes. A writer, serialized by a mutex, runs its operation
+// on the copy no reader is using, publishes that copy, and waits for a grace
+// period: every reader that could still be inside the old copy leaves it.
+// Only then is the same operation replayed on the old copy. Nodes and values
+// freed by a write are thus reclaimed only once no reader can reach them.
+//
+// Readers announce themselves in one of two striped reader counts. The
+// writer flips which count new readers use and drains them in turn, so a
+// steady stream of readers cannot starve it.
+//
+// Operations passed to write() run twice and must leave both copies alike:
+// the same calls in the same order, with the same arguments.
+template <typename V>
+class radix_concurrent_tree {
+ public:
+  typedef typename radix_tree<V>::size_type size_type;
+
+  explicit radix_concurrent_tree(radix_chunk_allocator* chunks = nullptr);
+
+  void insert(const std::string& pattern, V value);
+  size_type erase(const std::string& pattern);
+  size_type erase(const std::string& pattern, V value);
+  void finish(std::function<bool(V, V)> compfunc, int recall_limit);
+  void clear();
+
+  void match(const std::string& key, std::vector<V>& vec) const;
+  void match(const std::string& key,
+             std::vector<V>& vec,
+             std::function<bool(V, V)> compfunc,
+             int recall_limit) const;
+
+  // Run "op(radix_tree<V>&)" on both copies; see above.
+  template <typename Op>
+  void write(Op op);
+
+  // Run "op(const radix_tree<V>&)" on the current copy and return its
+  // result. Iterators obtained inside "op" must not be used after it returns.
+  // Writers wait for "op", so it should be short.
+  template <typename Op>
+  auto read(Op op) const -> decltype(op(std::declval<const radix_tree<V>&>()));
+
+ private:
+  static const int kStripes = 16;
+
+  struct alignas(64) reader_count {
+    std::atomic<int> readers{0};
+  };
+
+  // Marks the calling thread as a reader between construction and
+  // destruction.
+  class reader_guard {
+   public:
+    explicit reader_guard(const radix_concurrent_tree* owner);
+    ~reader_guard();
+
+    const radix_tree<V>& tree() const { return *m_tree; }
+
+   private:
+    reader_guard(const reader_guard&);             // delete
+    reader_guard& operator=(const reader_guard&);  // delete
+
+    reader_count* m_count;
+    const radix_tree<V>* m_tree;
+  };
+
+  radix_concurrent_tree(const radix_concurrent_tree&);             // delete
+  radix_concurrent_tree& operator=(const radix_concurrent_tree&);  // delete
+
+  static int stripe();
+  radix_tree<V>& tree(int side) { return side == 0 ? m_left : m_right; }
+  const radix_tree<V>& tree(int side) const {
+    return side == 0 ? m_left : m_right;
+  }
+  void publish();
+  void drain(int version) const;
+
+  radix_tree<V> m_left;
+  radix_tree<V> m_right;
+  // The copy readers use.
+  std::atomic<int> m_side;
+  // The reader counts new readers arrive at.
+  std::atomic<int> m_version;
+  mutable reader_count m_readers[2][kStripes];
+  std::mutex m_writer;
+};
+
+template <typename V>
+template <typename Op>
+void radix_concurrent_tree<V>::write(Op op) {
+  std::lock_guard<std::mutex> lock(m_writer);
+  op(tree(1 - m_side.load()));
+  publish();
+  op(tree(1 - m_side.load()));
+}
+
+template <typename V>
+template <typename Op>
+auto radix_concurrent_tree<V>::read(Op op) const
+    -> decltype(op(std::declval<const radix_tree<V>&>())) {
+  reader_guard guard(this);
+  return op(guard.tree());
+}
+
+extern template class radix_concurrent_tree<int>;
+
+}  // namespace radix
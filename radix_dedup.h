@@ -0,0 +1,151 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace radix {
+
+// The values a query has seen, to skip their duplicates. Values in
+// [0, domain), for an integral V, are marked in an array indexed by value;
+// the rest go to an open-addressing hash set. Every entry carries the
+// generation of the set that wrote it and counts only for that set, so a new
+// set starts empty without clearing anything.
+//
+// The arrays belong to the thread, one set of them for each depth of sets
+// live at once, as when a sharded query merges the lists of its shards.
+// Sets on a thread must end in the reverse order they were made, so that
+// each depth reuses its arrays, already sized to the domain, at every query.
+template <typename V>
+class radix_seen {
+ public:
+  explicit radix_seen(size_t domain = 0)
+      : m_domain(std::is_integral<V>::value ? domain : 0) {
+    scratch_stack& stack = thread_stack();
+    if (stack.depth == stack.scratches.size()) {
+      stack.scratches.emplace_back(new scratch());
+    }
+    m_scratch = stack.scratches[stack.depth++].get();
+    if (++m_scratch->generation == 0) {
+      std::fill(m_scratch->dense.begin(), m_scratch->dense.end(), 0);
+      std::fill(m_scratch->stamps.begin(), m_scratch->stamps.end(), 0);
+      m_scratch->generation = 1;
+    }
+    m_generation = m_scratch->generation;
+    if (m_scratch->dense.size() < m_domain) {
+      m_scratch->dense.resize(m_domain, 0);
+    }
+  }
+  ~radix_seen() { --thread_stack().depth; }
+
+  // Returns true if "value" was not seen before.
+  bool insert(const V& value) {
+    size_t index;
+    if (dense_index(value, &index, std::is_integral<V>())) {
+      uint32_t& stamp = m_scratch->dense[index];
+      if (stamp == m_generation) {
+        return false;
+      }
+      stamp = m_generation;
+      ++m_size;
+      return true;
+    }
+    return insert_sparse(value);
+  }
+
+  size_t size() const { return m_size; }
+
+ private:
+  static const size_t kMinSlots = 64;
+
+  struct scratch {
+    uint32_t generation = 0;
+    std::vector<uint32_t> dense;
+    // The hash set: a power of two of slots and their generations.
+    std::vector<V> slots;
+    std::vector<uint32_t> stamps;
+  };
+
+  // The arrays of each depth; those of the sets live now are the first
+  // "depth".
+  struct scratch_stack {
+    size_t depth = 0;
+    std::vector<std::unique_ptr<scratch>> scratches;
+  };
+
+  static scratch_stack& thread_stack() {
+    static thread_local scratch_stack s;
+    return s;
+  }
+
+  bool dense_index(const V& value, size_t* index, std::true_type) const {
+    // Negative values wrap around to beyond any domain.
+    uint64_t offset = static_cast<uint64_t>(value);
+    *index = offset;
+    return offset < m_domain;
+  }
+  bool dense_index(const V&, size_t*, std::false_type) const { return false; }
+
+  size_t slot_of(const V& value, size_t mask) const {
+    uint64_t hash = std::hash<V>()(value) * 0x9e3779b97f4a7c15ull;
+    return (hash >> 32 ^ hash) & mask;
+  }
+
+  bool insert_sparse(const V& value) {
+    if ((m_sparse + 1) * 2 > m_scratch->slots.size()) {
+      grow();
+    }
+    std::vector<V>& slots = m_scratch->slots;
+    std::vector<uint32_t>& stamps = m_scratch->stamps;
+    size_t mask = slots.size() - 1;
+    for (size_t slot = slot_of(value, mask);; slot = (slot + 1) & mask) {
+      if (stamps[slot] != m_generation) {
+        slots[slot] = value;
+        stamps[slot] = m_generation;
+        ++m_sparse;
+        ++m_size;
+        return true;
+      }
+      if (slots[slot] == value) {
+        return false;
+      }
+    }
+  }
+
+  // Double the slots, keeping the entries of this set.
+  void grow() {
+    size_t capacity = m_scratch->slots.empty() ? kMinSlots
+                                               : m_scratch->slots.size() * 2;
+    std::vector<V> slots(capacity);
+    std::vector<uint32_t> stamps(capacity, 0);
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < m_scratch->slots.size(); ++i) {
+      if (m_scratch->stamps[i] != m_generation) {
+        continue;
+      }
+      size_t slot = slot_of(m_scratch->slots[i], mask);
+      while (stamps[slot] == m_generation) {
+        slot = (slot + 1) & mask;
+      }
+      slots[slot] = m_scratch->slots[i];
+      stamps[slot] = m_generation;
+    }
+    m_scratch->slots.swap(slots);
+    m_scratch->stamps.swap(stamps);
+  }
+
+  radix_seen(const radix_seen&);             // delete
+  radix_seen& operator=(const radix_seen&);  // delete
+
+  size_t m_domain;
+  scratch* m_scratch;
+  uint32_t m_generation;
+  size_t m_size = 0;
+  size_t m_sparse = 0;
+};
+
+}  // namespace radix
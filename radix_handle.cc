@@ -0,0 +1,128 @@
+#include "radix_handle.h"
+
+#include <utility>
+
+namespace radix {
+
+template <typename V>
+radix_tree_handle<V>::reaper::reaper() {
+  m_thread = std::thread(&reaper::run, this);
+}
+
+template <typename V>
+radix_tree_handle<V>::reaper::~reaper() {
+  stop();
+}
+
+template <typename V>
+void radix_tree_handle<V>::reaper::retire(const radix_tree<V>* tree) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_stopped) {
+      m_trees.push_back(tree);
+      m_wake.notify_one();
+      return;
+    }
+  }
+  delete tree;
+}
+
+template <typename V>
+void radix_tree_handle<V>::reaper::stop() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopped = true;
+    m_wake.notify_one();
+  }
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+}
+
+template <typename V>
+void radix_tree_handle<V>::reaper::run() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (;;) {
+    m_wake.wait(lock, [this] { return m_stopped || !m_trees.empty(); });
+    if (m_trees.empty()) {
+      return;
+    }
+    const radix_tree<V>* tree = m_trees.front();
+    m_trees.pop_front();
+    lock.unlock();
+    delete tree;
+    lock.lock();
+  }
+}
+
+template <typename V>
+radix_tree_handle<V>::radix_tree_handle(radix_chunk_allocator* chunks)
+    : m_chunks(chunks), m_reaper(std::make_shared<reaper>()) {
+  publish(std::unique_ptr<radix_tree<V>>(new radix_tree<V>(m_chunks)));
+}
+
+template <typename V>
+radix_tree_handle<V>::~radix_tree_handle() {
+  wait();
+  std::atomic_store(&m_current, snapshot());
+  // Snapshots that outlive the handle share the reaper, which then deletes
+  // their trees inline.
+  m_reaper->stop();
+}
+
+template <typename V>
+void radix_tree_handle<V>::publish(std::unique_ptr<radix_tree<V>> tree) {
+  std::shared_ptr<reaper> to = m_reaper;
+  snapshot next(tree.release(),
+                [to](const radix_tree<V>* old) { to->retire(old); });
+  // The replaced tree goes to the reaper when its last snapshot is dropped,
+  // which may be right here.
+  std::atomic_store(&m_current, std::move(next));
+}
+
+template <typename V>
+bool radix_tree_handle<V>::rebuild(std::function<void(radix_tree<V>&)> build) {
+  std::lock_guard<std::mutex> lock(m_build_mutex);
+  if (m_building.load()) {
+    return false;
+  }
+  if (m_builder.joinable()) {
+    m_builder.join();
+  }
+  m_building.store(true);
+  m_builder = std::thread([this, build] {
+    std::unique_ptr<radix_tree<V>> tree(new radix_tree<V>(m_chunks));
+    build(*tree);
+    publish(std::move(tree));
+    m_building.store(false);
+  });
+  return true;
+}
+
+template <typename V>
+void radix_tree_handle<V>::wait() {
+  std::lock_guard<std::mutex> lock(m_build_mutex);
+  if (m_builder.joinable()) {
+    m_builder.join();
+  }
+}
+
+template <typename V>
+radix_snapshot_iter<V> radix_tree_handle<V>::match(
+    const std::string& key) const {
+  snapshot tree = get();
+  radix_tree_iter<V> iter = tree->match(key);
+  return radix_snapshot_iter<V>(std::move(tree), iter);
+}
+
+template <typename V>
+radix_snapshot_iter<V> radix_tree_handle<V>::lower_bound(
+    const std::string& key) const {
+  snapshot tree = get();
+  radix_tree_iter<V> iter = tree->lower_bound(key);
+  return radix_snapshot_iter<V>(std::move(tree), iter);
+}
+
+template class radix_tree_handle<int>;
+
+}  // namespace radix
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "radix.h"
+
+namespace radix {
+
+// A radix_tree_iter that keeps the tree it walks alive.
+template <typename V>
+class radix_snapshot_iter : public radix_tree_iter<V> {
+ public:
+  radix_snapshot_iter(std::shared_ptr<const radix_tree<V>> tree,
+                      const radix_tree_iter<V>& iter)
+      : radix_tree_iter<V>(iter), m_tree(std::move(tree)) {}
+
+ private:
+  std::shared_ptr<const radix_tree<V>> m_tree;
+};
+
+// Serves one radix_tree at a time and replaces it whole, for trees that are
+// rebuilt from scratch rather than updated. Readers take a reference-counted
+// snapshot of the current tree with one atomic load; publish() swaps in a
+// new tree with one atomic store, and the snapshots taken before keep the old
+// tree alive until they are dropped. Neither side ever waits for the other.
+//
+// rebuild() builds the next tree on a background thread and publishes it
+// when done. Replaced trees are destroyed on a thread of the handle's own,
+// so that readers dropping the last snapshot do not pay for the destructor.
+//
+// The served tree is const: it must not be modified once published.
+template <typename V>
+class radix_tree_handle {
+ public:
+  typedef std::shared_ptr<const radix_tree<V>> snapshot;
+
+  // New trees allocate from "chunks". The handle starts with an empty tree.
+  explicit radix_tree_handle(radix_chunk_allocator* chunks = nullptr);
+  // Waits for a running rebuild. Trees still held by snapshots are then
+  // destroyed by whoever drops them last.
+  ~radix_tree_handle();
+
+  snapshot get() const { return std::atomic_load(&m_current); }
+  void publish(std::unique_ptr<radix_tree<V>> tree);
+
+  // Run "build" on a new tree on a background thread, then publish the tree.
+  // Returns false, without running "build", if a rebuild is still running.
+  bool rebuild(std::function<void(radix_tree<V>&)> build);
+  bool building() const { return m_building.load(); }
+  // Wait for the running rebuild, if any.
+  void wait();
+
+  void match(const std::string& key, std::vector<V>& vec) const {
+    get()->match(key, vec);
+  }
+  template <typename Compare>
+  void match(const std::string& key,
+             std::vector<V>& vec,
+             Compare compfunc,
+             int recall_limit) const {
+    get()->match(key, vec, compfunc, recall_limit);
+  }
+  radix_snapshot_iter<V> match(const std::string& key) const;
+  radix_snapshot_iter<V> lower_bound(const std::string& key) const;
+
+ private:
+  // Destroys the trees handed to it on its own thread, or on the calling
+  // one once stopped.
+  class reaper {
+   public:
+    reaper();
+    ~reaper();
+
+    void retire(const radix_tree<V>* tree);
+    // Destroy the trees retired so far and stop the thread.
+    void stop();
+
+   private:
+    reaper(const reaper&);             // delete
+    reaper& operator=(const reaper&);  // delete
+
+    void run();
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::deque<const radix_tree<V>*> m_trees;
+    bool m_stopped = false;
+    std::thread m_thread;
+  };
+
+  radix_tree_handle(const radix_tree_handle&);             // delete
+  radix_tree_handle& operator=(const radix_tree_handle&);  // delete
+
+  radix_chunk_allocator* m_chunks;
+  std::shared_ptr<reaper> m_reaper;
+  snapshot m_current;
+  std::mutex m_build_mutex;
+  std::thread m_builder;
+  std::atomic<bool> m_building{false};
+};
+
+extern template class radix_tree_handle<int>;
+
+}  // namespace radix
@@ -0,0 +1,350 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "radix_arena.h"
+#include "slice.h"
+
+namespace radix {
+
+class radix_key_store;
+
+// Key of a radix_tree_node in 8 bytes. Keys of up to kInlineSize bytes are
+// held in place; longer ones are a size and a 32-bit offset into the
+// radix_key_store of the tree.
+class radix_key {
+ public:
+  static const size_t kInlineSize = 7;
+  static const size_t kMaxSize = (1 << 24) - 1;
+
+  radix_key() {
+    memset(m_bytes, 0, sizeof(m_bytes));
+    m_bytes[0] = 1;
+  }
+
+  size_t size() const {
+    if (is_inline()) {
+      return m_bytes[0] - 1;
+    }
+    return m_bytes[1] | m_bytes[2] << 8 | m_bytes[3] << 16;
+  }
+  bool empty() const { return size() == 0; }
+  bool is_inline() const { return m_bytes[0] != 0; }
+
+ private:
+  friend class radix_key_store;
+
+  // m_bytes[0] is the size plus one for an inline key, followed by the key.
+  // For a stored key it is 0, followed by the size in three bytes and the
+  // offset.
+  static radix_key make_inline(const char* data, size_t size) {
+    radix_key key;
+    key.m_bytes[0] = static_cast<unsigned char>(size + 1);
+    memcpy(key.m_bytes + 1, data, size);
+    return key;
+  }
+
+  static radix_key make_stored(uint32_t offset, size_t size) {
+    radix_key key;
+    key.m_bytes[0] = 0;
+    key.m_bytes[1] = static_cast<unsigned char>(size);
+    key.m_bytes[2] = static_cast<unsigned char>(size >> 8);
+    key.m_bytes[3] = static_cast<unsigned char>(size >> 16);
+    memcpy(key.m_bytes + 4, &offset, sizeof(offset));
+    return key;
+  }
+
+  const char* inline_data() const {
+    return reinterpret_cast<const char*>(m_bytes + 1);
+  }
+
+  uint32_t offset() const {
+    uint32_t offset;
+    memcpy(&offset, m_bytes + 4, sizeof(offset));
+    return offset;
+  }
+
+  unsigned char m_bytes[8];
+};
+
+// The bytes of the keys too long to be held in place, in one block that
+// grows by doubling, so that a key can refer to them by offset. The key of an
+// inner node refers to part of the bytes of any pattern below it, so bytes
+// are not freed key by key: release() counts those of the patterns that go,
+// and compact() copies the bytes the keys still refer to into a new block.
+//
+// A key that continues the last one stored only appends the rest, and one
+// that the last one starts with is not appended at all, so patterns stored
+// in sorted order share their common prefixes with their predecessors. Any
+// other key stored before, and not compacted away since, is found through a
+// hash table of the stored keys and shares their bytes.
+//
+// Bytes no key refers to are at most those release() counted since the last
+// compact(). So a tree that compacts whenever compactable() holds after a
+// release keeps the block under twice the bytes its keys refer to, or under
+// those plus kMinCapacity, and a pattern erased and inserted again takes no
+// new bytes.
+//
+// data() and slice() of a stored key are invalidated by the next store() or
+// compact().
+class radix_key_store {
+ public:
+  explicit radix_key_store(radix_chunk_allocator* chunks = nullptr)
+      : m_allocator(chunks != nullptr
+                        ? chunks
+                        : radix_chunk_allocator::default_allocator()) {}
+  ~radix_key_store() { reset(); }
+
+  // Whether a key of "size" bytes can be stored.
+  bool can_store(size_t size) const {
+    return size <= radix_key::kMaxSize &&
+           (size <= radix_key::kInlineSize || size <= kMaxBytes - m_size);
+  }
+
+  // REQUIRES: can_store(size)
+  radix_key store(const char* data, size_t size) {
+    if (size <= radix_key::kInlineSize) {
+      return radix_key::make_inline(data, size);
+    }
+    size_t last = m_size - m_last;
+    if (last > 0 && memcmp(m_data + m_last, data, std::min(last, size)) == 0) {
+      if (size > last) {
+        append(data + last, size - last);
+      }
+      radix_key key = radix_key::make_stored(m_last, size);
+      intern(key);
+      return key;
+    }
+    if (!m_slots.empty()) {
+      uint64_t slot = *find(data, size);
+      if (slot != 0) {
+        return radix_key::make_stored(slot >> 24, size);
+      }
+    }
+    m_last = m_size;
+    append(data, size);
+    radix_key key = radix_key::make_stored(m_last, size);
+    intern(key);
+    return key;
+  }
+
+  // The key of key[pos, pos + size), sharing the bytes of "key".
+  radix_key substr(const radix_key& key, size_t pos, size_t size) const {
+    if (size <= radix_key::kInlineSize) {
+      return radix_key::make_inline(data(key) + pos, size);
+    }
+    return radix_key::make_stored(key.offset() + pos, size);
+  }
+
+  // The bytes of an inline key are those of "key" itself, so it must not be
+  // a temporary.
+  const char* data(const radix_key& key) const {
+    return key.is_inline() ? key.inline_data() : m_data + key.offset();
+  }
+  Slice slice(const radix_key& key) const {
+    return Slice(data(key), key.size());
+  }
+
+  // Count the bytes of "key", whose pattern left the tree, as ones that
+  // compact() may reclaim.
+  void release(const radix_key& key) {
+    if (!key.is_inline()) {
+      m_released += key.size();
+    }
+  }
+
+  // Whether enough bytes were released for compact() to be worth a walk of
+  // every key.
+  bool compactable() const {
+    return m_released >= kMinCapacity && m_released * 2 >= m_size;
+  }
+
+  // Keep only the bytes of the keys that "for_each_key" passes, by reference,
+  // to the function it is given, and make those keys refer to their new
+  // place. It is called twice and must pass the same keys each time.
+  template <typename F>
+  void compact(F for_each_key) {
+    // The byte ranges the keys refer to, merged.
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+    for_each_key([&ranges](radix_key& key) {
+      if (!key.is_inline()) {
+        ranges.emplace_back(key.offset(), key.offset() + key.size());
+      }
+    });
+    std::sort(ranges.begin(), ranges.end());
+    size_t merged = 0;
+    size_t live = 0;
+    for (const auto& range : ranges) {
+      if (merged > 0 && range.first <= ranges[merged - 1].second) {
+        ranges[merged - 1].second =
+            std::max(ranges[merged - 1].second, range.second);
+        continue;
+      }
+      ranges[merged++] = range;
+    }
+    ranges.resize(merged);
+    for (const auto& range : ranges) {
+      live += range.second - range.first;
+    }
+    m_released = 0;
+    if (live == m_size) {
+      return;
+    }
+
+    // Copy the ranges end to end; "starts" are their new offsets.
+    size_t capacity = 0;
+    char* data = nullptr;
+    if (live > 0) {
+      capacity = kMinCapacity;
+      while (capacity < live) {
+        capacity *= 2;
+      }
+      if (capacity > kMaxBytes) {
+        capacity = kMaxBytes;
+      }
+      data = static_cast<char*>(m_allocator->allocate(capacity));
+    }
+    std::vector<uint32_t> starts(ranges.size());
+    size_t size = 0;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+      starts[i] = static_cast<uint32_t>(size);
+      memcpy(data + size, m_data + ranges[i].first,
+             ranges[i].second - ranges[i].first);
+      size += ranges[i].second - ranges[i].first;
+    }
+    if (m_data != nullptr) {
+      m_allocator->deallocate(m_data, m_capacity);
+    }
+    m_data = data;
+    m_size = size;
+    m_capacity = capacity;
+    m_last = size;
+
+    m_slots.clear();
+    m_interned = 0;
+    for_each_key([this, &ranges, &starts](radix_key& key) {
+      if (key.is_inline()) {
+        return;
+      }
+      uint32_t offset = key.offset();
+      size_t range =
+          std::upper_bound(ranges.begin(), ranges.end(),
+                           std::make_pair(offset, UINT32_MAX)) -
+          ranges.begin() - 1;
+      key = radix_key::make_stored(starts[range] + offset - ranges[range].first,
+                                   key.size());
+      intern(key);
+    });
+  }
+
+  void reset() {
+    if (m_data != nullptr) {
+      m_allocator->deallocate(m_data, m_capacity);
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_capacity = 0;
+    m_last = 0;
+    m_released = 0;
+    std::vector<uint64_t>().swap(m_slots);
+    m_interned = 0;
+  }
+
+  size_t bytes_used() const { return m_size; }
+  size_t bytes_reserved() const {
+    return m_capacity + m_slots.capacity() * sizeof(uint64_t);
+  }
+
+ private:
+  static const size_t kMinCapacity = 4 * 1024;
+  static const size_t kMaxBytes = UINT32_MAX;
+  static const size_t kMinSlots = 64;
+
+  // The slot of the hash table that holds a stored key with the bytes
+  // data[0, size), or the empty one where it would go. A slot is 0 when
+  // empty, else the offset of its key shifted left by 24 bits, or'ed with
+  // its size.
+  // REQUIRES: !m_slots.empty()
+  uint64_t* find(const char* data, size_t size) {
+    size_t mask = m_slots.size() - 1;
+    for (size_t index = hash(data, size) & mask;; index = (index + 1) & mask) {
+      uint64_t& slot = m_slots[index];
+      if (slot == 0 || ((slot & radix_key::kMaxSize) == size &&
+                        memcmp(m_data + (slot >> 24), data, size) == 0)) {
+        return &slot;
+      }
+    }
+  }
+
+  void intern(const radix_key& key) {
+    if ((m_interned + 1) * 2 > m_slots.size()) {
+      std::vector<uint64_t> slots;
+      slots.swap(m_slots);
+      m_slots.resize(slots.empty() ? kMinSlots : 2 * slots.size());
+      for (uint64_t slot : slots) {
+        if (slot != 0) {
+          *find(m_data + (slot >> 24), slot & radix_key::kMaxSize) = slot;
+        }
+      }
+    }
+    uint64_t* slot = find(m_data + key.offset(), key.size());
+    if (*slot == 0) {
+      *slot = uint64_t(key.offset()) << 24 | key.size();
+      ++m_interned;
+    }
+  }
+
+  static size_t hash(const char* data, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i) {
+      hash = (hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ull;
+    }
+    return static_cast<size_t>(hash >> 32 ^ hash);
+  }
+
+  void append(const char* data, size_t size) {
+    if (m_size + size > m_capacity) {
+      size_t capacity = m_capacity > 0 ? m_capacity : kMinCapacity;
+      while (capacity < m_size + size) {
+        capacity *= 2;
+      }
+      if (capacity > kMaxBytes) {
+        capacity = kMaxBytes;
+      }
+      char* grown = static_cast<char*>(m_allocator->allocate(capacity));
+      if (m_size > 0) {
+        memcpy(grown, m_data, m_size);
+      }
+      if (m_data != nullptr) {
+        m_allocator->deallocate(m_data, m_capacity);
+      }
+      m_data = grown;
+      m_capacity = capacity;
+    }
+    memcpy(m_data + m_size, data, size);
+    m_size += size;
+  }
+
+  radix_key_store(const radix_key_store&);             // delete
+  radix_key_store& operator=(const radix_key_store&);  // delete
+
+  radix_chunk_allocator* m_allocator;
+  char* m_data = nullptr;
+  size_t m_size = 0;
+  size_t m_capacity = 0;
+  // Offset of the last key appended.
+  size_t m_last = 0;
+  // Bytes of the keys passed to release() since the last compact().
+  size_t m_released = 0;
+  // The hash table of stored keys, a power of two of slots, at most half of
+  // them used.
+  std::vector<uint64_t> m_slots;
+  size_t m_interned = 0;
+};
+
+}  // namespace radix
@@ -1,9 +1,18 @@
 #pragma once
 
 #include <algorithm>
+#include <cassert>
+#include <cstdint>
 #include <functional>
-#include <map>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+#include "radix_arena.h"
+#include "radix_children.h"
+#include "radix_key.h"
+#include "radix_packed.h"
 #include "slice.h"
 
 namespace radix {
@@ -14,151 +23,740 @@ class radix_tree;
 template <typename V>
 class radix_tree_iter;
 
+template <typename V>
+class radix_tree_loader;
+
+// Array of values carved from a radix_arena: the values of a leaf, or the
+// precomputed top-k list of an inner node. As many values as fit in 24 bytes
+// are stored in place, which for a leaf is space the node union holds anyway,
+// so a leaf with a value or two needs no block of its own.
+//
+// Once a value is given a score, the array keeps a score for every value, in
+// a second array after the values in the same block, so that score passes
+// run over contiguous floats. Values added without one score 0.
+//
+// The leaves of a tree in compact mode keep their values sorted and distinct
+// with add_sorted() and erase_sorted(), and a list of integers without scores
+// is packed by radix_packed once it holds kPackSize values, after which an
+// insert or erase encodes only the frame of its value anew. A packed list has
+// no begin(), end() or operator[]; it is read with for_each(), values() or
+// append_to(), which work on either form.
+template <typename V>
+class radix_values {
+ public:
+  // Sorted lists of this many integers are packed.
+  static const uint32_t kPackSize = 32;
+
+  radix_values()
+      : m_size(0), m_capacity(kInlineCapacity), m_scored(0), m_packed(0) {}
+
+  size_t size() const { return m_size; }
+  bool empty() const { return m_size == 0; }
+  bool packed() const { return m_packed; }
+  const V* begin() const { return data(); }
+  const V* end() const { return data() + m_size; }
+  const V& operator[](size_t n) const { return data()[n]; }
+  const V& at(size_t n) const {
+    assert(n < m_size);
+    return data()[n];
+  }
+  // The scores of the values, or null if none was ever given.
+  const float* scores() const {
+    return m_scored ? score_data(data(), m_capacity) : nullptr;
+  }
+
+  // Call "f" on each value, in order.
+  template <typename F>
+  void for_each(F f) const {
+    if (m_packed) {
+      for_each_packed(f);
+      return;
+    }
+    const V* values = data();
+    for (uint32_t i = 0; i < m_size; ++i) {
+      f(values[i]);
+    }
+  }
+
+  // The values, decoded into "*buffer" if they are packed.
+  const V* values(std::vector<V>* buffer) const {
+    if (!m_packed) {
+      return data();
+    }
+    buffer->clear();
+    append_to(buffer);
+    return buffer->data();
+  }
+
+  void append_to(std::vector<V>* out) const {
+    if (!m_packed) {
+      out->insert(out->end(), begin(), end());
+      return;
+    }
+    out->reserve(out->size() + m_size);
+    for_each_packed([out](const V& value) { out->push_back(value); });
+  }
+
+  // Add "value", with "*score" unless it is null, to a sorted list of
+  // distinct values unless it is there already, in which case it keeps the
+  // higher of its scores. Returns whether it was added.
+  bool add_sorted(const V& value, const float* score, radix_arena& arena) {
+    if (m_packed) {
+      if (score == nullptr) {
+        return splice_packed(value, true, arena);
+      }
+      unpack(arena);
+    }
+    const V* values = data();
+    size_t pos = std::lower_bound(values, values + m_size, value) - values;
+    if (pos < m_size && values[pos] == value) {
+      if (score != nullptr) {
+        if (!m_scored) {
+          make_scored(arena);
+        }
+        float* scores = score_data();
+        scores[pos] = std::max(scores[pos], *score);
+      }
+      return false;
+    }
+    if (score != nullptr) {
+      insert(pos, value, *score, arena);
+    } else {
+      insert(pos, value, arena);
+    }
+    pack(arena);
+    return true;
+  }
+
+  // Remove "value" from a sorted list of distinct values. Returns 1 if it
+  // was there, 0 if not.
+  size_t erase_sorted(const V& value, radix_arena& arena) {
+    if (m_packed) {
+      if (m_size > kPackSize) {
+        return splice_packed(value, false, arena) ? 1 : 0;
+      }
+      if (!contains_packed(value)) {
+        return 0;
+      }
+      unpack(arena);
+    }
+    const V* values = data();
+    size_t pos = std::lower_bound(values, values + m_size, value) - values;
+    if (pos == m_size || !(values[pos] == value)) {
+      return 0;
+    }
+    erase_at(pos);
+    pack(arena);
+    return 1;
+  }
+
+  void push_back(const V& value, radix_arena& arena) {
+    if (m_size == m_capacity) {
+      grow(m_capacity == 0 ? 1 : m_capacity * 2, arena);
+    }
+    new (data() + m_size) V(value);
+    if (m_scored) {
+      score_data()[m_size] = 0;
+    }
+    ++m_size;
+  }
+
+  void push_back(const V& value, float score, radix_arena& arena) {
+    if (!m_scored) {
+      make_scored(arena);
+    }
+    push_back(value, arena);
+    score_data()[m_size - 1] = score;
+  }
+
+  void insert(size_t pos, const V& value, radix_arena& arena) {
+    push_back(value, arena);
+    V* values = data();
+    std::rotate(values + pos, values + m_size - 1, values + m_size);
+    if (m_scored) {
+      float* scores = score_data();
+      std::rotate(scores + pos, scores + m_size - 1, scores + m_size);
+    }
+  }
+
+  void insert(size_t pos, const V& value, float score, radix_arena& arena) {
+    if (!m_scored) {
+      make_scored(arena);
+    }
+    insert(pos, value, arena);
+    score_data()[pos] = score;
+  }
+
+  // Remove the value at "pos", keeping the order of the others.
+  void erase_at(size_t pos) {
+    V* values = data();
+    std::rotate(values + pos, values + pos + 1, values + m_size);
+    if (m_scored) {
+      float* scores = score_data();
+      std::rotate(scores + pos, scores + pos + 1, scores + m_size);
+    }
+    pop_back();
+  }
+
+  void pop_back() {
+    --m_size;
+    data()[m_size].~V();
+  }
+
+  // Remove every copy of "value" and return how many there were.
+  size_t erase(const V& value) {
+    V* values = data();
+    float* scores = m_scored ? score_data() : nullptr;
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < m_size; ++i) {
+      if (values[i] == value) {
+        continue;
+      }
+      if (kept != i) {
+        values[kept] = std::move(values[i]);
+        if (scores != nullptr) {
+          scores[kept] = scores[i];
+        }
+      }
+      ++kept;
+    }
+    size_t removed = m_size - kept;
+    while (m_size != kept) {
+      pop_back();
+    }
+    return removed;
+  }
+
+  void assign(const V* first, const V* last, radix_arena& arena) {
+    release(arena);
+    grow(static_cast<uint32_t>(last - first), arena);
+    V* values = data();
+    for (; first != last; ++first) {
+      new (values + m_size) V(*first);
+      ++m_size;
+    }
+  }
+
+  void assign(const V* values,
+              const float* scores,
+              size_t size,
+              radix_arena& arena) {
+    release(arena);
+    make_scored(arena);
+    grow(static_cast<uint32_t>(size), arena);
+    for (size_t i = 0; i < size; ++i) {
+      new (data() + m_size) V(values[i]);
+      score_data()[m_size] = scores[i];
+      ++m_size;
+    }
+  }
+
+  // Destroy the values and give their storage back to "arena".
+  void release(radix_arena& arena) {
+    if (m_packed) {
+      arena.deallocate(m_block, m_capacity);
+      m_size = 0;
+      m_capacity = kInlineCapacity;
+      m_packed = 0;
+      return;
+    }
+    destroy();
+    if (!is_inline()) {
+      arena.deallocate(m_data, block_bytes(m_capacity, m_scored));
+    }
+    m_capacity = kInlineCapacity;
+    m_scored = 0;
+  }
+
+  // Run the destructors without returning storage; used when the whole arena
+  // is about to be reset.
+  void destroy() {
+    if (m_packed) {
+      m_size = 0;
+      return;
+    }
+    V* values = data();
+    for (uint32_t i = 0; i < m_size; ++i) {
+      values[i].~V();
+    }
+    m_size = 0;
+  }
+
+ private:
+  static const size_t kInlineBytes = 24;
+  static const uint32_t kInlineCapacity =
+      alignof(V) <= alignof(V*) ? kInlineBytes / sizeof(V) : 0;
+
+  // Bytes of a block of "capacity" values, and scores if "scored".
+  static constexpr size_t block_bytes(uint32_t capacity, bool scored) {
+    return scored ? scores_offset(capacity) + capacity * sizeof(float)
+                  : capacity * sizeof(V);
+  }
+  static constexpr size_t scores_offset(uint32_t capacity) {
+    return (capacity * sizeof(V) + alignof(float) - 1) / alignof(float) *
+           alignof(float);
+  }
+  static constexpr uint32_t inline_scored_capacity(uint32_t capacity) {
+    return capacity == 0 || block_bytes(capacity, true) <= kInlineBytes
+               ? capacity
+               : inline_scored_capacity(capacity - 1);
+  }
+  static const uint32_t kInlineScoredCapacity =
+      inline_scored_capacity(kInlineCapacity);
+
+  bool is_inline() const {
+    return !m_packed &&
+           m_capacity == (m_scored ? kInlineScoredCapacity : kInlineCapacity);
+  }
+  V* data() {
+    assert(!m_packed);
+    return is_inline() ? reinterpret_cast<V*>(m_inline) : m_data;
+  }
+  const V* data() const {
+    assert(!m_packed);
+    return is_inline() ? reinterpret_cast<const V*>(m_inline) : m_data;
+  }
+
+  // The packed forms are only instantiated for integers, the only lists
+  // ever packed.
+  template <typename F>
+  void for_each_packed(F f) const {
+    if constexpr (std::is_integral<V>::value) {
+      radix_packed<V>::for_each(m_block, f);
+    }
+  }
+
+  bool contains_packed(const V& value) const {
+    if constexpr (std::is_integral<V>::value) {
+      return radix_packed<V>::contains(m_block, value);
+    }
+    return false;
+  }
+
+  // Add "value" to a packed list, or remove it, by encoding anew only the
+  // frame it belongs in. Returns whether the list changed.
+  bool splice_packed(const V& value, bool add, radix_arena& arena) {
+    if constexpr (std::is_integral<V>::value) {
+      typedef radix_packed<V> codec;
+      size_t frame = codec::locate(m_block, value);
+      V values[codec::kFrame + 1];
+      size_t count = codec::decode(m_block, frame, values);
+      V* pos = std::lower_bound(values, values + count, value);
+      bool found = pos != values + count && *pos == value;
+      if (found == add) {
+        return false;
+      }
+      if (add) {
+        std::copy_backward(pos, values + count, values + count + 1);
+        *pos = value;
+        ++count;
+      } else {
+        std::copy(pos + 1, values + count, pos);
+        --count;
+      }
+      size_t bytes =
+          codec::spliced_bytes(m_block, m_capacity, frame, values, count);
+      assert(bytes < (1u << 30));
+      unsigned char* block = static_cast<unsigned char*>(arena.allocate(bytes));
+      codec::splice(m_block, m_capacity, frame, values, count, block);
+      arena.deallocate(m_block, m_capacity);
+      m_block = block;
+      m_capacity = static_cast<uint32_t>(bytes);
+      m_size += add ? 1 : -1;
+      return true;
+    }
+    return false;
+  }
+
+  // Pack a sorted list of kPackSize or more integers without scores. The
+  // block size takes the place of the capacity.
+  void pack(radix_arena& arena) {
+    if constexpr (std::is_integral<V>::value) {
+      if (m_packed || m_scored || m_size < kPackSize) {
+        return;
+      }
+      const V* values = data();
+      size_t bytes = radix_packed<V>::encoded_bytes(values, m_size);
+      assert(bytes < (1u << 30));
+      unsigned char* block = static_cast<unsigned char*>(arena.allocate(bytes));
+      radix_packed<V>::encode(values, m_size, block);
+      if (!is_inline()) {
+        arena.deallocate(m_data, block_bytes(m_capacity, false));
+      }
+      m_block = block;
+      m_capacity = static_cast<uint32_t>(bytes);
+      m_packed = 1;
+    }
+  }
+
+  // Decode a packed list back into an array of values.
+  void unpack(radix_arena& arena) {
+    unsigned char* block = m_block;
+    size_t bytes = m_capacity;
+    uint32_t size = m_size;
+    m_size = 0;
+    m_capacity = kInlineCapacity;
+    m_packed = 0;
+    grow(size, arena);
+    if constexpr (std::is_integral<V>::value) {
+      V* values = data();
+      auto append = [this, values](const V& value) {
+        new (values + m_size) V(value);
+        ++m_size;
+      };
+      radix_packed<V>::for_each(block, append);
+    }
+    arena.deallocate(block, bytes);
+  }
+  static float* score_data(V* values, uint32_t capacity) {
+    return reinterpret_cast<float*>(reinterpret_cast<char*>(values) +
+                                    scores_offset(capacity));
+  }
+  static const float* score_data(const V* values, uint32_t capacity) {
+    return reinterpret_cast<const float*>(
+        reinterpret_cast<const char*>(values) + scores_offset(capacity));
+  }
+  float* score_data() { return score_data(data(), m_capacity); }
+
+  void grow(uint32_t capacity, radix_arena& arena) {
+    if (capacity <= m_capacity) {
+      return;
+    }
+    move_to(capacity, m_scored, arena);
+  }
+
+  // Give every value a score of 0.
+  void make_scored(radix_arena& arena) {
+    uint32_t capacity = m_size <= kInlineScoredCapacity
+                            ? kInlineScoredCapacity
+                            : std::max<uint32_t>(m_capacity, m_size);
+    move_to(capacity, true, arena);
+    float* scores = score_data();
+    for (uint32_t i = 0; i < m_size; ++i) {
+      scores[i] = 0;
+    }
+  }
+
+  // Move the values to storage for "capacity" values, in place if that is
+  // the inline capacity of "scored".
+  void move_to(uint32_t capacity, bool scored, radix_arena& arena) {
+    V* values = data();
+    const float* scores = m_scored ? score_data() : nullptr;
+    bool was_inline = is_inline();
+    uint32_t old_capacity = m_capacity;
+    bool old_scored = m_scored;
+    if (capacity == (scored ? kInlineScoredCapacity : kInlineCapacity)) {
+      // Only ever reached with the values in a block, or in place already,
+      // where they stay put.
+      if (!was_inline) {
+        V* inline_values = reinterpret_cast<V*>(m_inline);
+        float inline_scores[kInlineBytes / sizeof(float)];
+        for (uint32_t i = 0; i < m_size; ++i) {
+          inline_scores[i] = scores != nullptr ? scores[i] : 0;
+        }
+        V* block = values;
+        for (uint32_t i = 0; i < m_size; ++i) {
+          new (inline_values + i) V(std::move(block[i]));
+          block[i].~V();
+        }
+        m_capacity = capacity;
+        m_scored = scored;
+        if (scored) {
+          std::copy(inline_scores, inline_scores + m_size, score_data());
+        }
+        arena.deallocate(block, block_bytes(old_capacity, old_scored));
+        return;
+      }
+      m_capacity = capacity;
+      m_scored = scored;
+      return;
+    }
+    V* grown = static_cast<V*>(arena.allocate(block_bytes(capacity, scored)));
+    for (uint32_t i = 0; i < m_size; ++i) {
+      new (grown + i) V(std::move(values[i]));
+      values[i].~V();
+    }
+    if (scored && scores != nullptr) {
+      std::copy(scores, scores + m_size, score_data(grown, capacity));
+    }
+    if (!was_inline) {
+      arena.deallocate(m_data, block_bytes(old_capacity, old_scored));
+    }
+    m_data = grown;
+    m_capacity = capacity;
+    m_scored = scored;
+  }
+
+  uint32_t m_size;
+  uint32_t m_capacity : 30;
+  uint32_t m_scored : 1;
+  uint32_t m_packed : 1;
+  union {
+    V* m_data;
+    unsigned char* m_block;
+    alignas(V*) unsigned char m_inline[kInlineBytes];
+  };
+};
+
 template <typename V>
 class radix_tree_node {
   friend class radix_tree<V>;
   friend class radix_tree_iter<V>;
+  friend class radix_tree_loader<V>;
 
-  typedef typename std::map<Slice, radix_tree_node*>::iterator it_child;
+  typedef typename radix_children<radix_tree_node>::iterator it_child;
 
  public:
   radix_tree_node();
-  radix_tree_node(const Slice& key, V& value);
+  explicit radix_tree_node(const radix_key& key);
 
   void swap(radix_tree_node&);
 
  private:
+  // The leaf of rank "rank" among the leaves below "node", in pattern order,
+  // or null past the last; the values of the leaves before it are added to
+  // "*values". Takes O(depth * fanout).
+  static const radix_tree_node* select(const radix_tree_node* node,
+                                       int rank,
+                                       int* values);
+
+  // m_heap as queries read it. Queries on a tree in adaptive mode publish
+  // and withdraw lists while other queries read them.
+  const radix_values<V>* heap() const {
+    return __atomic_load_n(&m_heap, __ATOMIC_ACQUIRE);
+  }
+  void publish_heap(radix_values<V>* heap) {
+    __atomic_store_n(&m_heap, heap, __ATOMIC_RELEASE);
+  }
+
   radix_tree_node(const radix_tree_node&);             // delete
   radix_tree_node& operator=(const radix_tree_node&);  // delete
-  ~radix_tree_node();
+  ~radix_tree_node() = default;
 
   radix_tree_node* m_first = nullptr;
   radix_tree_node* m_last = nullptr;
-  Slice m_key;
+  radix_key m_key;
   union {
     struct {
-      std::map<Slice, radix_tree_node*> m_children;
+      radix_children<radix_tree_node> m_children;
       radix_tree_node* m_leaf;
-      std::vector<V>* m_heap;
+      radix_values<V>* m_heap;
     };
-    std::vector<V>* m_value;
+    radix_values<V> m_value;
   };
   int m_count = 0;
+  // Values stored in the leaves below the node.
+  int m_value_count = 0;
 };
 
+static_assert(sizeof(radix_values<int>) <=
+                  sizeof(radix_children<radix_tree_node<int>>) +
+                      2 * sizeof(void*),
+              "leaf values must fit in the node union");
+
 template <typename V>
 radix_tree_node<V>::radix_tree_node() {
-  new (&m_children) std::map<Slice, radix_tree_node*>;
+  new (&m_children) radix_children<radix_tree_node>;
   m_leaf = nullptr;
   m_heap = nullptr;
 }
 
 template <typename V>
-radix_tree_node<V>::radix_tree_node(const Slice& key, V& value)
-    : m_value(new std::vector<V>{value}), m_key(key) {}
-
-template <typename V>
-radix_tree_node<V>::~radix_tree_node() {
-  if (m_count == 0 && !m_key.empty()) {
-    delete m_value;
-  } else {
-    delete m_heap;
-    it_child it;
-    for (it = m_children.begin(); it != m_children.end(); ++it) {
-      delete it->second;
-    }
-    m_children.~map();
-  }
-}
+radix_tree_node<V>::radix_tree_node(const radix_key& key)
+    : m_key(key), m_value() {}
 
 template <typename V>
 void radix_tree_node<V>::swap(radix_tree_node<V>& other) {
   m_count = other.m_count;
+  m_value_count = other.m_value_count;
   std::swap(m_first, other.m_first);
   std::swap(m_last, other.m_last);
-  m_key.swap(other.m_key);
+  std::swap(m_key, other.m_key);
   m_children.swap(other.m_children);
   std::swap(m_leaf, other.m_leaf);
   std::swap(m_heap, other.m_heap);
 }
 
+template <typename V>
+const radix_tree_node<V>* radix_tree_node<V>::select(
+    const radix_tree_node<V>* node,
+    int rank,
+    int* values) {
+  while (true) {
+    if (node->m_leaf != nullptr) {
+      if (rank == 0) {
+        return node->m_leaf;
+      }
+      --rank;
+      *values += node->m_leaf->m_value.size();
+    }
+    it_child iter = node->m_children.begin();
+    for (; iter != node->m_children.end(); ++iter) {
+      if (rank < (*iter)->m_count) {
+        break;
+      }
+      rank -= (*iter)->m_count;
+      *values += (*iter)->m_value_count;
+    }
+    if (iter == node->m_children.end()) {
+      return nullptr;
+    }
+    node = *iter;
+  }
+}
+
 template <typename V>
 class radix_tree_iter {
  public:
+  // Iterate over "count" leaves from "begin" to "end". "begin" is the leaf of
+  // rank "rank" below "root", whose leaves include all of them. Their keys
+  // are in "keys".
   radix_tree_iter(const radix_tree_node<V>* const begin,
                   const radix_tree_node<V>* const end,
                   int count,
+                  const radix_tree_node<V>* root,
+                  int rank,
+                  const radix_key_store* keys,
                   bool order = true)
-      : m_begin(begin),
+      : m_keys(keys),
+        m_begin(begin),
         m_end(end),
         m_current(begin),
+        m_root(root),
         m_index(0),
         m_cursor(0),
+        m_rank(rank),
+        m_span(count),
         m_count(count),
-        m_order(order) {}
+        m_order(order) {
+    decode_current();
+    count_values();
+  }
   radix_tree_iter() = default;
   radix_tree_iter(const radix_tree_iter&) = default;
   ~radix_tree_iter() = default;
 
   radix_tree_iter& operator=(const radix_tree_iter& iter) {
+    m_keys = iter.m_keys;
     m_begin = iter.m_current;
     m_end = iter.m_end;
+    m_root = iter.m_root;
+    m_rank = iter.m_order ? iter.m_rank + iter.m_cursor
+                          : iter.m_rank - iter.m_cursor;
+    m_span = iter.m_span - iter.m_cursor;
     m_count = iter.m_count;
+    m_order = iter.m_order;
     m_current = m_begin;
     m_index = 0;
     m_cursor = 0;
+    decode_current();
+    count_values();
     return *this;
   }
 
  private:
+  const radix_key_store* m_keys = nullptr;
   const radix_tree_node<V>* m_begin = nullptr;
   const radix_tree_node<V>* m_end = nullptr;
   const radix_tree_node<V>* m_current = nullptr;
+  const radix_tree_node<V>* m_root = nullptr;
   std::size_t m_index = 0;
   int m_cursor = 0;
+  // Rank of "m_begin" below "m_root", and leaves from it to "m_end".
+  int m_rank = 0;
+  int m_span = 0;
   bool m_order = true;
   int m_count = 0;
+  int m_values = 0;
+  // The values of "m_current" if they are packed.
+  std::vector<V> m_decoded;
 
  public:
-  int count() { return m_count; }
+  // The number of values the iterator yields.
+  int count() { return m_values; }
 
+  // Skip "start" leaves, no further than the last one, and iterate over the
+  // next "count". Lands by subtree counts, in O(depth * fanout).
   void reset(int start, int count) {
     m_cursor = 0;
+    m_index = 0;
     m_count = count;
-    for (int skip = 0; skip < start; ++skip) {
-      if (m_begin != nullptr && m_begin != m_end &&
-          m_begin->m_last != nullptr) {
-        m_begin = m_begin->m_last;
-      }
+    if (m_root != nullptr && m_span > 0) {
+      int skip = std::min(start, m_span - 1);
+      m_rank += m_order ? skip : -skip;
+      m_span -= skip;
+      int values = 0;
+      m_begin = radix_tree_node<V>::select(m_root, m_rank, &values);
     }
     m_current = m_begin;
+    decode_current();
+    count_values();
   }
 
   bool valid() const {
-    if (m_current == nullptr || m_current->m_value == nullptr) {
+    if (m_current == nullptr) {
       return false;
     }
     if (m_cursor >= m_count) {
       return false;
     }
     if (m_cursor == m_count - 1 || m_current == m_end) {
-      return m_index < m_current->m_value->size();
+      return m_index < m_current->m_value.size();
     }
     return true;
   }
 
-  V value() const { return m_current->m_value->at(m_index); }
+  V value() const {
+    return m_current->m_value.packed() ? m_decoded[m_index]
+                                       : m_current->m_value.at(m_index);
+  }
+  // The pattern "value()" is stored under.
+  Slice key() const { return m_keys->slice(m_current->m_key); }
 
   void next() {
     ++m_index;
-    if (m_index < m_current->m_value->size()) {
+    if (m_index < m_current->m_value.size()) {
       return;
     }
     if (m_current != m_end && m_cursor < m_count) {
       m_index = 0;
-      m_current = m_current->m_last;
+      m_current = step(m_current);
       ++m_cursor;
+      decode_current();
+    }
+  }
+
+ private:
+  // The leaf after "leaf" in the direction of iteration: pattern order, or
+  // the reverse if "m_order" is false.
+  const radix_tree_node<V>* step(const radix_tree_node<V>* leaf) const {
+    return m_order ? leaf->m_last : leaf->m_first;
+  }
+
+  void decode_current() {
+    if (m_current != nullptr && m_current->m_value.packed()) {
+      m_current->m_value.values(&m_decoded);
+    }
+  }
+
+  // Values in the leaves of rank [0, rank) below "m_root".
+  int values_before(int rank) const {
+    if (rank >= m_root->m_count) {
+      return m_root->m_value_count;
+    }
+    int values = 0;
+    radix_tree_node<V>::select(m_root, rank, &values);
+    return values;
+  }
+
+  void count_values() {
+    m_values = 0;
+    if (m_root == nullptr || m_begin == nullptr) {
+      return;
     }
+    int leaves = std::max(0, std::min(m_count, m_span));
+    int first = m_order ? m_rank : m_rank - leaves + 1;
+    m_values = values_before(first + leaves) - values_before(first);
   }
 };
 
@@ -0,0 +1,324 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace radix {
+
+// Codec of the packed value lists of compact leaves: ascending, distinct
+// integers in frames of up to kFrame values. A frame stores its first value in
+// full and the gaps to the values after it bit-packed at the width of its
+// widest gap, so that a frame decodes on its own, a value is found by a binary
+// search over the first values of the frames and one frame decode, and a
+// change to one frame is spliced into a copy of the others without decoding
+// them.
+//
+// A block is laid out as
+//   uint32_t frames
+//   uint32_t offsets[frames]  byte offset of each frame in the block
+//   each frame:
+//     uint64_t first          the first value, sign-extended
+//     uint8_t width           bits per gap, 0 to 32, or 64 for whole words
+//     uint8_t count - 1       values in the frame, less one
+//     gaps                    (count - 1) * width bits, least significant
+//                             bit first
+//   kPadding bytes, so that any gap is read with one 8-byte load.
+//
+// Where values are 32 bits wide, gaps are summed into values four at a time
+// with SSE2.
+template <typename V>
+class radix_packed {
+  static_assert(std::is_integral<V>::value, "only integers are packed");
+
+ public:
+  static constexpr size_t kFrame = 128;
+
+  // Bytes of the block of values[0, size).
+  static size_t encoded_bytes(const V* values, size_t size) {
+    return table_bytes(pieces(size)) + frames_bytes(values, size) + kPadding;
+  }
+
+  // Write the block of values[0, size), encoded_bytes() long, to "block".
+  static void encode(const V* values, size_t size, unsigned char* block) {
+    size_t frames = pieces(size);
+    store32(block, frames);
+    unsigned char* end =
+        write_frames(values, size, block, 0, block + table_bytes(frames));
+    memset(end, 0, kPadding);
+  }
+
+  static size_t frames(const unsigned char* block) { return load32(block); }
+
+  // Decode the frame "frame" into "out", and return the number of values in
+  // it.
+  static size_t decode(const unsigned char* block, size_t frame, V* out) {
+    const unsigned char* in = block + offset(block, frame);
+    uint64_t first;
+    memcpy(&first, in, sizeof(first));
+    unsigned bits = in[sizeof(first)];
+    size_t count = in[sizeof(first) + 1] + size_t(1);
+    in += kHeader;
+    out[0] = static_cast<V>(first);
+    if (bits == 64) {
+      uint64_t value = first;
+      for (size_t i = 1; i < count; ++i) {
+        uint64_t gap;
+        memcpy(&gap, in + (i - 1) * sizeof(gap), sizeof(gap));
+        value += gap;
+        out[i] = static_cast<V>(value);
+      }
+      return count;
+    }
+    uint32_t gaps[kFrame];
+    uint64_t mask = (uint64_t(1) << bits) - 1;
+    for (size_t i = 0; i + 1 < count; ++i) {
+      size_t bit = i * bits;
+      uint64_t window;
+      memcpy(&window, in + bit / 8, sizeof(window));
+      gaps[i] = static_cast<uint32_t>((window >> (bit % 8)) & mask);
+    }
+    prefix_sum(first, gaps, count - 1, out);
+    return count;
+  }
+
+  // Call "f" on each value, in order.
+  template <typename F>
+  static void for_each(const unsigned char* block, F& f) {
+    V values[kFrame];
+    size_t frames = radix_packed::frames(block);
+    for (size_t frame = 0; frame < frames; ++frame) {
+      size_t count = decode(block, frame, values);
+      for (size_t i = 0; i < count; ++i) {
+        f(values[i]);
+      }
+    }
+  }
+
+  // The frame that holds "value" if any does, or would take it: the last
+  // one that does not start after it, or the first.
+  static size_t locate(const unsigned char* block, V value) {
+    size_t low = 0;
+    size_t high = frames(block);
+    while (high - low > 1) {
+      size_t mid = (low + high) / 2;
+      if (value < first(block, mid)) {
+        high = mid;
+      } else {
+        low = mid;
+      }
+    }
+    return low;
+  }
+
+  static bool contains(const unsigned char* block, V value) {
+    size_t frame = locate(block, value);
+    if (value < first(block, frame)) {
+      return false;
+    }
+    V values[kFrame];
+    size_t count = decode(block, frame, values);
+    return std::binary_search(values, values + count, value);
+  }
+
+  // Bytes of the block "block", "bytes" long, with the frame "frame" replaced
+  // by values[0, count), which take as few frames as hold them, or none.
+  static size_t spliced_bytes(const unsigned char* block,
+                              size_t bytes,
+                              size_t frame,
+                              const V* values,
+                              size_t count) {
+    size_t frames = radix_packed::frames(block);
+    return bytes - table_bytes(frames) - frame_bytes(block, bytes, frame) +
+           table_bytes(frames - 1 + pieces(count)) +
+           frames_bytes(values, count);
+  }
+
+  // Write that block, spliced_bytes() long, to "out".
+  static void splice(const unsigned char* block,
+                     size_t bytes,
+                     size_t frame,
+                     const V* values,
+                     size_t count,
+                     unsigned char* out) {
+    size_t frames = radix_packed::frames(block);
+    size_t added = pieces(count);
+    store32(out, frames - 1 + added);
+    unsigned char* end = out + table_bytes(frames - 1 + added);
+    end = copy_frames(block, bytes, 0, frame, out, 0, end);
+    end = write_frames(values, count, out, frame, end);
+    end = copy_frames(block, bytes, frame + 1, frames, out, frame + added, end);
+    memset(end, 0, kPadding);
+  }
+
+ private:
+  static const size_t kHeader = sizeof(uint64_t) + 2;
+  static const size_t kPadding = sizeof(uint64_t);
+
+  static uint32_t load32(const unsigned char* in) {
+    uint32_t value;
+    memcpy(&value, in, sizeof(value));
+    return value;
+  }
+  static void store32(unsigned char* out, size_t value) {
+    uint32_t word = static_cast<uint32_t>(value);
+    memcpy(out, &word, sizeof(word));
+  }
+
+  static size_t table_bytes(size_t frames) {
+    return (1 + frames) * sizeof(uint32_t);
+  }
+  static size_t offset(const unsigned char* block, size_t frame) {
+    return load32(block + (1 + frame) * sizeof(uint32_t));
+  }
+  static void set_offset(unsigned char* block, size_t frame, size_t offset) {
+    store32(block + (1 + frame) * sizeof(uint32_t), offset);
+  }
+  static size_t frame_bytes(const unsigned char* block,
+                            size_t bytes,
+                            size_t frame) {
+    size_t end = frame + 1 < frames(block) ? offset(block, frame + 1)
+                                           : bytes - kPadding;
+    return end - offset(block, frame);
+  }
+
+  // Frames for "count" values; frame "piece" of them takes the values
+  // [piece_begin(piece), piece_begin(piece + 1)).
+  static size_t pieces(size_t count) { return (count + kFrame - 1) / kFrame; }
+  static size_t piece_begin(size_t piece, size_t count) {
+    return piece * count / pieces(count);
+  }
+
+  // The value as a 64-bit word, in which the gap between two ascending values
+  // is their difference.
+  static uint64_t word(V value) { return static_cast<uint64_t>(value); }
+
+  static unsigned width(const V* values, size_t count) {
+    uint64_t widest = 0;
+    for (size_t i = 1; i < count; ++i) {
+      widest = std::max(widest, word(values[i]) - word(values[i - 1]));
+    }
+    unsigned bits = widest == 0 ? 0 : 64 - __builtin_clzll(widest);
+    return bits <= 32 ? bits : 64;
+  }
+
+  static size_t gap_bytes(size_t count, unsigned bits) {
+    return ((count - 1) * bits + 7) / 8;
+  }
+
+  static size_t frames_bytes(const V* values, size_t count) {
+    size_t bytes = 0;
+    for (size_t piece = 0; piece < pieces(count); ++piece) {
+      size_t begin = piece_begin(piece, count);
+      size_t size = piece_begin(piece + 1, count) - begin;
+      bytes += kHeader + gap_bytes(size, width(values + begin, size));
+    }
+    return bytes;
+  }
+
+  // Write the frames of values[0, count) at "out", as the frames from
+  // "frame" on of "block", and return the end of the last.
+  static unsigned char* write_frames(const V* values,
+                                     size_t count,
+                                     unsigned char* block,
+                                     size_t frame,
+                                     unsigned char* out) {
+    for (size_t piece = 0; piece < pieces(count); ++piece) {
+      size_t begin = piece_begin(piece, count);
+      set_offset(block, frame + piece, out - block);
+      out = write_frame(values + begin, piece_begin(piece + 1, count) - begin,
+                        out);
+    }
+    return out;
+  }
+
+  static unsigned char* write_frame(const V* values,
+                                    size_t count,
+                                    unsigned char* out) {
+    unsigned bits = width(values, count);
+    uint64_t first = word(values[0]);
+    memcpy(out, &first, sizeof(first));
+    out[sizeof(first)] = static_cast<unsigned char>(bits);
+    out[sizeof(first) + 1] = static_cast<unsigned char>(count - 1);
+    out += kHeader;
+    size_t bytes = gap_bytes(count, bits);
+    memset(out, 0, bytes);
+    for (size_t i = 1; i < count; ++i) {
+      uint64_t gap = word(values[i]) - word(values[i - 1]);
+      if (bits == 64) {
+        memcpy(out + (i - 1) * sizeof(gap), &gap, sizeof(gap));
+        continue;
+      }
+      // A gap of up to 32 bits at any bit offset spans at most 5 bytes.
+      size_t bit = (i - 1) * bits;
+      size_t byte = bit / 8;
+      for (uint64_t shifted = gap << (bit % 8); shifted != 0; shifted >>= 8) {
+        out[byte++] |= static_cast<unsigned char>(shifted);
+      }
+    }
+    return out + bytes;
+  }
+
+  // Copy the frames [begin, end) of "from", "bytes" long, to "out", as the
+  // frames from "frame" on of "block", and return the end of the last.
+  static unsigned char* copy_frames(const unsigned char* from,
+                                    size_t bytes,
+                                    size_t begin,
+                                    size_t end,
+                                    unsigned char* block,
+                                    size_t frame,
+                                    unsigned char* out) {
+    if (begin == end) {
+      return out;
+    }
+    size_t first = offset(from, begin);
+    size_t last = offset(from, end - 1) + frame_bytes(from, bytes, end - 1);
+    for (size_t i = begin; i < end; ++i) {
+      set_offset(block, frame + i - begin,
+                 out - block + offset(from, i) - first);
+    }
+    memcpy(out, from + first, last - first);
+    return out + (last - first);
+  }
+
+  static V first(const unsigned char* block, size_t frame) {
+    uint64_t value;
+    memcpy(&value, block + offset(block, frame), sizeof(value));
+    return static_cast<V>(value);
+  }
+
+  // out[i + 1] = first + gaps[0] + ... + gaps[i] for i < count.
+  static void prefix_sum(uint64_t first,
+                         const uint32_t* gaps,
+                         size_t count,
+                         V* out) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    if (sizeof(V) == sizeof(uint32_t)) {
+      __m128i carry = _mm_set1_epi32(static_cast<int>(first));
+      for (; i + 4 <= count; i += 4) {
+        __m128i x =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(gaps + i));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, carry);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 1 + i), x);
+        carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+      }
+    }
+#endif
+    uint64_t value = word(out[i]);
+    for (; i < count; ++i) {
+      value += gaps[i];
+      out[i + 1] = static_cast<V>(value);
+    }
+  }
+};
+
+}  // namespace radix
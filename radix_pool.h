@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace radix {
+
+// Small work-stealing thread pool. Each thread owns a deque: tasks submitted
+// from inside a task go to the submitter's deque and are taken LIFO by their
+// owner, while idle threads steal FIFO from the others. The thread calling
+// wait() works as one of the "threads".
+class radix_thread_pool {
+ public:
+  explicit radix_thread_pool(int threads) {
+    if (threads < 1) {
+      threads = 1;
+    }
+    for (int i = 0; i < threads; ++i) {
+      m_queues.emplace_back(new queue());
+    }
+    for (int i = 1; i < threads; ++i) {
+      m_workers.emplace_back([this, i] { work(i); });
+    }
+  }
+
+  ~radix_thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_wake.notify_all();
+    for (std::thread& worker : m_workers) {
+      worker.join();
+    }
+  }
+
+  int size() const { return static_cast<int>(m_queues.size()); }
+
+  void submit(std::function<void()> task) {
+    size_t index;
+    if (current().pool == this) {
+      index = current().index;
+    } else {
+      index = m_next.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+    }
+    m_pending.fetch_add(1, std::memory_order_relaxed);
+    m_queued.fetch_add(1, std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+      m_queues[index]->tasks.push_back(std::move(task));
+    }
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    m_wake.notify_all();
+  }
+
+  // Run tasks on the calling thread as well until every submitted task,
+  // including the ones submitted meanwhile, has finished.
+  void wait() {
+    context saved = current();
+    current() = {this, 0};
+    std::function<void()> task;
+    while (m_pending.load(std::memory_order_acquire) > 0) {
+      if (pop(0, task)) {
+        run(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [this] {
+        return m_pending.load(std::memory_order_acquire) == 0 ||
+               m_queued.load(std::memory_order_acquire) > 0;
+      });
+    }
+    current() = saved;
+  }
+
+ private:
+  struct queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  struct context {
+    radix_thread_pool* pool;
+    size_t index;
+  };
+
+  static context& current() {
+    static thread_local context ctx = {nullptr, 0};
+    return ctx;
+  }
+
+  bool pop(size_t self, std::function<void()>& task) {
+    if (m_queued.load(std::memory_order_acquire) == 0) {
+      return false;
+    }
+    for (size_t i = 0; i < m_queues.size(); ++i) {
+      size_t index = (self + i) % m_queues.size();
+      queue& q = *m_queues[index];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (q.tasks.empty()) {
+        continue;
+      }
+      if (index == self) {
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+      } else {
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+      }
+      m_queued.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+    return false;
+  }
+
+  void run(std::function<void()>& task) {
+    task();
+    task = nullptr;
+    if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+      }
+      m_wake.notify_all();
+    }
+  }
+
+  void work(size_t self) {
+    current() = {this, self};
+    std::function<void()> task;
+    while (true) {
+      if (pop(self, task)) {
+        run(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_wake.wait(lock, [this] {
+        return m_stop || m_queued.load(std::memory_order_acquire) > 0;
+      });
+      if (m_stop) {
+        return;
+      }
+    }
+  }
+
+  radix_thread_pool(const radix_thread_pool&);             // delete
+  radix_thread_pool& operator=(const radix_thread_pool&);  // delete
+
+  std::vector<std::unique_ptr<queue>> m_queues;
+  std::vector<std::thread> m_workers;
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::atomic<size_t> m_pending{0};
+  std::atomic<size_t> m_queued{0};
+  std::atomic<size_t> m_next{0};
+  bool m_stop = false;
+};
+
+}  // namespace radix
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace radix {
+
+// The "recall_limit" distinct values with the highest scores among those
+// offered, each ranked by the best score it was offered with, ties going to
+// the smaller value. Values and scores are kept in two parallel arrays.
+//
+// Offers are appended if they score at least the cutoff, without a branch, and
+// the buffer is cut down to the best "recall_limit" once it holds twice that
+// many, which raises the cutoff to the score of the last one kept.
+template <typename V>
+class radix_top_scores {
+ public:
+  radix_top_scores(int recall_limit, float min_score)
+      : m_limit(recall_limit > 0 ? recall_limit : 0),
+        m_buffer(2 * m_limit > kMinBuffer ? 2 * m_limit : kMinBuffer),
+        m_cutoff(min_score) {}
+
+  float cutoff() const { return m_cutoff; }
+
+  // Offer values[0, size), with scores[0, size), or a score of 0 each if
+  // "scores" is null.
+  void add(const V* values, const float* scores, size_t size) {
+    if (m_limit == 0) {
+      return;
+    }
+    if (scores == nullptr) {
+      if (0 < m_cutoff) {
+        return;
+      }
+      m_ids.insert(m_ids.end(), values, values + size);
+      m_scores.insert(m_scores.end(), size, 0.0f);
+    } else {
+      size_t n = m_ids.size();
+      m_ids.resize(n + size);
+      m_scores.resize(n + size);
+      V* ids = m_ids.data();
+      float* kept = m_scores.data();
+      for (size_t i = 0; i < size; ++i) {
+        ids[n] = values[i];
+        kept[n] = scores[i];
+        n += scores[i] >= m_cutoff;
+      }
+      m_ids.resize(n);
+      m_scores.resize(n);
+    }
+    if (m_ids.size() > m_buffer) {
+      compact();
+    }
+  }
+
+  // Append the values, best first, to "*values", and their scores to
+  // "*scores" unless it is null.
+  void finish(std::vector<V>* values, std::vector<float>* scores) {
+    compact();
+    std::sort(m_order.begin(), m_order.end(), ranks_before(this));
+    for (uint32_t i : m_order) {
+      values->push_back(m_ids[i]);
+      if (scores != nullptr) {
+        scores->push_back(m_scores[i]);
+      }
+    }
+    m_ids.clear();
+    m_scores.clear();
+    m_order.clear();
+  }
+
+ private:
+  static const size_t kMinBuffer = 64;
+
+  // Higher score first, then smaller value.
+  struct ranks_before {
+    explicit ranks_before(const radix_top_scores* top) : top(top) {}
+    bool operator()(uint32_t a, uint32_t b) const {
+      float sa = top->m_scores[a];
+      float sb = top->m_scores[b];
+      return sa > sb || (sa == sb && top->m_ids[a] < top->m_ids[b]);
+    }
+    const radix_top_scores* top;
+  };
+
+  // Keep the best offer of each value, then the best "m_limit" of those,
+  // leaving their indices in m_order.
+  void compact() {
+    m_order.resize(m_ids.size());
+    for (uint32_t i = 0; i < m_order.size(); ++i) {
+      m_order[i] = i;
+    }
+    const V* ids = m_ids.data();
+    const float* scores = m_scores.data();
+    std::sort(m_order.begin(), m_order.end(), [ids, scores](uint32_t a,
+                                                            uint32_t b) {
+      return ids[a] < ids[b] || (ids[a] == ids[b] && scores[a] > scores[b]);
+    });
+    m_order.erase(std::unique(m_order.begin(), m_order.end(),
+                              [ids](uint32_t a, uint32_t b) {
+                                return ids[a] == ids[b];
+                              }),
+                  m_order.end());
+    if (m_order.size() > m_limit) {
+      std::nth_element(m_order.begin(), m_order.begin() + m_limit - 1,
+                       m_order.end(), ranks_before(this));
+      m_order.resize(m_limit);
+    }
+    if (m_order.size() == m_limit) {
+      float last = std::numeric_limits<float>::infinity();
+      for (uint32_t i : m_order) {
+        last = std::min(last, scores[i]);
+      }
+      m_cutoff = std::max(m_cutoff, last);
+    }
+
+    std::vector<V> kept_ids;
+    std::vector<float> kept_scores;
+    kept_ids.reserve(m_buffer + kMinBuffer);
+    kept_scores.reserve(m_buffer + kMinBuffer);
+    for (uint32_t& i : m_order) {
+      kept_ids.push_back(ids[i]);
+      kept_scores.push_back(scores[i]);
+      i = kept_ids.size() - 1;
+    }
+    m_ids.swap(kept_ids);
+    m_scores.swap(kept_scores);
+  }
+
+  size_t m_limit;
+  size_t m_buffer;
+  float m_cutoff;
+  std::vector<V> m_ids;
+  std::vector<float> m_scores;
+  std::vector<uint32_t> m_order;
+};
+
+}  // namespace radix
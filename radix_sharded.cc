@@ -0,0 +1,122 @@
+#include "radix_sharded.h"
+
+#include <cstring>
+#include <thread>
+
+#include "radix_utf8.h"
+
+namespace radix {
+
+template <typename V>
+radix_sharded_tree<V>::radix_sharded_tree(int shards,
+                                          int threads,
+                                          size_t prefix_len,
+                                          radix_chunk_allocator* chunks)
+    : m_prefix_len(std::max<size_t>(1, prefix_len)),
+      m_pool(threads > 0
+                 ? threads
+                 : static_cast<int>(std::thread::hardware_concurrency())) {
+  for (int i = 0; i < std::max(1, shards); ++i) {
+    m_shards.emplace_back(new radix_tree<V>(chunks));
+  }
+}
+
+template <typename V>
+typename radix_sharded_tree<V>::size_type radix_sharded_tree<V>::size() const {
+  size_type size = 0;
+  for (const std::unique_ptr<radix_tree<V>>& shard : m_shards) {
+    size += shard->size();
+  }
+  return size;
+}
+
+template <typename V>
+void radix_sharded_tree<V>::clear() {
+  for_each_shard([this](int index) { m_shards[index]->clear(); });
+}
+
+template <typename V>
+void radix_sharded_tree<V>::set_value_domain(size_t domain) {
+  m_value_domain = domain;
+  for (const std::unique_ptr<radix_tree<V>>& shard : m_shards) {
+    shard->set_value_domain(domain);
+  }
+}
+
+template <typename V>
+int radix_sharded_tree<V>::hash_prefix(const std::string& pattern,
+                                       bool* complete) const {
+  // The tree ignores everything from the first NUL on.
+  size_t len = strnlen(pattern.data(), pattern.size());
+  size_t end = 0;
+  size_t uchars = 0;
+  while (end < len && uchars < m_prefix_len) {
+    end += std::max<size_t>(1, radix_utf8_length(pattern[end]));
+    ++uchars;
+  }
+  *complete = uchars == m_prefix_len;
+
+  // FNV-1a.
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < std::min(end, len); ++i) {
+    hash = (hash ^ static_cast<unsigned char>(pattern[i])) * 1099511628211ull;
+  }
+  return static_cast<int>(hash % m_shards.size());
+}
+
+template <typename V>
+int radix_sharded_tree<V>::home_shard(const std::string& pattern) const {
+  bool complete;
+  return hash_prefix(pattern, &complete);
+}
+
+template <typename V>
+int radix_sharded_tree<V>::shard_of(const std::string& pattern) const {
+  bool complete;
+  int index = hash_prefix(pattern, &complete);
+  return complete ? index : -1;
+}
+
+template <typename V>
+void radix_sharded_tree<V>::insert(const std::string& pattern, V value) {
+  m_shards[home_shard(pattern)]->insert(pattern, value);
+}
+
+template <typename V>
+typename radix_sharded_tree<V>::size_type radix_sharded_tree<V>::erase(
+    const std::string& pattern) {
+  return m_shards[home_shard(pattern)]->erase(pattern);
+}
+
+template <typename V>
+typename radix_sharded_tree<V>::size_type radix_sharded_tree<V>::erase(
+    const std::string& pattern,
+    V value) {
+  return m_shards[home_shard(pattern)]->erase(pattern, value);
+}
+
+template <typename V>
+void radix_sharded_tree<V>::match(const std::string& key,
+                                  std::vector<V>& vec) const {
+  int index = shard_of(key);
+  if (index >= 0) {
+    m_shards[index]->match(key, vec);
+    return;
+  }
+  for (const std::unique_ptr<radix_tree<V>>& shard : m_shards) {
+    shard->match(key, vec);
+  }
+}
+
+template <typename V>
+void radix_sharded_tree<V>::for_each_shard(
+    const std::function<void(int)>& op) {
+  for (int index = 0; index < shard_count(); ++index) {
+    m_pool.submit([&op, index] { op(index); });
+  }
+  m_pool.wait();
+}
+
+template class radix_sharded_tree<int>;
+
+}  // namespace radix
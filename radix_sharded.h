@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "radix.h"
+#include "radix_pool.h"
+
+namespace radix {
+
+// A set of independent radix_trees, the shards, that patterns are spread
+// over by a hash of their first "prefix_len" code points. Each shard has its
+// own arenas and leaf chain, so batch inserts, finish() and clear() work on
+// all shards in parallel without locking.
+//
+// A key of at least "prefix_len" code points can only be a prefix of
+// patterns in one shard, and match() only searches that one. Shorter keys
+// search every shard and merge the results.
+//
+// Like radix_tree, a radix_sharded_tree is not safe for concurrent use; the
+// parallelism is inside its batch operations.
+template <typename V>
+class radix_sharded_tree {
+ public:
+  typedef typename radix_tree<V>::size_type size_type;
+
+  // "threads" 0 uses one thread per hardware thread. The shards allocate
+  // from "chunks" concurrently.
+  explicit radix_sharded_tree(int shards,
+                              int threads = 0,
+                              size_t prefix_len = 1,
+                              radix_chunk_allocator* chunks = nullptr);
+
+  size_type size() const;
+  bool empty() const { return size() == 0; }
+  void clear();
+  // As radix_tree::set_value_domain(), for every shard and for merging their
+  // lists.
+  void set_value_domain(size_t domain);
+
+  int shard_count() const { return static_cast<int>(m_shards.size()); }
+  const radix_tree<V>& shard(int index) const { return *m_shards[index]; }
+  // The shard "pattern" belongs to, or -1 if it is shorter than the shard
+  // prefix and may match patterns in any shard.
+  int shard_of(const std::string& pattern) const;
+
+  void insert(const std::string& pattern, V value);
+  // Insert a range of (pattern, value) pairs, every shard on its own thread.
+  // Pairs that land in one shard are inserted in range order.
+  template <typename Iterator>
+  void insert(Iterator first, Iterator last);
+  size_type erase(const std::string& pattern);
+  size_type erase(const std::string& pattern, V value);
+
+  // Run finish() on every shard in parallel; "compfunc" is called
+  // concurrently.
+  template <typename Compare>
+  void finish(Compare compfunc, int recall_limit);
+
+  // As radix_tree::match(). The values of a key shorter than the shard
+  // prefix come shard by shard, each in pattern order.
+  void match(const std::string& key, std::vector<V>& vec) const;
+  template <typename Compare>
+  void match(const std::string& key,
+             std::vector<V>& vec,
+             Compare compfunc,
+             int recall_limit) const;
+
+ private:
+  radix_sharded_tree(const radix_sharded_tree&);             // delete
+  radix_sharded_tree& operator=(const radix_sharded_tree&);  // delete
+
+  // The shard of a pattern that is shorter than the shard prefix, which is
+  // hashed whole.
+  int home_shard(const std::string& pattern) const;
+  // Hash the first "m_prefix_len" code points of "pattern", or all of it.
+  // "*complete" tells whether there were that many.
+  int hash_prefix(const std::string& pattern, bool* complete) const;
+  // Run "op(shard index)" for every shard on the pool and wait for all.
+  void for_each_shard(const std::function<void(int)>& op);
+
+  size_t m_prefix_len;
+  size_t m_value_domain = 0;
+  std::vector<std::unique_ptr<radix_tree<V>>> m_shards;
+  radix_thread_pool m_pool;
+};
+
+template <typename V>
+template <typename Iterator>
+void radix_sharded_tree<V>::insert(Iterator first, Iterator last) {
+  std::vector<std::vector<Iterator>> buckets(m_shards.size());
+  for (; first != last; ++first) {
+    buckets[home_shard(first->first)].push_back(first);
+  }
+  for_each_shard([&](int index) {
+    for (const Iterator& item : buckets[index]) {
+      m_shards[index]->insert(item->first, item->second);
+    }
+  });
+}
+
+template <typename V>
+template <typename Compare>
+void radix_sharded_tree<V>::finish(Compare compfunc, int recall_limit) {
+  for_each_shard([&](int index) {
+    m_shards[index]->finish(compfunc, recall_limit);
+  });
+}
+
+template <typename V>
+template <typename Compare>
+void radix_sharded_tree<V>::match(const std::string& key,
+                                  std::vector<V>& vec,
+                                  Compare compfunc,
+                                  int recall_limit) const {
+  int index = shard_of(key);
+  if (index >= 0) {
+    m_shards[index]->match(key, vec, compfunc, recall_limit);
+    return;
+  }
+  // The merged list is the top-k of the shards' top-k lists, which are all
+  // collected before the set that merges them is made, so that the sets of
+  // the shards' queries are not nested in it.
+  std::vector<std::vector<V>> tops(m_shards.size());
+  for (size_t index = 0; index < m_shards.size(); ++index) {
+    m_shards[index]->match(key, tops[index], compfunc, recall_limit);
+  }
+  radix_seen<V> item_set(m_value_domain);
+  for (const std::vector<V>& top : tops) {
+    for (const V& item : top) {
+      if (item_set.insert(item)) {
+        radix_tree<V>::heap_insert(&vec, item, compfunc, recall_limit);
+      }
+    }
+  }
+  std::sort_heap(vec.begin(), vec.end(), compfunc);
+}
+
+extern template class radix_sharded_tree<int>;
+
+}  // namespace radix
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace radix {
+
+// Bytes held by a radix_tree, by category.
+struct radix_memory_stats {
+  size_t node_bytes = 0;      // nodes and their child tables
+  size_t key_bytes = 0;       // key bytes too long to hold in the nodes
+  size_t value_bytes = 0;     // values stored at the leaves
+  size_t heap_bytes = 0;      // top-k lists built by finish()
+  size_t reserved_bytes = 0;  // chunks obtained from the chunk allocator
+};
+
+// Shape of a radix_tree. The root is at depth 0; a pattern's depth is that of
+// the node its key ends at.
+struct radix_tree_stats {
+  size_t inner_nodes = 0;  // nodes other than leaves, the root included
+  size_t leaves = 0;       // one per distinct pattern
+  size_t values = 0;       // values stored at the leaves
+  size_t heap_nodes = 0;   // inner nodes with a top-k list
+  size_t heap_values = 0;  // values held by the top-k lists
+  size_t max_depth = 0;
+  // depth[d]: patterns at depth d.
+  std::vector<size_t> depth;
+  // fanout[0]: inner nodes without children; fanout[b]: inner nodes with
+  // 2^(b-1) to 2^b - 1 children.
+  std::vector<size_t> fanout;
+  radix_memory_stats memory;
+};
+
+// Query counters of a radix_tree. They are only kept if the library is
+// compiled with RADIX_ENABLE_COUNTERS, and read as zero otherwise.
+struct radix_query_stats {
+  static const int kLatencyBuckets = 32;
+
+  uint64_t lookups = 0;         // keys looked up by match() and match_batch()
+  uint64_t misses = 0;          // lookups no pattern starts with
+  uint64_t heap_hits = 0;       // top-k lookups answered by a top-k list
+  uint64_t scans = 0;           // lookups that walked the leaf chain
+  uint64_t leaves_scanned = 0;  // leaves those walks went through
+  uint64_t dedup_values = 0;    // distinct values the top-k walks saw
+  uint64_t max_dedup = 0;       // most distinct values seen by one walk
+  // latency[b]: vector match() calls that took 2^b to 2^(b+1) - 1 ns; the
+  // last bucket takes everything slower.
+  uint64_t latency[kLatencyBuckets] = {};
+};
+
+// State of the result cache of a radix_tree; see
+// radix_tree::set_cache_capacity().
+struct radix_cache_stats {
+  uint64_t hits = 0;           // top-k lookups answered from the cache
+  uint64_t misses = 0;         // cacheable lookups that had to scan
+  uint64_t evictions = 0;      // lists dropped to make room
+  uint64_t invalidations = 0;  // lists dropped by insert() or erase()
+  size_t entries = 0;
+  size_t bytes = 0;
+  size_t capacity = 0;
+};
+
+// State of the lazily built top-k lists of a radix_tree; see
+// radix_tree::finish_adaptive().
+struct radix_adaptive_stats {
+  uint64_t builds = 0;     // lists built for prefixes that earned one
+  uint64_t evictions = 0;  // lists dropped to stay within the budget
+  size_t lists = 0;
+  size_t max_lists = 0;  // the budget, in lists of full length
+  size_t tracked = 0;    // prefixes whose queries are being counted
+};
+
+#ifdef RADIX_ENABLE_COUNTERS
+#define RADIX_COUNT(expr) (expr)
+#else
+#define RADIX_COUNT(expr) ((void)0)
+#endif
+
+// The live counters behind radix_query_stats. Updated with relaxed atomics,
+// so concurrent readers of one tree may count into it.
+class radix_query_counters {
+ public:
+  radix_query_counters() = default;
+
+  void lookup(bool hit) {
+    add(&m_lookups, 1);
+    if (!hit) {
+      add(&m_misses, 1);
+    }
+  }
+
+  void heap_hit() { add(&m_heap_hits, 1); }
+
+  void scan(uint64_t leaves) {
+    add(&m_scans, 1);
+    add(&m_leaves_scanned, leaves);
+  }
+
+  void dedup(uint64_t values) {
+    add(&m_dedup_values, values);
+    uint64_t max = m_max_dedup.load(std::memory_order_relaxed);
+    while (max < values && !m_max_dedup.compare_exchange_weak(
+                               max, values, std::memory_order_relaxed)) {
+    }
+  }
+
+  void latency(uint64_t ns) {
+    int bucket = 0;
+    while (bucket + 1 < radix_query_stats::kLatencyBuckets &&
+           (ns >> (bucket + 1)) != 0) {
+      ++bucket;
+    }
+    add(&m_latency[bucket], 1);
+  }
+
+  radix_query_stats snapshot() const {
+    radix_query_stats stats;
+    stats.lookups = m_lookups.load(std::memory_order_relaxed);
+    stats.misses = m_misses.load(std::memory_order_relaxed);
+    stats.heap_hits = m_heap_hits.load(std::memory_order_relaxed);
+    stats.scans = m_scans.load(std::memory_order_relaxed);
+    stats.leaves_scanned = m_leaves_scanned.load(std::memory_order_relaxed);
+    stats.dedup_values = m_dedup_values.load(std::memory_order_relaxed);
+    stats.max_dedup = m_max_dedup.load(std::memory_order_relaxed);
+    for (int i = 0; i < radix_query_stats::kLatencyBuckets; ++i) {
+      stats.latency[i] = m_latency[i].load(std::memory_order_relaxed);
+    }
+    return stats;
+  }
+
+  void reset() {
+    for (std::atomic<uint64_t>* counter :
+         {&m_lookups, &m_misses, &m_heap_hits, &m_scans, &m_leaves_scanned,
+          &m_dedup_values, &m_max_dedup}) {
+      counter->store(0, std::memory_order_relaxed);
+    }
+    for (std::atomic<uint64_t>& counter : m_latency) {
+      counter.store(0, std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  radix_query_counters(const radix_query_counters&);             // delete
+  radix_query_counters& operator=(const radix_query_counters&);  // delete
+
+  static void add(std::atomic<uint64_t>* counter, uint64_t n) {
+    counter->fetch_add(n, std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> m_lookups{0};
+  std::atomic<uint64_t> m_misses{0};
+  std::atomic<uint64_t> m_heap_hits{0};
+  std::atomic<uint64_t> m_scans{0};
+  std::atomic<uint64_t> m_leaves_scanned{0};
+  std::atomic<uint64_t> m_dedup_values{0};
+  std::atomic<uint64_t> m_max_dedup{0};
+  std::atomic<uint64_t> m_latency[radix_query_stats::kLatencyBuckets] = {};
+};
+
+// Adds the time from construction to destruction to a latency histogram.
+class radix_latency_timer {
+ public:
+  explicit radix_latency_timer(radix_query_counters* counters)
+      : m_counters(counters), m_begin(std::chrono::steady_clock::now()) {}
+  ~radix_latency_timer() {
+    m_counters->latency(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - m_begin)
+                            .count());
+  }
+
+ private:
+  radix_latency_timer(const radix_latency_timer&);             // delete
+  radix_latency_timer& operator=(const radix_latency_timer&);  // delete
+
+  radix_query_counters* m_counters;
+  std::chrono::steady_clock::time_point m_begin;
+};
+
+}  // namespace radix
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace radix {
+
+// Length in bytes of the code point that starts with "lead", measured the way
+// radix_tree::UTF8Decode does, or 0 if "lead" cannot start a code point.
+inline size_t radix_utf8_length(char lead) {
+  unsigned c = static_cast<unsigned char>(lead);
+  if (c < 0x80) {
+    return 1;
+  }
+  if (c < 0xC0) {
+    return 0;
+  }
+  size_t ones = __builtin_clz(~(c << 24));
+  return ones < 7 ? ones : 7;
+}
+
+// Return true iff "c" continues a multi-byte code point. In a string that
+// UTF8Decode accepts, code points start exactly at the other bytes.
+inline bool radix_utf8_continuation(char c) {
+  return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+}
+
+// Return the length of the common prefix of a[0, n) and b[0, n). Runs of
+// equal bytes, typically ASCII, are compared a vector at a time.
+inline size_t radix_mismatch(const char* a, const char* b, size_t n) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 32 <= n; i += 32) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    unsigned mask = ~static_cast<unsigned>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  for (; i + 16 <= n; i += 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) ^ 0xFFFFu;
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+  while (i < n && a[i] == b[i]) {
+    ++i;
+  }
+  return i;
+}
+
+}  // namespace radix
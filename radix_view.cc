@@ -0,0 +1,242 @@
+#include "radix_view.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+#include "radix.h"
+
+namespace radix {
+
+template <typename V>
+radix_tree_view<V>::radix_tree_view()
+    : m_map(nullptr),
+      m_map_size(0),
+      m_header(nullptr),
+      m_nodes(nullptr),
+      m_child_keys(nullptr),
+      m_child_nodes(nullptr),
+      m_leaves(nullptr),
+      m_values(nullptr),
+      m_heap_values(nullptr),
+      m_keys(nullptr),
+      m_value_domain(0) {
+  static_assert(std::is_trivially_copyable<V>::value,
+                "radix_tree_view needs trivially copyable values");
+}
+
+template <typename V>
+radix_tree_view<V>::~radix_tree_view() {
+  close();
+}
+
+template <typename V>
+bool radix_tree_view<V>::open(const std::string& path) {
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  void* map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  if (!attach(static_cast<const char*>(map), st.st_size)) {
+    munmap(map, st.st_size);
+    return false;
+  }
+  m_map = map;
+  m_map_size = st.st_size;
+  return true;
+}
+
+template <typename V>
+bool radix_tree_view<V>::attach(const char* data, size_t size) {
+  close();
+  if (size < sizeof(radix_image_header) ||
+      reinterpret_cast<uintptr_t>(data) % kImageAlignment != 0) {
+    return false;
+  }
+  const radix_image_header* header =
+      reinterpret_cast<const radix_image_header*>(data);
+  if (memcmp(header->magic, "RADIXIMG", sizeof(header->magic)) != 0 ||
+      header->version != kImageVersion || header->value_size != sizeof(V) ||
+      header->size != size || header->node_count == 0) {
+    return false;
+  }
+  struct {
+    uint64_t offset;
+    uint64_t bytes;
+  } sections[] = {
+      {header->nodes, header->node_count * sizeof(radix_image_node)},
+      {header->child_keys, header->child_count * sizeof(uint64_t)},
+      {header->child_nodes, header->child_count * sizeof(uint32_t)},
+      {header->leaves, header->leaf_count * sizeof(radix_image_leaf)},
+      {header->values, header->value_count * sizeof(V)},
+      {header->heap_values, header->heap_value_count * sizeof(V)},
+      {header->keys, header->key_bytes},
+  };
+  for (const auto& section : sections) {
+    if (section.offset % kImageAlignment != 0 || section.offset > size ||
+        section.bytes > size - section.offset) {
+      return false;
+    }
+  }
+
+  m_header = header;
+  m_nodes = reinterpret_cast<const radix_image_node*>(data + header->nodes);
+  m_child_keys = reinterpret_cast<const uint64_t*>(data + header->child_keys);
+  m_child_nodes = reinterpret_cast<const uint32_t*>(data + header->child_nodes);
+  m_leaves = reinterpret_cast<const radix_image_leaf*>(data + header->leaves);
+  m_values = reinterpret_cast<const V*>(data + header->values);
+  m_heap_values = reinterpret_cast<const V*>(data + header->heap_values);
+  m_keys = data + header->keys;
+  return true;
+}
+
+template <typename V>
+void radix_tree_view<V>::close() {
+  if (m_map != nullptr) {
+    munmap(m_map, m_map_size);
+  }
+  m_map = nullptr;
+  m_map_size = 0;
+  m_header = nullptr;
+}
+
+template <typename V>
+const radix_image_node* radix_tree_view<V>::find_child(
+    const radix_image_node* node,
+    uint64_t key) const {
+  const uint64_t* first = m_child_keys + node->child_begin;
+  const uint64_t* last = first + node->child_count;
+  const uint64_t* pos = std::lower_bound(first, last, key);
+  if (pos == last || *pos != key) {
+    return nullptr;
+  }
+  return m_nodes + m_child_nodes[pos - m_child_keys];
+}
+
+// Same walk as radix_tree::find_prefix().
+template <typename V>
+const radix_image_node* radix_tree_view<V>::find_prefix(const char* key,
+                                                        size_t len) const {
+  if (m_header == nullptr) {
+    return nullptr;
+  }
+  const char* nul = static_cast<const char*>(memchr(key, 0, len));
+  if (nul != nullptr) {
+    len = nul - key;
+  }
+  if (len == 0) {
+    return nullptr;
+  }
+
+  const radix_image_node* result = m_nodes;
+  size_t pos = 0;
+  while (true) {
+    size_t uchar_len = radix_utf8_length(key[pos]);
+    if (uchar_len == 0 || uchar_len > len - pos) {
+      return nullptr;
+    }
+    const radix_image_node* child =
+        find_child(result, radix_child_key(key + pos, uchar_len));
+    if (child == nullptr) {
+      return nullptr;
+    }
+
+    const char* child_key = node_key(child);
+    size_t compare = std::min<size_t>(len - pos, child->key_size);
+    if (radix_mismatch(key + pos + uchar_len, child_key + uchar_len,
+                       compare - uchar_len) != compare - uchar_len) {
+      return nullptr;
+    }
+    pos += compare;
+    if (pos == len) {
+      if (compare < child->key_size &&
+          radix_utf8_continuation(child_key[compare])) {
+        return nullptr;
+      }
+      return child;
+    }
+    result = child;
+  }
+}
+
+template <typename V>
+void radix_tree_view<V>::match(const std::string& key,
+                               std::vector<V>& vec) const {
+  const radix_image_node* match_node = find_prefix(key.data(), key.size());
+  if (match_node == nullptr) {
+    return;
+  }
+  if (!infix()) {
+    for (uint32_t i = match_node->leaf_begin; i < match_node->leaf_end; ++i) {
+      const V* values = m_values + m_leaves[i].value;
+      vec.insert(vec.end(), values, values + m_leaves[i].value_count);
+    }
+    return;
+  }
+  // A value comes once for each suffix of its pattern that matches; only
+  // the first is kept, as the tree does.
+  radix_seen<V> item_set(m_value_domain);
+  for (uint32_t i = match_node->leaf_begin; i < match_node->leaf_end; ++i) {
+    const V* values = m_values + m_leaves[i].value;
+    for (uint64_t j = 0; j < m_leaves[i].value_count; ++j) {
+      if (item_set.insert(values[j])) {
+        vec.push_back(values[j]);
+      }
+    }
+  }
+}
+
+template <typename V>
+void radix_tree_view<V>::match(const std::string& key,
+                               std::vector<V>& vec,
+                               std::function<bool(V, V)> compfunc,
+                               int recall_limit) const {
+  const radix_image_node* match_node = find_prefix(key.data(), key.size());
+  if (match_node == nullptr) {
+    return;
+  }
+  if (match_node->heap_size > 0) {
+    const V* heap = m_heap_values + match_node->heap;
+    vec.insert(vec.end(), heap,
+               heap + std::min<size_t>(recall_limit, match_node->heap_size));
+    return;
+  }
+  radix_seen<V> item_set(m_value_domain);
+  for (uint32_t i = match_node->leaf_begin; i < match_node->leaf_end; ++i) {
+    const V* values = m_values + m_leaves[i].value;
+    for (uint64_t j = 0; j < m_leaves[i].value_count; ++j) {
+      if (item_set.insert(values[j])) {
+        radix_tree<V>::heap_insert(&vec, values[j], compfunc, recall_limit);
+      }
+    }
+  }
+  std::sort_heap(vec.begin(), vec.end(), compfunc);
+}
+
+template <typename V>
+radix_tree_view_iter<V> radix_tree_view<V>::match(
+    const std::string& key) const {
+  const radix_image_node* match_node = find_prefix(key.data(), key.size());
+  if (match_node != nullptr) {
+    return {this, match_node->leaf_begin, match_node->leaf_end};
+  }
+  return {};
+}
+
+template class radix_tree_view<int>;
+
+}  // namespace radix
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace radix {
+
+// Layout of the image written by radix_tree::freeze(). Every section starts
+// on a kImageAlignment boundary and is addressed by its offset from the start
+// of the image, so the image can be mapped at any address. Integers and
+// values are stored in the byte order of the host that wrote them.
+//
+// Nodes are numbered in the order of a depth-first walk that visits children
+// by key, so the leaves below any node form one run of the leaf array, in the
+// order of their patterns. The children of a node are numbered consecutively.
+static const uint32_t kImageVersion = 2;
+static const size_t kImageAlignment = 16;
+
+// radix_image_header::flags.
+static const uint32_t kImageInfix = 1;  // frozen from a tree in infix mode
+
+struct radix_image_header {
+  char magic[8];  // "RADIXIMG"
+  uint32_t version;
+  uint32_t value_size;
+  uint32_t flags;
+  uint32_t reserved;
+  uint64_t node_count;
+  uint64_t child_count;
+  uint64_t leaf_count;
+  uint64_t value_count;
+  uint64_t heap_value_count;
+  uint64_t key_bytes;
+  // Section offsets.
+  uint64_t nodes;         // radix_image_node[node_count]
+  uint64_t child_keys;    // uint64_t[child_count], see radix_child_key()
+  uint64_t child_nodes;   // uint32_t[child_count]
+  uint64_t leaves;        // radix_image_leaf[leaf_count]
+  uint64_t values;        // V[value_count]
+  uint64_t heap_values;   // V[heap_value_count]
+  uint64_t keys;          // char[key_bytes]
+  uint64_t size;          // of the whole image
+};
+
+struct radix_image_node {
+  uint64_t key;          // offset into the key bytes
+  uint64_t heap;         // offset into the heap values
+  uint32_t key_size;
+  uint32_t heap_size;    // 0 if finish() built no list for the node
+  uint32_t child_begin;  // children in the child arrays, sorted by key
+  uint32_t child_count;
+  uint32_t leaf_begin;   // leaves of the subtree
+  uint32_t leaf_end;
+  uint32_t has_leaf;     // leaf_begin holds the node's own pattern
+  uint32_t reserved;
+};
+
+struct radix_image_leaf {
+  uint64_t value;        // offset into the values
+  uint64_t value_count;
+};
+
+template <typename V>
+class radix_tree_view_iter;
+
+// Read-only radix_tree served straight from an image written by
+// radix_tree::freeze() or save(), typically mapped from a file so that
+// opening it costs no parsing and processes share the page cache. Answers
+// the same queries as the tree it was frozen from; values under a prefix come
+// in pattern order. As with a tree in infix mode, match() returns a value
+// once however many suffixes of its pattern match, and iterators see the
+// suffixes as patterns. V must be trivially copyable.
+//
+// The image is trusted: open() checks its header and section bounds, not the
+// contents of the sections.
+template <typename V>
+class radix_tree_view {
+ public:
+  radix_tree_view();
+  ~radix_tree_view();
+
+  // Map the image in "path". Returns false if it cannot be read or is not an
+  // image of radix_tree<V>.
+  bool open(const std::string& path);
+  // Serve the image at data[0, size), which must stay valid and be aligned
+  // to kImageAlignment, like the result of freeze().
+  bool attach(const char* data, size_t size);
+  void close();
+
+  size_t size() const { return m_header != nullptr ? m_header->leaf_count : 0; }
+  // Whether the image is of a tree in infix mode; see radix_tree::set_infix().
+  bool infix() const {
+    return m_header != nullptr && (m_header->flags & kImageInfix) != 0;
+  }
+  // See radix_tree::set_value_domain().
+  void set_value_domain(size_t domain) { m_value_domain = domain; }
+
+  void match(const std::string& key, std::vector<V>& vec) const;
+  void match(const std::string& key,
+             std::vector<V>& vec,
+             std::function<bool(V, V)> compfunc,
+             int recall_limit) const;
+  radix_tree_view_iter<V> match(const std::string& key) const;
+
+ private:
+  friend class radix_tree_view_iter<V>;
+
+  radix_tree_view(const radix_tree_view&);             // delete
+  radix_tree_view& operator=(const radix_tree_view&);  // delete
+
+  const radix_image_node* find_prefix(const char* key, size_t len) const;
+  const radix_image_node* find_child(const radix_image_node* node,
+                                     uint64_t key) const;
+  const char* node_key(const radix_image_node* node) const {
+    return m_keys + node->key;
+  }
+
+  void* m_map;
+  size_t m_map_size;
+  const radix_image_header* m_header;
+  const radix_image_node* m_nodes;
+  const uint64_t* m_child_keys;
+  const uint32_t* m_child_nodes;
+  const radix_image_leaf* m_leaves;
+  const V* m_values;
+  const V* m_heap_values;
+  const char* m_keys;
+  size_t m_value_domain;
+};
+
+// Walks the values of a run of leaves of a radix_tree_view, like
+// radix_tree_iter does for a radix_tree.
+template <typename V>
+class radix_tree_view_iter {
+ public:
+  radix_tree_view_iter() = default;
+  radix_tree_view_iter(const radix_tree_view<V>* view,
+                       uint32_t leaf_begin,
+                       uint32_t leaf_end)
+      : m_view(view),
+        m_leaf(leaf_begin),
+        m_end(leaf_end),
+        m_count(leaf_end - leaf_begin) {
+    skip_empty();
+  }
+
+  // Number of patterns in the run.
+  int count() const { return m_count; }
+
+  bool valid() const { return m_leaf < m_end; }
+
+  V value() const {
+    const radix_image_leaf& leaf = m_view->m_leaves[m_leaf];
+    return m_view->m_values[leaf.value + m_index];
+  }
+
+  void next() {
+    if (++m_index < m_view->m_leaves[m_leaf].value_count) {
+      return;
+    }
+    ++m_leaf;
+    m_index = 0;
+    skip_empty();
+  }
+
+ private:
+  void skip_empty() {
+    while (m_leaf < m_end && m_view->m_leaves[m_leaf].value_count == 0) {
+      ++m_leaf;
+    }
+  }
+
+  const radix_tree_view<V>* m_view = nullptr;
+  uint32_t m_leaf = 0;
+  uint32_t m_end = 0;
+  int m_count = 0;
+  uint64_t m_index = 0;
+};
+
+extern template class radix_tree_view<int>;
+
+}  // namespace radix
@@ -0,0 +1,1206 @@
+// Checks radix_tree and the structures built on it against a
+// std::multimap<std::string, int> holding the same (pattern, value) pairs.
+// Patterns are drawn from a small alphabet of 1 to 4 byte code points, so
+// that they share prefixes, split nodes and collide on values often.
+//
+//   radix_test [--seed=S]
+//
+// Prints the first disagreement of each failing check and exits with 1 if
+// any check failed.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "radix.h"
+#include "radix_concurrent.h"
+#include "radix_dedup.h"
+#include "radix_handle.h"
+#include "radix_packed.h"
+#include "radix_sharded.h"
+#include "radix_view.h"
+
+namespace radix {
+namespace test {
+namespace {
+
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if (!(cond)) {                                                    \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+              #cond);                                                 \
+      return false;                                                   \
+    }                                                                 \
+  } while (0)
+
+typedef std::multimap<std::string, int> model;
+typedef std::vector<std::pair<std::string, int>> pairs;
+
+const int kTopK = 5;
+
+struct less_ids {
+  bool operator()(int a, int b) const { return a < b; }
+};
+
+struct greater_ids {
+  bool operator()(int a, int b) const { return a > b; }
+};
+
+bool less_fn(int a, int b) { return a < b; }
+bool greater_fn(int a, int b) { return a > b; }
+
+// A functor whose ordering is in its state.
+struct ordered_by {
+  bool ascending;
+  bool operator()(int a, int b) const { return ascending ? a < b : a > b; }
+};
+
+// a, b, c, e-acute, a CJK ideograph and an emoji.
+const char* const kAlphabet[] = {"a",          "b",          "c", "\xc3\xa9",
+                                 "\xe4\xb8\xad", "\xf0\x9f\x98\x80"};
+const int kAlphabetSize = sizeof(kAlphabet) / sizeof(kAlphabet[0]);
+
+std::string random_string(std::mt19937_64& rng, int max_len) {
+  int len = 1 + rng() % max_len;
+  std::string s;
+  for (int i = 0; i < len; ++i) {
+    s += kAlphabet[rng() % kAlphabetSize];
+  }
+  return s;
+}
+
+// The code points of a valid UTF-8 string.
+std::vector<std::string> code_points(const std::string& s) {
+  std::vector<std::string> result;
+  for (size_t i = 0; i < s.size();) {
+    size_t len = radix_utf8_length(s[i]);
+    result.push_back(s.substr(i, len));
+    i += len;
+  }
+  return result;
+}
+
+bool starts_with(const std::string& s, const std::string& prefix) {
+  return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+// The pairs whose pattern starts with "key", in pattern order.
+pairs prefix_pairs(const model& m, const std::string& key) {
+  pairs result;
+  if (key.empty()) {
+    return result;
+  }
+  for (model::const_iterator it = m.lower_bound(key);
+       it != m.end() && starts_with(it->first, key); ++it) {
+    result.push_back(*it);
+  }
+  return result;
+}
+
+std::vector<int> values_of(const pairs& p) {
+  std::vector<int> values;
+  for (const auto& entry : p) {
+    values.push_back(entry.second);
+  }
+  return values;
+}
+
+template <typename Compare>
+std::vector<int> top_k(std::vector<int> values, Compare compfunc, int k) {
+  std::sort(values.begin(), values.end(), compfunc);
+  values.erase(std::unique(values.begin(), values.end()), values.end());
+  if (values.size() > static_cast<size_t>(k)) {
+    values.resize(k);
+  }
+  return values;
+}
+
+// Levenshtein distance between two sequences of code points.
+int edit_distance(const std::vector<std::string>& a,
+                  const std::vector<std::string>& b) {
+  std::vector<int> row(b.size() + 1);
+  for (size_t j = 0; j <= b.size(); ++j) {
+    row[j] = j;
+  }
+  for (size_t i = 1; i <= a.size(); ++i) {
+    int diagonal = row[0];
+    row[0] = i;
+    for (size_t j = 1; j <= b.size(); ++j) {
+      int above = row[j];
+      row[j] = std::min(diagonal + (a[i - 1] == b[j - 1] ? 0 : 1),
+                        std::min(row[j], row[j - 1]) + 1);
+      diagonal = above;
+    }
+  }
+  return row[b.size()];
+}
+
+// The pairs whose pattern has a prefix within "max_edits" of "key".
+pairs fuzzy_pairs(const model& m, const std::string& key, int max_edits) {
+  std::vector<std::string> target = code_points(key);
+  pairs result;
+  for (const auto& entry : m) {
+    std::vector<std::string> pattern = code_points(entry.first);
+    for (size_t len = 0; len <= pattern.size(); ++len) {
+      std::vector<std::string> prefix(pattern.begin(), pattern.begin() + len);
+      if (edit_distance(prefix, target) <= max_edits) {
+        result.push_back(entry);
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+// The (pattern, value) pairs an iterator yields.
+template <typename Iter>
+pairs walk(Iter it) {
+  pairs result;
+  for (; it.valid(); it.next()) {
+    result.emplace_back(it.key().ToString(), it.value());
+  }
+  return result;
+}
+
+// The pairs of "p" grouped by pattern, in reverse pattern order, each
+// pattern's values kept in order, as reverse iteration yields them.
+pairs reverse_patterns(const pairs& p) {
+  pairs result;
+  size_t end = p.size();
+  while (end > 0) {
+    size_t begin = end - 1;
+    while (begin > 0 && p[begin - 1].first == p[end - 1].first) {
+      --begin;
+    }
+    result.insert(result.end(), p.begin() + begin, p.begin() + end);
+    end = begin;
+  }
+  return result;
+}
+
+// The pairs of the patterns [skip, skip + count) of "p".
+pairs pattern_page(const pairs& p, int skip, int count) {
+  pairs result;
+  int pattern = -1;
+  for (size_t i = 0; i < p.size(); ++i) {
+    if (i == 0 || p[i].first != p[i - 1].first) {
+      ++pattern;
+    }
+    if (pattern >= skip && pattern < skip + count) {
+      result.push_back(p[i]);
+    }
+  }
+  return result;
+}
+
+int pattern_count(const pairs& p) {
+  int count = 0;
+  for (size_t i = 0; i < p.size(); ++i) {
+    count += i == 0 || p[i].first != p[i - 1].first;
+  }
+  return count;
+}
+
+// Fill "tree" and "m" with "n" random pairs.
+void fill(std::mt19937_64& rng,
+          int n,
+          int max_len,
+          radix_tree<int>* tree,
+          model* m) {
+  for (int i = 0; i < n; ++i) {
+    std::string pattern = random_string(rng, max_len);
+    int value = rng() % 500;
+    tree->insert(pattern, value);
+    m->emplace(pattern, value);
+  }
+}
+
+// match(), top-k match(), match_batch() and the iterator of match() agree
+// with the model for "queries" random keys.
+bool check_queries(std::mt19937_64& rng,
+                   const radix_tree<int>& tree,
+                   const model& m,
+                   int queries) {
+  for (int q = 0; q < queries; ++q) {
+    std::string key = random_string(rng, 3);
+    pairs expected = prefix_pairs(m, key);
+    std::vector<int> values;
+    tree.match(key, values);
+    CHECK(values == values_of(expected));
+
+    values.clear();
+    tree.match(key, values, less_ids(), kTopK);
+    CHECK(values == top_k(values_of(expected), less_ids(), kTopK));
+
+    std::vector<std::vector<int>> batch;
+    tree.match_batch({key, key + "a"}, batch);
+    CHECK(batch.size() == 2 && batch[0] == values_of(expected));
+    CHECK(batch[1] == values_of(prefix_pairs(m, key + "a")));
+
+    radix_tree_iter<int> it = tree.match(key);
+    CHECK(it.count() == static_cast<int>(expected.size()));
+    CHECK(walk(it) == expected);
+  }
+  return true;
+}
+
+bool test_insert_match(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  radix_tree<int> tree;
+  model m;
+  fill(rng, 3000, 6, &tree, &m);
+  CHECK(tree.size() == m.size() && tree.stats().values == m.size());
+  CHECK(check_queries(rng, tree, m, 300));
+
+  // Top-k lists from finish() answer the same as scans, and stay current
+  // through later inserts.
+  tree.finish(less_ids(), kTopK);
+  CHECK(tree.stats().heap_nodes > 0);
+  CHECK(check_queries(rng, tree, m, 300));
+  fill(rng, 1000, 6, &tree, &m);
+  CHECK(check_queries(rng, tree, m, 300));
+  return true;
+}
+
+bool test_erase(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  radix_tree<int> tree;
+  model m;
+  fill(rng, 3000, 4, &tree, &m);
+  tree.finish(less_ids(), kTopK);
+  for (int step = 0; step < 3000; ++step) {
+    std::string pattern = random_string(rng, 4);
+    if (rng() % 2 == 0) {
+      size_t expected = m.erase(pattern);
+      CHECK(tree.erase(pattern) == expected);
+    } else {
+      int value = rng() % 500;
+      std::pair<model::iterator, model::iterator> range =
+          m.equal_range(pattern);
+      if (range.first != range.second && rng() % 2 == 0) {
+        value = range.first->second;
+      }
+      size_t expected = 0;
+      for (model::iterator it = range.first; it != range.second;) {
+        if (it->second == value) {
+          it = m.erase(it);
+          ++expected;
+        } else {
+          ++it;
+        }
+      }
+      CHECK(tree.erase(pattern, value) == expected);
+    }
+    if (step % 100 == 0) {
+      CHECK(tree.size() == m.size());
+      CHECK(check_queries(rng, tree, m, 20));
+    }
+    if (step % 500 == 0) {
+      fill(rng, 200, 4, &tree, &m);
+    }
+  }
+  CHECK(check_queries(rng, tree, m, 300));
+
+  while (!m.empty()) {
+    std::string pattern = m.begin()->first;
+    size_t expected = m.erase(pattern);
+    CHECK(tree.erase(pattern) == expected);
+  }
+  radix_tree_stats stats = tree.stats();
+  CHECK(stats.leaves == 0 && stats.values == 0);
+  CHECK(tree.size() == 0 && tree.empty());
+  return true;
+}
+
+// Bytes of the patterns of "m" too long to be held in node keys.
+size_t stored_bytes(const model& m) {
+  size_t bytes = 0;
+  for (model::const_iterator it = m.begin(); it != m.end();
+       it = m.upper_bound(it->first)) {
+    if (it->first.size() > radix_key::kInlineSize) {
+      bytes += it->first.size();
+    }
+  }
+  return bytes;
+}
+
+// Patterns erased and inserted over and over keep the key store within a
+// bound of the bytes of the patterns left, through compactions that move
+// every stored key, and an emptied tree keeps no key bytes.
+bool test_key_store(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  for (int infix = 0; infix < 2; ++infix) {
+    radix_tree<int> tree;
+    tree.set_infix(infix == 1);
+    model m;
+    for (int step = 0; step < 20000; ++step) {
+      if (m.size() < 500 || rng() % 2 == 0) {
+        std::string pattern = random_string(rng, 12);
+        int value = rng() % 500;
+        tree.insert(pattern, value);
+        m.emplace(pattern, value);
+      } else {
+        model::iterator it = m.begin();
+        std::advance(it, rng() % m.size());
+        std::string pattern = it->first;
+        size_t expected = m.erase(pattern);
+        CHECK(tree.erase(pattern) == expected);
+      }
+      if (step % 1000 == 0) {
+        // Inner node keys may outlive the patterns whose bytes they share,
+        // but hold no more bytes than the patterns below them.
+        size_t live = 2 * stored_bytes(m);
+        CHECK(tree.memory_usage().key_bytes <=
+              std::max(2 * live, live + 4096));
+      }
+    }
+    if (infix == 0) {
+      CHECK(check_queries(rng, tree, m, 300));
+      CHECK(walk(tree.lower_bound("")) == pairs(m.begin(), m.end()));
+    } else {
+      for (int q = 0; q < 100; ++q) {
+        std::string key = random_string(rng, 3);
+        std::set<int> expected;
+        for (const auto& entry : m) {
+          if (entry.first.find(key) != std::string::npos) {
+            expected.insert(entry.second);
+          }
+        }
+        std::vector<int> values;
+        tree.match(key, values);
+        CHECK(std::set<int>(values.begin(), values.end()) == expected);
+      }
+    }
+
+    // Patterns erased and inserted again take no new bytes, whether or not
+    // they were the last stored. Their letters are not in the alphabet, so
+    // the tree does not hold them yet.
+    const std::string again[] = {"xyzxyzxyzxyz", "zyxzyxzyxzyx"};
+    for (const std::string& pattern : again) {
+      tree.insert(pattern, 1);
+    }
+    size_t key_bytes = tree.memory_usage().key_bytes;
+    for (int i = 0; i < 100; ++i) {
+      const std::string& pattern = again[i % 2];
+      CHECK(tree.erase(pattern) == 1);
+      tree.insert(pattern, 1);
+      CHECK(tree.memory_usage().key_bytes <= key_bytes);
+      key_bytes = tree.memory_usage().key_bytes;
+    }
+    for (const std::string& pattern : again) {
+      CHECK(tree.erase(pattern) == 1);
+    }
+
+    while (!m.empty()) {
+      std::string pattern = m.begin()->first;
+      size_t expected = m.erase(pattern);
+      CHECK(tree.erase(pattern) == expected);
+    }
+    CHECK(tree.empty() && tree.memory_usage().key_bytes == 0);
+  }
+  return true;
+}
+
+bool test_iterators(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  radix_tree<int> tree;
+  model m;
+  fill(rng, 2000, 5, &tree, &m);
+  pairs all(m.begin(), m.end());
+  for (int q = 0; q < 300; ++q) {
+    std::string key = random_string(rng, 3);
+    pairs expected(m.lower_bound(key), m.end());
+    CHECK(walk(tree.lower_bound(key)) == expected);
+    expected.assign(m.upper_bound(key), m.end());
+    CHECK(walk(tree.upper_bound(key)) == expected);
+
+    std::string from = key;
+    std::string to = random_string(rng, 3);
+    if (to < from) {
+      std::swap(from, to);
+    }
+    expected.assign(m.lower_bound(from), m.lower_bound(to));
+    CHECK(walk(tree.range(from, to)) == expected);
+    CHECK(walk(tree.range(from, to, false)) == reverse_patterns(expected));
+
+    // Pages of the patterns under a prefix; the skip stops at the last one.
+    expected = prefix_pairs(m, key);
+    int patterns = pattern_count(expected);
+    if (patterns == 0) {
+      continue;
+    }
+    int start = rng() % (patterns + 3);
+    int count = 1 + rng() % 5;
+    radix_tree_iter<int> it = tree.match(key);
+    it.reset(start, count);
+    pairs page = pattern_page(expected, std::min(start, patterns - 1), count);
+    CHECK(it.count() == static_cast<int>(page.size()));
+    CHECK(walk(it) == page);
+  }
+  CHECK(walk(tree.lower_bound("")) == all);
+  return true;
+}
+
+bool test_fuzzy(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  radix_tree<int> tree;
+  model m;
+  fill(rng, 1500, 5, &tree, &m);
+  tree.finish(less_ids(), kTopK);
+  for (int q = 0; q < 200; ++q) {
+    std::string key = random_string(rng, 4);
+    int max_edits = 1 + rng() % 2;
+    pairs expected = fuzzy_pairs(m, key, max_edits);
+    std::vector<int> values;
+    tree.fuzzy_match(key, max_edits, values);
+    CHECK(values == values_of(expected));
+
+    values.clear();
+    tree.fuzzy_match(key, max_edits, values, less_ids(), kTopK);
+    CHECK(values == top_k(values_of(expected), less_ids(), kTopK));
+  }
+  return true;
+}
+
+bool test_parallel_finish(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  radix_tree<int> tree;
+  model m;
+  fill(rng, 4000, 6, &tree, &m);
+  tree.finish(less_ids(), kTopK, 4);
+  CHECK(tree.stats().heap_nodes > 0);
+  CHECK(check_queries(rng, tree, m, 300));
+  return true;
+}
+
+bool test_bulk_load(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  model m;
+  for (int i = 0; i < 3000; ++i) {
+    m.emplace(random_string(rng, 6), rng() % 500);
+  }
+  pairs sorted(m.begin(), m.end());
+  radix_tree<int> loaded;
+  CHECK(loaded.bulk_load(sorted.begin(), sorted.end(), less_ids(), kTopK) ==
+        0);
+  CHECK(loaded.size() == m.size());
+  CHECK(loaded.stats().heap_nodes > 0);
+  CHECK(check_queries(rng, loaded, m, 300));
+
+  // Pairs out of order and invalid UTF-8 are left out and counted.
+  pairs input = {{"b", 1}, {"a", 2}, {"c\xff", 3}, {"c", 4}};
+  radix_tree<int> partial;
+  CHECK(partial.bulk_load(input.begin(), input.end()) == 2);
+  CHECK(partial.size() == 2);
+  model kept = {{"b", 1}, {"c", 4}};
+  CHECK(check_queries(rng, partial, kept, 20));
+  return true;
+}
+
+bool test_view(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  radix_tree<int> tree;
+  model m;
+  fill(rng, 3000, 6, &tree, &m);
+  tree.finish(less_ids(), kTopK);
+  const std::string path = "radix_test.img";
+  CHECK(tree.save(path));
+  radix_tree_view<int> view;
+  CHECK(view.open(path));
+  std::remove(path.c_str());
+  for (int q = 0; q < 300; ++q) {
+    std::string key = random_string(rng, 3);
+    pairs expected = prefix_pairs(m, key);
+    std::vector<int> values;
+    view.match(key, values);
+    CHECK(values == values_of(expected));
+
+    values.clear();
+    view.match(key, values, less_ids(), kTopK);
+    CHECK(values == top_k(values_of(expected), less_ids(), kTopK));
+
+    values.clear();
+    for (radix_tree_view_iter<int> it = view.match(key); it.valid();
+         it.next()) {
+      values.push_back(it.value());
+    }
+    CHECK(values == values_of(expected));
+  }
+  return true;
+}
+
+bool test_concurrent(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  radix_concurrent_tree<int> tree;
+  model m;
+  tree.finish(less_ids(), kTopK);
+  // A reader runs alongside the writes; every answer it gets must be a
+  // sorted top-k list.
+  std::atomic<bool> done{false};
+  std::atomic<bool> sorted{true};
+  std::thread reader([&tree, &done, &sorted] {
+    std::vector<int> values;
+    while (!done.load()) {
+      for (const char* key : kAlphabet) {
+        values.clear();
+        tree.match(key, values, less_ids(), kTopK);
+        if (!std::is_sorted(values.begin(), values.end()) ||
+            values.size() > static_cast<size_t>(kTopK)) {
+          sorted.store(false);
+        }
+      }
+    }
+  });
+  bool erased = true;
+  for (int i = 0; i < 2000; ++i) {
+    std::string pattern = random_string(rng, 4);
+    if (rng() % 4 == 0) {
+      size_t expected = m.erase(pattern);
+      erased = tree.erase(pattern) == expected && erased;
+    } else {
+      int value = rng() % 500;
+      tree.insert(pattern, value);
+      m.emplace(pattern, value);
+    }
+  }
+  done.store(true);
+  reader.join();
+  CHECK(erased);
+  CHECK(sorted.load());
+
+  for (int q = 0; q < 300; ++q) {
+    std::string key = random_string(rng, 3);
+    pairs expected = prefix_pairs(m, key);
+    std::vector<int> values;
+    tree.match(key, values);
+    CHECK(values == values_of(expected));
+    values.clear();
+    tree.match(key, values, less_ids(), kTopK);
+    CHECK(values == top_k(values_of(expected), less_ids(), kTopK));
+    CHECK(tree.read([&key](const radix_tree<int>& t) {
+      return walk(t.match(key));
+    }) == expected);
+  }
+  return true;
+}
+
+bool test_sharded(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  radix_sharded_tree<int> tree(4, 2);
+  CHECK(tree.empty());
+  model m;
+  pairs input;
+  for (int i = 0; i < 3000; ++i) {
+    input.emplace_back(random_string(rng, 5), rng() % 500);
+    m.insert(input.back());
+  }
+  tree.insert(input.begin(), input.end());
+  CHECK(tree.size() == m.size() && !tree.empty());
+  tree.finish(less_ids(), kTopK);
+  for (int q = 0; q < 300; ++q) {
+    std::string key = random_string(rng, 3);
+    std::vector<int> expected = values_of(prefix_pairs(m, key));
+    std::vector<int> values;
+    tree.match(key, values);
+    std::sort(values.begin(), values.end());
+    std::sort(expected.begin(), expected.end());
+    CHECK(values == expected);
+    values.clear();
+    tree.match(key, values, less_ids(), kTopK);
+    CHECK(values == top_k(expected, less_ids(), kTopK));
+  }
+
+  // Sets made while others are live on the thread keep their own values.
+  {
+    radix_seen<int> outer(1000);
+    CHECK(outer.insert(5) && outer.insert(5000));
+    {
+      radix_seen<int> inner(1000);
+      CHECK(inner.insert(5) && inner.insert(5000) && !inner.insert(5));
+    }
+    radix_seen<int> next(1000);
+    CHECK(next.insert(5) && next.insert(7));
+    CHECK(!outer.insert(5) && !outer.insert(5000) && outer.insert(7));
+  }
+
+  // A domain of 20 million values: each short-prefix query merges the lists
+  // of all the shards, and neither its set nor those of the shards' queries
+  // may take arrays of that size each time, or this takes minutes.
+  radix_sharded_tree<int> wide(8, 2, 2);
+  wide.set_value_domain(20000000);
+  model wide_m;
+  for (int i = 0; i < 3000; ++i) {
+    std::string pattern = random_string(rng, 5);
+    int value = rng() % 25000000;
+    wide.insert(pattern, value);
+    wide_m.emplace(pattern, value);
+  }
+  for (int finished = 0; finished < 2; ++finished) {
+    if (finished == 1) {
+      wide.finish(less_ids(), kTopK);
+    }
+    for (int q = 0; q < 300; ++q) {
+      std::string key = random_string(rng, 1);
+      std::vector<int> expected = values_of(prefix_pairs(wide_m, key));
+      std::vector<int> values;
+      wide.match(key, values, less_ids(), kTopK);
+      CHECK(values == top_k(expected, less_ids(), kTopK));
+      // Lists from finish() serve every ordering, so others are checked
+      // on the scans before it.
+      if (finished == 0) {
+        values.clear();
+        wide.match(key, values, greater_ids(), kTopK);
+        CHECK(values == top_k(expected, greater_ids(), kTopK));
+      }
+    }
+  }
+  return true;
+}
+
+bool test_handle(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  radix_tree_handle<int> handle;
+  std::vector<int> values;
+  handle.match("a", values);
+  CHECK(values.empty());
+
+  model m;
+  pairs input;
+  for (int i = 0; i < 2000; ++i) {
+    input.emplace_back(random_string(rng, 5), rng() % 500);
+    m.insert(input.back());
+  }
+  CHECK(handle.rebuild([&input](radix_tree<int>& tree) {
+    for (const auto& entry : input) {
+      tree.insert(entry.first, entry.second);
+    }
+    tree.finish(less_ids(), kTopK);
+  }));
+  handle.wait();
+  radix_snapshot_iter<int> it = handle.match("a");
+  radix_tree_handle<int>::snapshot old = handle.get();
+  handle.publish(std::unique_ptr<radix_tree<int>>(new radix_tree<int>()));
+  // The snapshot and the iterator still see the replaced tree.
+  CHECK(walk(it) == prefix_pairs(m, "a"));
+  CHECK(check_queries(rng, *old, m, 100));
+  values.clear();
+  handle.match("a", values);
+  CHECK(values.empty());
+  return true;
+}
+
+// Run a top-k query for "key" twice, the second time from the cache.
+template <typename Compare>
+bool check_twice(const radix_tree<int>& tree,
+                 const std::string& key,
+                 Compare compfunc,
+                 const std::vector<int>& expected) {
+  for (int pass = 0; pass < 2; ++pass) {
+    std::vector<int> values;
+    tree.match(key, values, compfunc, kTopK);
+    CHECK(values == expected);
+  }
+  return true;
+}
+
+bool test_cache(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  radix_tree<int> tree;
+  tree.set_cache_capacity(1 << 20);
+  model m;
+  fill(rng, 3000, 5, &tree, &m);
+  for (int q = 0; q < 300; ++q) {
+    std::string key = random_string(rng, 1);
+    std::vector<int> expected = values_of(prefix_pairs(m, key));
+    // A list cached for one ordering does not answer another, even with a
+    // comparator of the same type.
+    std::vector<int> ascending = top_k(expected, less_ids(), kTopK);
+    std::vector<int> descending = top_k(expected, greater_ids(), kTopK);
+    std::function<bool(int, int)> less = std::less<int>();
+    std::function<bool(int, int)> greater = std::greater<int>();
+    std::function<bool(int, int)> less_wrapped = less_fn;
+    std::function<bool(int, int)> greater_wrapped = greater_fn;
+    CHECK(check_twice(tree, key, less_ids(), ascending));
+    CHECK(check_twice(tree, key, greater_ids(), descending));
+    CHECK(check_twice(tree, key, less, ascending));
+    CHECK(check_twice(tree, key, greater, descending));
+    CHECK(check_twice(tree, key, less_fn, ascending));
+    CHECK(check_twice(tree, key, greater_fn, descending));
+    CHECK(check_twice(tree, key, less_wrapped, ascending));
+    CHECK(check_twice(tree, key, greater_wrapped, descending));
+    CHECK(check_twice(tree, key, ordered_by{true}, ascending));
+    CHECK(check_twice(tree, key, ordered_by{false}, descending));
+    CHECK(check_twice(tree, key, radix_order_named(ordered_by{true}, 1),
+                      ascending));
+    CHECK(check_twice(tree, key, radix_order_named(ordered_by{false}, 2),
+                      descending));
+    if (q % 50 == 0) {
+      fill(rng, 20, 5, &tree, &m);
+    }
+  }
+  CHECK(tree.cache_stats().hits > 0);
+  return true;
+}
+
+bool test_adaptive(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  radix_tree<int> tree;
+  model m;
+  fill(rng, 3000, 5, &tree, &m);
+  tree.finish_adaptive(less_ids(), kTopK, 1 << 16);
+  // Hot prefixes earn lists through queries in other orderings, and the
+  // lists still answer in that of finish_adaptive(), also after the inserts
+  // and erases that follow. Queries in other orderings, or for more values
+  // than the lists hold, answer the same before and after their prefixes
+  // get hot.
+  for (int q = 0; q < 50; ++q) {
+    for (const char* key : kAlphabet) {
+      std::vector<int> expected = values_of(prefix_pairs(m, key));
+      std::vector<int> values;
+      tree.match(key, values, greater_ids(), kTopK);
+      CHECK(values == top_k(expected, greater_ids(), kTopK));
+      values.clear();
+      tree.match(key, values, less_fn, kTopK);
+      CHECK(values == top_k(expected, less_ids(), kTopK));
+      values.clear();
+      tree.match(key, values, less_ids(), kTopK - 2);
+      CHECK(values == top_k(expected, less_ids(), kTopK - 2));
+      values.clear();
+      tree.match(key, values, less_ids(), kTopK + 2);
+      CHECK(values == top_k(expected, less_ids(), kTopK + 2));
+      values.clear();
+      tree.fuzzy_match(key, 0, values, greater_ids(), kTopK);
+      CHECK(values == top_k(expected, greater_ids(), kTopK));
+    }
+  }
+  CHECK(tree.adaptive_stats().lists > 0);
+  CHECK(check_queries(rng, tree, m, 300));
+  fill(rng, 500, 5, &tree, &m);
+  for (int i = 0; i < 500; ++i) {
+    std::string pattern = random_string(rng, 5);
+    size_t expected = m.erase(pattern);
+    CHECK(tree.erase(pattern) == expected);
+  }
+  CHECK(check_queries(rng, tree, m, 300));
+
+  // A tree that is only read keeps its lists within the budget, though hot
+  // prefixes outnumber the lists it has room for and keep replacing them.
+  radix_tree<int> budget_tree;
+  model budget_m;
+  fill(rng, 3000, 5, &budget_tree, &budget_m);
+  const size_t budget = 1024;
+  budget_tree.finish_adaptive(less_ids(), kTopK, budget);
+  const radix_tree<int>& reader = budget_tree;
+  for (int round = 0; round < 20; ++round) {
+    for (const char* first : kAlphabet) {
+      for (const char* second : kAlphabet) {
+        std::string key = std::string(first) + second;
+        for (int q = 0; q < 3; ++q) {
+          std::vector<int> values;
+          reader.match(key, values, less_ids(), kTopK);
+          CHECK(values ==
+                top_k(values_of(prefix_pairs(budget_m, key)), less_ids(),
+                      kTopK));
+        }
+      }
+    }
+    CHECK(reader.memory_usage().heap_bytes <= budget);
+  }
+  CHECK(reader.adaptive_stats().evictions > 0);
+
+  // So do concurrent readers, which may have to leave withdrawn lists to
+  // the next query.
+  std::atomic<bool> agree(true);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&reader, &budget_m, &agree, t]() {
+      const int keys = kAlphabetSize * kAlphabetSize;
+      for (int round = 0; round < 10; ++round) {
+        for (int i = 0; i < keys; ++i) {
+          int index = (i * 7 + t * 11 + round) % keys;
+          std::string key = std::string(kAlphabet[index / kAlphabetSize]) +
+                            kAlphabet[index % kAlphabetSize];
+          std::vector<int> values;
+          reader.match(key, values, less_ids(), kTopK);
+          if (values != top_k(values_of(prefix_pairs(budget_m, key)),
+                              less_ids(), kTopK)) {
+            agree = false;
+          }
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  CHECK(agree);
+  CHECK(reader.memory_usage().heap_bytes <= budget);
+  return true;
+}
+
+// The pairs of "values" with their best scores, ranked as match_scored()
+// ranks them.
+std::vector<std::pair<int, float>> top_scores(
+    const std::vector<std::pair<int, float>>& values,
+    int k,
+    float min_score) {
+  std::map<int, float> best;
+  for (const auto& entry : values) {
+    std::map<int, float>::iterator found = best.find(entry.first);
+    if (found == best.end()) {
+      best.emplace(entry);
+    } else {
+      found->second = std::max(found->second, entry.second);
+    }
+  }
+  std::vector<std::pair<int, float>> result;
+  for (const auto& entry : best) {
+    if (entry.second >= min_score) {
+      result.push_back(entry);
+    }
+  }
+  std::sort(result.begin(), result.end(),
+            [](const std::pair<int, float>& a, const std::pair<int, float>& b) {
+              return a.second != b.second ? a.second > b.second
+                                          : a.first < b.first;
+            });
+  if (result.size() > static_cast<size_t>(k)) {
+    result.resize(k);
+  }
+  return result;
+}
+
+bool test_scored(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  radix_tree<int> tree;
+  tree.set_value_domain(500);
+  std::multimap<std::string, std::pair<int, float>> m;
+  // Scores come in steps of 1/8 so that ties are common.
+  for (int step = 0; step < 4000; ++step) {
+    std::string pattern = random_string(rng, 5);
+    int value = rng() % 500;
+    float score = (rng() % 64) / 8.0f;
+    tree.insert(pattern, value, score);
+    m.emplace(pattern, std::make_pair(value, score));
+    if (step == 2000) {
+      tree.finish_scored(kTopK);
+      CHECK(tree.stats().heap_nodes > 0);
+    }
+  }
+  for (int q = 0; q < 300; ++q) {
+    std::string key = random_string(rng, 3);
+    float min_score = q % 2 == 0 ? -std::numeric_limits<float>::infinity()
+                                 : (rng() % 64) / 8.0f;
+    std::vector<std::pair<int, float>> under;
+    std::vector<int> all;
+    for (auto it = m.lower_bound(key);
+         it != m.end() && starts_with(it->first, key); ++it) {
+      under.push_back(it->second);
+      all.push_back(it->second.first);
+    }
+    std::vector<std::pair<int, float>> expected =
+        top_scores(under, kTopK, min_score);
+    std::vector<int> values;
+    std::vector<float> scores;
+    tree.match_scored(key, values, kTopK, min_score, &scores);
+    CHECK(values.size() == expected.size() && scores.size() == values.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+      CHECK(values[i] == expected[i].first && scores[i] == expected[i].second);
+    }
+    // Duplicates are skipped through the value domain by the other top-k
+    // queries as well.
+    values.clear();
+    tree.match(key, values, greater_ids(), kTopK);
+    CHECK(values == top_k(all, greater_ids(), kTopK));
+  }
+  return true;
+}
+
+// The pairs of "kept" as a model, each pattern's values in ascending order,
+// as a tree with kCompactValues holds them.
+model sorted_model(const std::set<std::pair<std::string, int>>& kept) {
+  return model(kept.begin(), kept.end());
+}
+
+// Packed blocks decode to what was encoded, for 64-bit values spanning the
+// whole range, and stay so through frames spliced in and out.
+bool check_packed(std::mt19937_64& rng) {
+  typedef long long word;
+  typedef radix_packed<word> codec;
+  for (int round = 0; round < 20; ++round) {
+    std::set<word> distinct;
+    auto random_word = [&rng, round]() {
+      word value = static_cast<word>(rng());
+      return round % 2 == 0 ? value : value % 1000;
+    };
+    size_t size = 1 + rng() % 600;
+    while (distinct.size() < size) {
+      distinct.insert(random_word());
+    }
+    std::vector<word> values(distinct.begin(), distinct.end());
+    std::vector<unsigned char> block(
+        codec::encoded_bytes(values.data(), values.size()));
+    codec::encode(values.data(), values.size(), block.data());
+    for (int step = 0; step < 200; ++step) {
+      std::vector<word> decoded;
+      auto append = [&decoded](word value) { decoded.push_back(value); };
+      codec::for_each(block.data(), append);
+      CHECK(decoded == std::vector<word>(distinct.begin(), distinct.end()));
+      word probe = step % 2 == 0 ? decoded[rng() % decoded.size()]
+                                 : random_word();
+      CHECK(codec::contains(block.data(), probe) ==
+            (distinct.count(probe) != 0));
+
+      // Add or remove a value in its frame, keeping at least one.
+      word value = random_word();
+      size_t frame = codec::locate(block.data(), value);
+      word frame_values[codec::kFrame + 1];
+      size_t count = codec::decode(block.data(), frame, frame_values);
+      std::vector<word> changed(frame_values, frame_values + count);
+      if (distinct.count(value) != 0) {
+        if (distinct.size() == 1) {
+          continue;
+        }
+        changed.erase(std::find(changed.begin(), changed.end(), value));
+        distinct.erase(value);
+      } else {
+        changed.insert(
+            std::lower_bound(changed.begin(), changed.end(), value), value);
+        distinct.insert(value);
+      }
+      std::vector<unsigned char> spliced(
+          codec::spliced_bytes(block.data(), block.size(), frame,
+                               changed.data(), changed.size()));
+      codec::splice(block.data(), block.size(), frame, changed.data(),
+                    changed.size(), spliced.data());
+      block.swap(spliced);
+    }
+  }
+  return true;
+}
+
+bool test_compact(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  CHECK(check_packed(rng));
+  radix_tree<int> tree;
+  tree.set_value_encoding(kCompactValues);
+  std::set<std::pair<std::string, int>> kept;
+  // Few, short patterns, so that their lists grow long enough to pack; some
+  // values at the ends of the range, so that gaps take all 32 bits.
+  auto random_value = [&rng]() {
+    switch (rng() % 50) {
+      case 0:
+        return std::numeric_limits<int>::min();
+      case 1:
+        return std::numeric_limits<int>::max();
+      default:
+        return static_cast<int>(rng() % 3000) - 1000;
+    }
+  };
+  for (int step = 0; step < 20000; ++step) {
+    std::string pattern = random_string(rng, 2);
+    int value = random_value();
+    size_t size = tree.size();
+    tree.insert(pattern, value);
+    CHECK(tree.size() - size == (kept.emplace(pattern, value).second ? 1 : 0));
+    if (step == 10000) {
+      tree.finish(less_ids(), kTopK);
+    }
+  }
+  model m = sorted_model(kept);
+  CHECK(tree.size() == m.size() && tree.stats().values == m.size());
+  CHECK(check_queries(rng, tree, m, 300));
+
+  for (int step = 0; step < 3000; ++step) {
+    std::string pattern = random_string(rng, 2);
+    if (step % 100 == 0) {
+      size_t expected = 0;
+      auto it = kept.lower_bound({pattern, std::numeric_limits<int>::min()});
+      while (it != kept.end() && it->first == pattern) {
+        it = kept.erase(it);
+        ++expected;
+      }
+      CHECK(tree.erase(pattern) == expected);
+      continue;
+    }
+    int value = random_value();
+    CHECK(tree.erase(pattern, value) == kept.erase({pattern, value}));
+  }
+  m = sorted_model(kept);
+  CHECK(tree.size() == m.size());
+  CHECK(check_queries(rng, tree, m, 300));
+
+  // A score unpacks a list for good; a repeated value keeps its best score.
+  std::vector<std::pair<int, float>> scored;
+  for (int i = 0; i < 100; ++i) {
+    int value = i % 60;
+    float score = (rng() % 16) / 4.0f;
+    tree.insert("scored", value, score);
+    scored.emplace_back(value, score);
+  }
+  std::vector<int> values;
+  std::vector<float> scores;
+  tree.match_scored("scored", values, kTopK, 0, &scores);
+  std::vector<std::pair<int, float>> expected = top_scores(scored, kTopK, 0);
+  CHECK(values.size() == expected.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    CHECK(values[i] == expected[i].first && scores[i] == expected[i].second);
+  }
+
+  // The loader leaves out repeated values as well.
+  pairs input(m.begin(), m.end());
+  input.insert(input.begin() + input.size() / 2, input[input.size() / 2]);
+  radix_tree<int> loaded;
+  loaded.set_value_encoding(kCompactValues);
+  CHECK(loaded.bulk_load(input.begin(), input.end()) == 1);
+  CHECK(check_queries(rng, loaded, m, 300));
+  return true;
+}
+
+bool test_infix(uint64_t seed) {
+  std::mt19937_64 rng(seed);
+  radix_tree<int> tree;
+  tree.set_infix(true);
+  tree.finish(less_ids(), kTopK);
+  model m;
+  for (int step = 0; step < 3000; ++step) {
+    std::string pattern = random_string(rng, 5);
+    int value = rng() % 100;
+    if (rng() % 4 != 0) {
+      tree.insert(pattern, value);
+      m.emplace(pattern, value);
+      continue;
+    }
+    std::pair<model::iterator, model::iterator> range = m.equal_range(pattern);
+    size_t expected = 0;
+    for (model::iterator it = range.first; it != range.second;) {
+      if (it->second == value) {
+        it = m.erase(it);
+        ++expected;
+      } else {
+        ++it;
+      }
+    }
+    CHECK(tree.erase(pattern, value) == expected);
+  }
+  CHECK(tree.size() == m.size());
+  for (int q = 0; q < 300; ++q) {
+    std::string key = random_string(rng, 3);
+    std::set<int> expected;
+    for (const auto& entry : m) {
+      if (entry.first.find(key) != std::string::npos) {
+        expected.insert(entry.second);
+      }
+    }
+    std::vector<int> values;
+    tree.match(key, values);
+    std::set<int> distinct(values.begin(), values.end());
+    CHECK(distinct.size() == values.size() && distinct == expected);
+    values.clear();
+    tree.match(key, values, less_ids(), kTopK);
+    CHECK(values == top_k(std::vector<int>(expected.begin(), expected.end()),
+                          less_ids(), kTopK));
+  }
+
+  // A view of the frozen tree answers as the tree does: match() gives each
+  // value once, and iterators see the suffixes as patterns.
+  tree.insert("banana", 7);
+  const std::string path = "radix_test_infix.img";
+  CHECK(tree.save(path));
+  radix_tree_view<int> view;
+  CHECK(view.open(path));
+  std::remove(path.c_str());
+  CHECK(view.infix());
+  std::vector<int> values;
+  view.match("an", values);
+  CHECK(std::count(values.begin(), values.end(), 7) == 1);
+  for (int q = 0; q < 300; ++q) {
+    std::string key = random_string(rng, 3);
+    std::vector<int> expected;
+    tree.match(key, expected);
+    values.clear();
+    view.match(key, values);
+    CHECK(values == expected);
+
+    expected.clear();
+    tree.match(key, expected, less_ids(), kTopK);
+    values.clear();
+    view.match(key, values, less_ids(), kTopK);
+    CHECK(values == expected);
+
+    expected.clear();
+    for (radix_tree_iter<int> it = tree.match(key); it.valid(); it.next()) {
+      expected.push_back(it.value());
+    }
+    values.clear();
+    for (radix_tree_view_iter<int> it = view.match(key); it.valid();
+         it.next()) {
+      values.push_back(it.value());
+    }
+    CHECK(values == expected);
+  }
+  return true;
+}
+
+bool parse(int argc, char** argv, uint64_t* seed) {
+  for (int i = 1; i < argc; ++i) {
+    if (strncmp(argv[i], "--seed=", 7) != 0) {
+      return false;
+    }
+    *seed = strtoull(argv[i] + 7, nullptr, 10);
+  }
+  return true;
+}
+
+}  // namespace
+}  // namespace test
+}  // namespace radix
+
+int main(int argc, char** argv) {
+  using namespace radix::test;
+  uint64_t seed = 1;
+  if (!parse(argc, argv, &seed)) {
+    fprintf(stderr, "usage: %s [--seed=S]\n", argv[0]);
+    return 2;
+  }
+  struct {
+    const char* name;
+    bool (*run)(uint64_t);
+  } tests[] = {
+      {"insert_match", test_insert_match},
+      {"erase", test_erase},
+      {"key_store", test_key_store},
+      {"iterators", test_iterators},
+      {"fuzzy", test_fuzzy},
+      {"parallel_finish", test_parallel_finish},
+      {"bulk_load", test_bulk_load},
+      {"view", test_view},
+      {"concurrent", test_concurrent},
+      {"sharded", test_sharded},
+      {"handle", test_handle},
+      {"cache", test_cache},
+      {"adaptive", test_adaptive},
+      {"scored", test_scored},
+      {"compact", test_compact},
+      {"infix", test_infix},
+  };
+  bool ok = true;
+  for (const auto& test : tests) {
+    bool passed = test.run(seed);
+    printf("%-16s %s\n", test.name, passed ? "ok" : "FAILED");
+    ok = ok && passed;
+  }
+  return ok ? 0 : 1;
+}